@@ -0,0 +1,145 @@
+#include "access_trace.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    const char kTraceMagic[8] = { 'O', 'S', 'T', 'R', 'A', 'C', 'E', '1' };
+    const uint64_t kDigestSeed = 0x9e3779b97f4a7c15ULL;
+} // anonymous namespace
+
+AccessTrace::AccessTrace(size_t capacity)
+    : ring(capacity), total(0), hash(kDigestSeed), enabled(true) {}
+
+void AccessTrace::set_capacity(size_t capacity) {
+    ring.assign(capacity, TraceRecord());
+    clear();
+}
+
+void AccessTrace::clear() {
+    total = 0;
+    hash = kDigestSeed;
+}
+
+size_t AccessTrace::retained() const {
+    return total < ring.size() ? static_cast<size_t>(total) : ring.size();
+}
+
+const TraceRecord& AccessTrace::at(size_t i) const {
+    if (i >= retained())
+        throw std::out_of_range("AccessTrace: record " + std::to_string(i) + " is not retained.");
+    uint64_t first = total - retained();
+    return ring[(first + i) % ring.size()];
+}
+
+// File layout: magic, count, digest, number of retained records, then the
+// retained records oldest first.
+void AccessTrace::save(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("AccessTrace: cannot write " + path);
+    uint64_t kept = retained();
+    out.write(kTraceMagic, sizeof(kTraceMagic));
+    out.write(reinterpret_cast<const char*>(&total), sizeof(total));
+    out.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+    out.write(reinterpret_cast<const char*>(&kept), sizeof(kept));
+    for (size_t i = 0; i < kept; i++)
+        out.write(reinterpret_cast<const char*>(&at(i)), sizeof(TraceRecord));
+    if (!out)
+        throw std::runtime_error("AccessTrace: short write to " + path);
+}
+
+AccessTrace AccessTrace::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("AccessTrace: cannot read " + path);
+    char magic[sizeof(kTraceMagic)];
+    uint64_t count = 0, digest = 0, kept = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&count), sizeof(count));
+    in.read(reinterpret_cast<char*>(&digest), sizeof(digest));
+    in.read(reinterpret_cast<char*>(&kept), sizeof(kept));
+    if (!in || std::string(magic, sizeof(magic)) != std::string(kTraceMagic, sizeof(kTraceMagic)))
+        throw std::runtime_error("AccessTrace: " + path + " is not a trace file.");
+    if (kept > count)
+        throw std::runtime_error("AccessTrace: corrupt header in " + path);
+
+    AccessTrace trace(static_cast<size_t>(kept));
+    for (uint64_t i = 0; i < kept; i++)
+        in.read(reinterpret_cast<char*>(&trace.ring[i]), sizeof(TraceRecord));
+    if (!in)
+        throw std::runtime_error("AccessTrace: truncated trace in " + path);
+    // Re-base the ring so at(0) is the first retained record.
+    trace.total = count;
+    trace.hash = digest;
+    if (kept > 0) {
+        std::vector<TraceRecord> rotated(trace.ring.size());
+        for (uint64_t i = 0; i < kept; i++)
+            rotated[(count - kept + i) % kept] = trace.ring[i];
+        trace.ring.swap(rotated);
+    }
+    return trace;
+}
+
+std::string AccessTrace::describe(const TraceRecord& r) {
+    std::ostringstream oss;
+    oss << (r.op == TRACE_WRITE ? "Write" : "Read") << " bucket at level " << r.level
+        << ", index " << r.bucket
+        << ", slots [" << r.offset << ", " << (r.offset + r.length) << ")";
+    return oss.str();
+}
+
+std::vector<std::string> AccessTrace::to_strings() const {
+    std::vector<std::string> lines;
+    lines.reserve(retained());
+    for (size_t i = 0; i < retained(); i++)
+        lines.push_back(describe(at(i)));
+    return lines;
+}
+
+static bool sameRecord(const TraceRecord& x, const TraceRecord& y) {
+    return x.op == y.op && x.level == y.level && x.bucket == y.bucket &&
+           x.offset == y.offset && x.length == y.length;
+}
+
+TraceDiff compare_traces(const AccessTrace& a, const AccessTrace& b) {
+    TraceDiff diff;
+    diff.identical = false;
+    diff.first_mismatch = 0;
+
+    // Walk the records both rings still hold, aligned by record number.
+    uint64_t a_first = a.count() - a.retained();
+    uint64_t b_first = b.count() - b.retained();
+    uint64_t start = a_first > b_first ? a_first : b_first;
+    uint64_t end = a.count() < b.count() ? a.count() : b.count();
+    for (uint64_t n = start; n < end; n++) {
+        const TraceRecord& x = a.at(static_cast<size_t>(n - a_first));
+        const TraceRecord& y = b.at(static_cast<size_t>(n - b_first));
+        if (!sameRecord(x, y)) {
+            diff.first_mismatch = n;
+            diff.detail = "record " + std::to_string(n) + ": " + AccessTrace::describe(x) +
+                          " vs " + AccessTrace::describe(y);
+            // The difference may start before the retained window.
+            if (n == start && start > 0)
+                diff.detail += " (earlier records were not retained)";
+            return diff;
+        }
+    }
+
+    if (a.count() != b.count()) {
+        diff.first_mismatch = end;
+        diff.detail = "trace lengths differ: " + std::to_string(a.count()) + " vs " +
+                      std::to_string(b.count()) + " records";
+        return diff;
+    }
+    if (a.digest() != b.digest()) {
+        diff.first_mismatch = start;
+        diff.detail = "digests differ in records that were not retained (before record " +
+                      std::to_string(start) + ")";
+        return diff;
+    }
+    diff.identical = true;
+    diff.detail = std::to_string(a.count()) + " records, digest identical";
+    return diff;
+}
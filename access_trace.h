@@ -0,0 +1,112 @@
+#ifndef ACCESS_TRACE_H
+#define ACCESS_TRACE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * AccessTrace:
+ * Compact binary record of every access UntrustedMemory serves, cheap
+ * enough to leave on in production.
+ *
+ * Each access is a fixed 16-byte TraceRecord written into a preallocated
+ * ring buffer; nothing is allocated or formatted on the hot path. The ring
+ * keeps the most recent `capacity` records for diagnosis, while a running
+ * 64-bit digest and a count cover every record ever made, so two traces of
+ * any length can be compared even after the ring has wrapped.
+ *
+ * For an oblivious sort, traces of two inputs with the same size must be
+ * identical; trace_diff checks this.
+ */
+enum TraceOp : uint8_t {
+    TRACE_READ = 0,
+    TRACE_WRITE = 1
+};
+
+struct TraceRecord {
+    uint8_t op;        // TraceOp.
+    uint8_t reserved;
+    uint16_t level;
+    uint32_t bucket;
+    uint32_t offset;   // First slot touched within the bucket.
+    uint32_t length;   // Number of slots touched.
+};
+
+class AccessTrace {
+public:
+    explicit AccessTrace(size_t capacity = 1 << 16);
+
+    // Reallocates the ring for `capacity` records and clears the trace.
+    void set_capacity(size_t capacity);
+    void set_enabled(bool on) { enabled = on; }
+    bool is_enabled() const { return enabled; }
+    void clear();
+
+    void record(TraceOp op, int level, int bucket, int offset, int length) {
+        if (!enabled)
+            return;
+        TraceRecord r;
+        r.op = static_cast<uint8_t>(op);
+        r.reserved = 0;
+        r.level = static_cast<uint16_t>(level);
+        r.bucket = static_cast<uint32_t>(bucket);
+        r.offset = static_cast<uint32_t>(offset);
+        r.length = static_cast<uint32_t>(length);
+        hash = mix(hash, r);
+        if (!ring.empty())
+            ring[total % ring.size()] = r;
+        total++;
+    }
+
+    // Total number of records ever made and the digest over all of them.
+    uint64_t count() const { return total; }
+    uint64_t digest() const { return hash; }
+    size_t capacity() const { return ring.size(); }
+    // Records still held by the ring; at(0) is the oldest of them and is
+    // record number count() - retained() of the whole trace.
+    size_t retained() const;
+    const TraceRecord& at(size_t i) const;
+
+    void save(const std::string& path) const;
+    static AccessTrace load(const std::string& path);
+
+    static std::string describe(const TraceRecord& r);
+    // Retained records rendered as text, for the old get_access_log() API.
+    std::vector<std::string> to_strings() const;
+
+private:
+    // Order-sensitive digest step (murmur3 finalizer over the packed record).
+    static uint64_t mix(uint64_t h, const TraceRecord& r) {
+        uint64_t lo = static_cast<uint64_t>(r.op) | (static_cast<uint64_t>(r.level) << 16) |
+                      (static_cast<uint64_t>(r.bucket) << 32);
+        uint64_t hi = static_cast<uint64_t>(r.offset) | (static_cast<uint64_t>(r.length) << 32);
+        return fmix(fmix(h ^ lo) ^ hi);
+    }
+
+    static uint64_t fmix(uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    std::vector<TraceRecord> ring;
+    uint64_t total;
+    uint64_t hash;
+    bool enabled;
+};
+
+// Result of comparing two traces.
+struct TraceDiff {
+    bool identical;
+    uint64_t first_mismatch;  // Record number of the first difference, if known.
+    std::string detail;
+};
+
+TraceDiff compare_traces(const AccessTrace& a, const AccessTrace& b);
+
+#endif // ACCESS_TRACE_H
@@ -0,0 +1,88 @@
+// Benchmark: butterfly time and untrusted-memory traffic vs levels per pass
+// (Enclave::block_levels, AES variant two).
+//
+//   bench_block_levels [n] [payload_size] [Z]
+//
+// Runs the butterfly on the same input with block_levels = 1, 2, ... L and
+// with 0 (chosen from block_cache_bytes). For each it reports the passes over
+// the buckets, the bucket ranges read and written, the time, and whether the
+// sorted output matches the one-level-per-pass run.
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include "oblivious_sort_two.h"
+
+static std::vector<Element> makeInput(int n, int payload_size) {
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<int> sort_dist(0, 1 << 30);
+    std::uniform_int_distribution<int> char_dist('a', 'z');
+    std::vector<Element> input;
+    input.reserve(n);
+    for (int i = 0; i < n; i++) {
+        std::string payload(payload_size, 'a');
+        for (char &c : payload)
+            c = static_cast<char>(char_dist(gen));
+        input.push_back(Element{ sort_dist(gen), 0, false, payload });
+    }
+    return input;
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? std::atoi(argv[1]) : (1 << 16);
+    int payload_size = argc > 2 ? std::atoi(argv[2]) : 64;
+    int Z = argc > 3 ? std::atoi(argv[3]) : 128;
+    if (n <= 0 || payload_size < 0 || Z <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [n] [payload_size] [Z]\n";
+        return 1;
+    }
+
+    std::vector<Element> input = makeInput(n, payload_size);
+    int L;
+    {
+        UntrustedMemory untrusted;
+        L = Enclave<AesCtrPolicy>(&untrusted).computeBucketParameters(n, Z).second;
+    }
+    std::cout << "n=" << n << " payload=" << payload_size << " Z=" << Z << " B=" << (1 << L) << " L=" << L << "\n";
+    std::cout << std::setw(8) << "levels" << std::setw(8) << "passes" << std::setw(12) << "ranges"
+              << std::setw(12) << "ms" << std::setw(12) << "output" << "\n";
+
+    std::vector<Element> reference;
+    bool ok = true;
+    std::vector<int> settings;
+    for (int k = 1; k <= L; k++)
+        settings.push_back(k);
+    settings.push_back(0);
+    for (int k : settings) {
+        UntrustedMemory untrusted;
+        Enclave<AesCtrPolicy> enclave(&untrusted, 2024);
+        enclave.block_levels = k;
+        std::pair<int, int> params = enclave.computeBucketParameters(n, Z);
+        int B = params.first;
+        enclave.initializeBuckets(input, B, Z);
+        untrusted.transitions.clear();
+        auto start = std::chrono::high_resolution_clock::now();
+        enclave.performButterflyNetwork(B, L, Z);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        uint64_t ranges = untrusted.transitions.ranges;
+        std::vector<Element> out = enclave.finalSort(enclave.extractFinalElements(B, L));
+
+        bool same = true;
+        if (k == 1) {
+            reference = out;
+        } else {
+            same = out.size() == reference.size();
+            for (size_t i = 0; same && i < out.size(); i++)
+                same = out[i].sorting == reference[i].sorting && out[i].payload == reference[i].payload;
+        }
+        ok = ok && same;
+        // Each pass reads and writes every bucket once.
+        std::cout << std::setw(8) << (k == 0 ? "auto" : std::to_string(k)) << std::setw(8) << ranges / (2 * B)
+                  << std::setw(12) << ranges << std::setw(12) << std::fixed << std::setprecision(1) << ms
+                  << std::setw(12) << (same ? "identical" : "DIFFERS") << "\n";
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+// Benchmark: binary vs k-ary merge-split (Enclave::arity_bits, AES variant two).
+//
+//   bench_kary_merge [n] [payload_size] [Z] [max_bits]
+//
+// For k = 1 .. max_bits, runs the butterfly with nodes of 2^k buckets and one
+// node level per pass over the buckets (block_levels = k), so it makes
+// ceil(L / k) passes. Fewer passes mean fewer decrypt/route/encrypt rounds
+// per element, but each node sorts 2^k * Z elements instead of 2 * Z, and a
+// bitonic sort costs O(m log^2 m) for m elements. The table shows both sides:
+// the time of one node on its own and the whole butterfly, and checks the
+// sorted output matches the binary run.
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include "oblivious_sort_two.h"
+
+static std::vector<Element> makeInput(int n, int payload_size) {
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<int> sort_dist(0, 1 << 30);
+    std::uniform_int_distribution<int> char_dist('a', 'z');
+    std::vector<Element> input;
+    input.reserve(n);
+    for (int i = 0; i < n; i++) {
+        std::string payload(payload_size, 'a');
+        for (char &c : payload)
+            c = static_cast<char>(char_dist(gen));
+        input.push_back(Element{ sort_dist(gen), 0, false, payload });
+    }
+    return input;
+}
+
+// Milliseconds for one node of 2^bits half-full buckets at level 0.
+static double nodeMs(Enclave<AesCtrPolicy>& enclave, int bits, int L, int Z, int payload_size) {
+    std::mt19937 gen(7);
+    std::vector<std::vector<Element>> buckets(size_t(1) << bits);
+    for (auto& bucket : buckets)
+        for (int s = 0; s < Z; s++)
+            bucket.push_back(s < Z / 2 ? Element{ int(gen()), int(gen() % (1u << L)), false, std::string(payload_size, 'p') }
+                                       : Element{ 0, 0, true, "" });
+    auto start = std::chrono::high_resolution_clock::now();
+    enclave.merge_split_group(buckets, 0, static_cast<int>(buckets.size()), 0, bits, L, Z);
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? std::atoi(argv[1]) : (1 << 16);
+    int payload_size = argc > 2 ? std::atoi(argv[2]) : 64;
+    int Z = argc > 3 ? std::atoi(argv[3]) : 128;
+    int max_bits = argc > 4 ? std::atoi(argv[4]) : 5;
+    if (n <= 0 || payload_size < 0 || Z <= 0 || max_bits <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [n] [payload_size] [Z] [max_bits]\n";
+        return 1;
+    }
+
+    std::vector<Element> input = makeInput(n, payload_size);
+    int L;
+    {
+        UntrustedMemory untrusted;
+        L = Enclave<AesCtrPolicy>(&untrusted).computeBucketParameters(n, Z).second;
+    }
+    std::cout << "n=" << n << " payload=" << payload_size << " Z=" << Z << " B=" << (1 << L) << " L=" << L << "\n";
+    std::cout << std::setw(6) << "k" << std::setw(8) << "ways" << std::setw(8) << "passes" << std::setw(12) << "node ms"
+              << std::setw(14) << "butterfly ms" << std::setw(12) << "output" << "\n";
+
+    std::vector<Element> reference;
+    bool ok = true;
+    for (int k = 1; k <= std::min(max_bits, L); k++) {
+        UntrustedMemory untrusted;
+        Enclave<AesCtrPolicy> enclave(&untrusted, 2024);
+        enclave.arity_bits = k;
+        enclave.block_levels = k;
+        std::pair<int, int> params = enclave.computeBucketParameters(n, Z);
+        int B = params.first;
+        double node_ms = nodeMs(enclave, k, L, Z, payload_size);
+        enclave.initializeBuckets(input, B, Z);
+        untrusted.transitions.clear();
+        auto start = std::chrono::high_resolution_clock::now();
+        enclave.performButterflyNetwork(B, L, Z);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        uint64_t passes = untrusted.transitions.ranges / (2 * B);
+        std::vector<Element> out = enclave.finalSort(enclave.extractFinalElements(B, L));
+
+        bool same = true;
+        if (k == 1) {
+            reference = out;
+        } else {
+            same = out.size() == reference.size();
+            for (size_t i = 0; same && i < out.size(); i++)
+                same = out[i].sorting == reference[i].sorting && out[i].payload == reference[i].payload;
+        }
+        ok = ok && same;
+        std::cout << std::setw(6) << k << std::setw(8) << (1 << k) << std::setw(8) << passes
+                  << std::setw(12) << std::fixed << std::setprecision(2) << node_ms
+                  << std::setw(14) << std::setprecision(1) << ms << std::setw(12) << (same ? "identical" : "DIFFERS")
+                  << "\n";
+    }
+    return ok ? 0 : 1;
+}
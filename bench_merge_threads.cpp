@@ -0,0 +1,98 @@
+// Benchmark: butterfly sort time vs merge-split threads (AES variant two),
+// level by level and as a dataflow graph.
+//
+//   bench_merge_threads [n] [payload_size] [Z] [max_threads]
+//
+// Sorts the same input with Enclave::merge_threads (and crypto_threads) at
+// 1, 2, 4, ... up to max_threads, every run seeded alike: once with a barrier
+// after each level and once with Enclave::dataflow, where a pair starts as
+// soon as its inputs are written. Merge-split only depends on its pair and
+// the final permutation draws one RNG seed per bucket in bucket order, so
+// every run must return exactly the 1-thread output; the benchmark fails if
+// one does not.
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include "oblivious_sort_two.h"
+
+static std::vector<Element> makeInput(int n, int payload_size) {
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<int> sort_dist(0, 1 << 30);
+    std::uniform_int_distribution<int> char_dist('a', 'z');
+    std::vector<Element> input;
+    input.reserve(n);
+    for (int i = 0; i < n; i++) {
+        std::string payload(payload_size, 'a');
+        for (char &c : payload)
+            c = static_cast<char>(char_dist(gen));
+        input.push_back(Element{ sort_dist(gen), 0, false, payload });
+    }
+    return input;
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? std::atoi(argv[1]) : (1 << 15);
+    int payload_size = argc > 2 ? std::atoi(argv[2]) : 64;
+    int Z = argc > 3 ? std::atoi(argv[3]) : 256;
+    int max_threads = argc > 4 ? std::atoi(argv[4])
+                               : static_cast<int>(std::max(4u, std::thread::hardware_concurrency()));
+    if (n <= 0 || payload_size < 0 || Z <= 0 || max_threads <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [n] [payload_size] [Z] [max_threads]\n";
+        return 1;
+    }
+
+    std::vector<Element> input = makeInput(n, payload_size);
+    std::cout << "n=" << n << " payload=" << payload_size << " Z=" << Z
+              << " (" << std::thread::hardware_concurrency() << " hardware threads)\n";
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "levels ms" << std::setw(10) << "speedup"
+              << std::setw(14) << "dataflow ms" << std::setw(10) << "speedup" << std::setw(12) << "output" << "\n";
+
+    std::vector<Element> reference;
+    double serial_ms = 0;
+    bool ok = true;
+    auto sort = [&](int threads, bool dataflow, double& ms) {
+        UntrustedMemory untrusted;
+        Enclave<AesCtrPolicy> enclave(&untrusted, 2024);
+        enclave.merge_threads = threads;
+        enclave.crypto_threads = threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        std::pair<int, int> params = enclave.computeBucketParameters(n, Z);
+        int B = params.first, L = params.second;
+        enclave.initializeBuckets(input, B, Z);
+        if (dataflow)
+            enclave.performButterflyNetworkDataflow(B, L, Z);
+        else
+            enclave.performButterflyNetwork(B, L, Z);
+        std::vector<Element> out = enclave.finalSort(enclave.extractFinalElements(B, L));
+        ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return out;
+    };
+    auto matches = [&](const std::vector<Element>& out) {
+        bool same = out.size() == reference.size();
+        for (size_t i = 0; same && i < out.size(); i++)
+            same = out[i].sorting == reference[i].sorting && out[i].payload == reference[i].payload;
+        return same;
+    };
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double levels_ms, dataflow_ms;
+        std::vector<Element> out = sort(threads, false, levels_ms);
+        if (threads == 1) {
+            reference = out;
+            serial_ms = levels_ms;
+        }
+        std::vector<Element> flow = sort(threads, true, dataflow_ms);
+        bool same = matches(out) && matches(flow);
+        ok = ok && same;
+        std::cout << std::setw(8) << threads << std::fixed << std::setprecision(1)
+                  << std::setw(12) << levels_ms << std::setw(9) << std::setprecision(2) << serial_ms / levels_ms << "x"
+                  << std::setw(14) << std::setprecision(1) << dataflow_ms
+                  << std::setw(9) << std::setprecision(2) << serial_ms / dataflow_ms << "x"
+                  << std::setw(12) << (same ? "identical" : "DIFFERS") << "\n";
+    }
+    return ok ? 0 : 1;
+}
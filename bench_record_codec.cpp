@@ -0,0 +1,166 @@
+// Benchmark: encoding and decoding records, the old string serializer vs
+// RecordCodec, in ns per element and heap allocations per element.
+//
+//   bench_record_codec [Z] [payload_size] [rounds]
+//
+// The string path is what the AES variants did before: serializeElement grew
+// a std::string with one append per field and decryptBucket cut each record
+// out with substr before deserializeElement copied the payload out again. The
+// codec path encodes a bucket straight into one preallocated buffer and
+// decodes it with payload views into that buffer. Allocations are counted by
+// replacing the global operator new.
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+
+#include "record_codec.h"
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+struct Element {
+    int sorting;
+    int key;
+    bool is_dummy;
+    std::string payload;
+};
+
+static const size_t kHeaderBytes = RecordCodec::kHeaderBytes;
+
+static std::string serializeElement(const Element& e, size_t width) {
+    std::string out;
+    out.reserve(width);
+    out.append(reinterpret_cast<const char*>(&e.sorting), sizeof(e.sorting));
+    out.append(reinterpret_cast<const char*>(&e.key), sizeof(e.key));
+    char flag = e.is_dummy ? 1 : 0;
+    out.append(&flag, sizeof(flag));
+    uint32_t size = e.payload.size();
+    out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.append(e.payload);
+    out.resize(width, '\0');
+    return out;
+}
+
+static Element deserializeElement(const std::string& data) {
+    Element e;
+    char flag;
+    uint32_t size;
+    std::memcpy(&e.sorting, data.data(), sizeof(int));
+    std::memcpy(&e.key, data.data() + sizeof(int), sizeof(int));
+    std::memcpy(&flag, data.data() + 2 * sizeof(int), sizeof(flag));
+    std::memcpy(&size, data.data() + 2 * sizeof(int) + 1, sizeof(size));
+    e.is_dummy = flag != 0;
+    e.payload = data.substr(kHeaderBytes, size);
+    return e;
+}
+
+int main(int argc, char* argv[]) {
+    int Z = argc > 1 ? std::atoi(argv[1]) : 512;
+    int payload_size = argc > 2 ? std::atoi(argv[2]) : 64;
+    int rounds = argc > 3 ? std::atoi(argv[3]) : 200;
+    if (Z <= 0 || payload_size < 0 || rounds <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [Z] [payload_size] [rounds]\n";
+        return 1;
+    }
+    size_t width = kHeaderBytes + payload_size;
+
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<int> char_dist('a', 'z');
+    std::vector<Element> bucket(Z);
+    for (auto& e : bucket) {
+        e.sorting = static_cast<int>(gen());
+        e.key = static_cast<int>(gen() % Z);
+        e.is_dummy = gen() % 4 == 0;
+        e.payload.resize(gen() % (payload_size + 1));
+        for (char& c : e.payload)
+            c = static_cast<char>(char_dist(gen));
+    }
+    double elements = static_cast<double>(Z) * rounds;
+    auto now = [] { return std::chrono::high_resolution_clock::now(); };
+    auto ns = [&](std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration<double, std::nano>(now() - start).count() / elements;
+    };
+
+    // String path.
+    std::string joined;
+    joined.reserve(width * Z);
+    size_t before = allocations;
+    auto start = now();
+    for (int r = 0; r < rounds; r++) {
+        joined.clear();
+        for (const auto& e : bucket)
+            joined.append(serializeElement(e, width));
+    }
+    double string_encode = ns(start);
+    double string_encode_allocs = (allocations - before) / elements;
+    std::vector<Element> decoded;
+    decoded.reserve(Z);
+    before = allocations;
+    start = now();
+    long checksum = 0;
+    for (int r = 0; r < rounds; r++) {
+        decoded.clear();
+        for (int i = 0; i < Z; i++)
+            decoded.push_back(deserializeElement(joined.substr(i * width, width)));
+        checksum += decoded[r % Z].payload.size();
+    }
+    double string_decode = ns(start);
+    double string_decode_allocs = (allocations - before) / elements;
+    bool ok = true;
+    for (int i = 0; i < Z; i++)
+        ok = ok && decoded[i].sorting == bucket[i].sorting && decoded[i].payload == bucket[i].payload;
+
+    // Codec path: one buffer, views into it.
+    RecordCodec codec(width);
+    BucketView<const Element> view = make_bucket_view(bucket);
+    std::string buffer(width * Z, '\0');
+    before = allocations;
+    start = now();
+    for (int r = 0; r < rounds; r++)
+        codec.encodeBucket(view, &buffer[0]);
+    double codec_encode = ns(start);
+    double codec_encode_allocs = (allocations - before) / elements;
+    ok = ok && buffer == joined;
+    before = allocations;
+    start = now();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < Z; i++) {
+            RecordFields f = codec.decode(&buffer[i * width]);
+            checksum += f.sorting + f.payload.size;
+        }
+    double codec_decode = ns(start);
+    double codec_decode_allocs = (allocations - before) / elements;
+    for (int i = 0; i < Z; i++) {
+        RecordFields f = codec.decode(&buffer[i * width]);
+        ok = ok && f.sorting == bucket[i].sorting && f.key == bucket[i].key && f.is_dummy == bucket[i].is_dummy &&
+             bucket[i].payload.compare(0, std::string::npos, f.payload.data, f.payload.size) == 0;
+    }
+
+    std::cout << "Z=" << Z << " record=" << width << " bytes, " << rounds << " rounds (checksum " << checksum << ")\n";
+    std::cout << std::setw(8) << "path" << std::setw(14) << "encode ns" << std::setw(14) << "decode ns"
+              << std::setw(16) << "encode allocs" << std::setw(16) << "decode allocs" << "\n";
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::setw(8) << "string" << std::setw(14) << string_encode << std::setw(14) << string_decode
+              << std::setw(16) << string_encode_allocs << std::setw(16) << string_decode_allocs << "\n";
+    std::cout << std::setw(8) << "codec" << std::setw(14) << codec_encode << std::setw(14) << codec_decode
+              << std::setw(16) << codec_encode_allocs << std::setw(16) << codec_decode_allocs << "\n";
+    std::cout << "speedup: encode " << string_encode / codec_encode << "x, decode " << string_decode / codec_decode
+              << "x; records " << (ok ? "identical" : "DIFFER") << "\n";
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#ifndef BUCKET_BATCH_H
+#define BUCKET_BATCH_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "bucket_view.h"
+
+/*
+ * Vectored bucket access:
+ * Every call from the enclave into UntrustedMemory stands for one enclave
+ * transition (an ocall). read_buckets/write_buckets (and view_buckets/
+ * bucket_slots) serve a whole list of bucket ranges in one call, so a stage
+ * that touches k ranges pays one transition instead of k.
+ */
+struct BucketRange {
+    int level;
+    int bucket;
+    int offset; // First slot of the range.
+    int length; // Number of slots.
+};
+
+struct TransitionStats {
+    uint64_t transitions = 0; // Calls into UntrustedMemory.
+    uint64_t ranges = 0;      // Bucket ranges served by those calls.
+
+    void count(size_t n) {
+        transitions++;
+        ranges += n;
+    }
+    // Transitions avoided compared to one call per range.
+    uint64_t saved() const { return ranges - transitions; }
+    void clear() { transitions = ranges = 0; }
+};
+
+// End of the batch starting at `first` when at most `budget` ranges may go in
+// one transition (budget <= 0 means no limit).
+inline size_t batch_end(size_t first, size_t total, int budget) {
+    if (budget <= 0 || total - first <= static_cast<size_t>(budget))
+        return total;
+    return first + budget;
+}
+
+// How many units of `unit_ranges` ranges each fit in one transition (at least
+// one, so a unit larger than the budget is split by batch_end instead).
+inline int units_per_batch(int budget, int unit_ranges, int total_units) {
+    if (budget <= 0)
+        return total_units;
+    int units = budget / unit_ranges;
+    return units < 1 ? 1 : units;
+}
+
+template <typename T>
+std::vector<BucketView<const T>> make_bucket_views(const std::vector<std::vector<T>>& buckets) {
+    std::vector<BucketView<const T>> views;
+    views.reserve(buckets.size());
+    for (const auto& b : buckets)
+        views.push_back(make_bucket_view(b));
+    return views;
+}
+
+#endif // BUCKET_BATCH_H
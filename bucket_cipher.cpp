@@ -0,0 +1,267 @@
+#include "bucket_cipher.h"
+
+#include <cryptopp/aes.h>
+#include <cryptopp/modes.h>
+#include <cryptopp/gcm.h>
+#include <cryptopp/osrng.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using namespace CryptoPP;
+
+namespace {
+    // Keystream a single nonce may cover: 2^32 AES blocks.
+    const uint64_t kMaxStreamBytes = uint64_t(1) << 36;
+
+    void putBE(byte* out, uint32_t v, int bytes) {
+        for (int i = bytes - 1; i >= 0; i--, v >>= 8)
+            out[i] = static_cast<byte>(v);
+    }
+
+    // Counter block (or GCM IV, its first 12 bytes) of a nonce.
+    void counterBlock(const CtrNonce& nonce, byte* iv) {
+        if (nonce.level < 0 || nonce.level > 0xFF || nonce.bucket < 0 || nonce.bucket > 0xFFFFFF)
+            throw std::out_of_range("BucketCipher: level or bucket does not fit the nonce.");
+        putBE(iv, nonce.run, 4);
+        putBE(iv + 4, nonce.epoch, 4);
+        putBE(iv + 8, static_cast<uint32_t>(nonce.level), 1);
+        putBE(iv + 9, static_cast<uint32_t>(nonce.bucket), 3);
+        putBE(iv + 12, 0, 4);
+    }
+
+    // Associated data of a sealed range: its first slot, length and write pass.
+    void rangeAad(int first_slot, int slots, uint32_t pass, byte* aad) {
+        putBE(aad, static_cast<uint32_t>(first_slot), 4);
+        putBE(aad + 4, static_cast<uint32_t>(slots), 4);
+        putBE(aad + 8, pass, 4);
+    }
+
+    // A fresh random key, wiped when it goes out of scope.
+    struct RandomKey {
+        byte bytes[BucketCipher::kKeyBytes];
+        RandomKey() {
+            AutoSeededRandomPool prng;
+            prng.GenerateBlock(bytes, sizeof(bytes));
+        }
+        ~RandomKey() { std::memset(bytes, 0, sizeof(bytes)); }
+    };
+
+    // Best of three passes over 1 MiB, in seconds.
+    double timeCipher(StreamCipher which) {
+        BucketCipher cipher;
+        cipher.use(which);
+        std::string buffer(1 << 20, '\0');
+        double best = 0;
+        for (int pass = 0; pass < 3; pass++) {
+            auto start = std::chrono::steady_clock::now();
+            cipher.process(buffer, CtrNonce{ 0, static_cast<uint32_t>(pass), 0, 0 });
+            double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (pass == 0 || s < best)
+                best = s;
+        }
+        return best;
+    }
+
+    void requireAes(StreamCipher selected) {
+        if (selected != StreamCipher::AES)
+            throw std::logic_error("BucketCipher: GCM records need the AES stream cipher.");
+    }
+
+    uint32_t take(std::atomic<uint32_t>& counter, const char* what) {
+        uint32_t id = counter++;
+        if (id == UINT32_MAX)
+            throw std::overflow_error(std::string("BucketCipher: out of ") + what + " ids.");
+        return id;
+    }
+} // anonymous namespace
+
+RecordMode record_mode_from_env() {
+    const char* value = std::getenv("RECORD_MODE");
+    if (!value || !*value || std::strcmp(value, "ctr") == 0)
+        return RecordMode::CTR;
+    if (std::strcmp(value, "gcm") == 0)
+        return RecordMode::GCM;
+    throw std::invalid_argument(std::string("RECORD_MODE: expected ctr or gcm, got ") + value);
+}
+
+StreamCipher record_cipher_from_env() {
+    const char* value = std::getenv("RECORD_CIPHER");
+    if (!value || !*value)
+        return kDefaultStreamCipher;
+    if (std::strcmp(value, "aes") == 0)
+        return StreamCipher::AES;
+    if (std::strcmp(value, "chacha20") == 0)
+        return StreamCipher::ChaCha20;
+    if (std::strcmp(value, "auto") == 0)
+        return fastest_stream_cipher();
+    throw std::invalid_argument(std::string("RECORD_CIPHER: expected aes, chacha20 or auto, got ") + value);
+}
+
+StreamCipher fastest_stream_cipher() {
+    static const StreamCipher fastest =
+        timeCipher(StreamCipher::ChaCha20) < timeCipher(StreamCipher::AES) ? StreamCipher::ChaCha20 : StreamCipher::AES;
+    return fastest;
+}
+
+const char* stream_cipher_name(StreamCipher cipher) {
+    return cipher == StreamCipher::ChaCha20 ? "ChaCha20" : "AES-CTR";
+}
+
+// Subkeys of a key: its ChaCha20 keystream under a nonce no record ever uses
+// (run id UINT32_MAX is never handed out), bytes 0-31 for ChaCha20 and
+// 32-47 for AES.
+struct BucketCipher::Subkeys {
+    byte chacha[ChaCha20::kKeyBytes];
+    byte aes[AES::DEFAULT_KEYLENGTH];
+
+    explicit Subkeys(const byte* key) {
+        byte stream[sizeof(chacha) + sizeof(aes)] = { 0 };
+        byte nonce[ChaCha20::kNonceBytes];
+        std::memset(nonce, 0xFF, sizeof(nonce));
+        ChaCha20(key).process(stream, sizeof(stream), nonce, 0);
+        std::memcpy(chacha, stream, sizeof(chacha));
+        std::memcpy(aes, stream + sizeof(chacha), sizeof(aes));
+        std::memset(stream, 0, sizeof(stream));
+    }
+    ~Subkeys() {
+        std::memset(chacha, 0, sizeof(chacha));
+        std::memset(aes, 0, sizeof(aes));
+    }
+};
+
+struct BucketCipher::Context {
+    CTR_Mode<AES>::Encryption ctr;
+    GCM<AES>::Encryption gcm_seal;
+    GCM<AES>::Decryption gcm_open;
+
+    explicit Context(const byte* key) {
+        byte zero[AES::BLOCKSIZE] = { 0 };
+        ctr.SetKeyWithIV(key, AES::DEFAULT_KEYLENGTH, zero);
+        gcm_seal.SetKey(key, AES::DEFAULT_KEYLENGTH);
+        gcm_open.SetKey(key, AES::DEFAULT_KEYLENGTH);
+    }
+};
+
+BucketCipher::BucketCipher() : BucketCipher(RandomKey().bytes) {}
+
+BucketCipher::BucketCipher(const uint8_t* k) : BucketCipher(Subkeys(k)) {}
+
+BucketCipher::BucketCipher(const Subkeys& keys)
+    : chacha(keys.chacha), selected(kDefaultStreamCipher), processed(0), runs(0), epochs(0) {
+    static_assert(sizeof(aes_key) == sizeof(keys.aes), "AES subkey size");
+    std::memcpy(aes_key, keys.aes, sizeof(aes_key));
+}
+
+BucketCipher::~BucketCipher() {
+    std::memset(aes_key, 0, sizeof(aes_key));
+}
+
+uint32_t BucketCipher::new_run() {
+    return take(runs, "run");
+}
+
+uint32_t BucketCipher::new_epoch() {
+    return take(epochs, "epoch");
+}
+
+BucketCipher::Lease BucketCipher::lease() {
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (!idle.empty()) {
+            Context* ctx = idle.back();
+            idle.pop_back();
+            return Lease(this, ctx);
+        }
+    }
+    // Key expansion happens outside the lock; two threads that find the pool
+    // empty at once each key their own context.
+    std::unique_ptr<Context> fresh(new Context(aes_key));
+    Context* ctx = fresh.get();
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    idle.reserve(pool.size() + 1);
+    pool.push_back(std::move(fresh));
+    return Lease(this, ctx);
+}
+
+size_t BucketCipher::contexts() const {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return pool.size();
+}
+
+BucketCipher::Lease::~Lease() {
+    if (!ctx)
+        return;
+    // Cannot throw: idle has room for every context in the pool.
+    std::lock_guard<std::mutex> lock(owner->pool_mutex);
+    owner->idle.push_back(ctx);
+}
+
+void BucketCipher::Lease::process(uint8_t* data, size_t len, const CtrNonce& nonce, uint64_t stream_offset) {
+    if (len == 0)
+        return;
+    if (stream_offset + len > kMaxStreamBytes)
+        throw std::out_of_range("BucketCipher: bucket exceeds the keystream of one nonce.");
+    byte iv[AES::BLOCKSIZE];
+    counterBlock(nonce, iv);
+    if (owner->selected == StreamCipher::ChaCha20) {
+        // The first 12 bytes of the counter block are the ChaCha20 nonce.
+        owner->chacha.process(data, len, iv, stream_offset);
+        owner->processed += len;
+        return;
+    }
+    // New counter block, then the offset: no re-keying, no allocation.
+    ctx->ctr.Resynchronize(iv, sizeof(iv));
+    if (stream_offset != 0)
+        ctx->ctr.Seek(stream_offset);
+    ctx->ctr.ProcessData(data, data, len);
+    owner->processed += len;
+}
+
+void BucketCipher::Lease::process(std::string& buffer, const CtrNonce& nonce, uint64_t stream_offset) {
+    if (!buffer.empty())
+        process(reinterpret_cast<uint8_t*>(&buffer[0]), buffer.size(), nonce, stream_offset);
+}
+
+void BucketCipher::Lease::seal(std::string& buffer, const CtrNonce& nonce, int first_slot, int slots, uint32_t pass,
+                               uint8_t* tag) {
+    requireAes(owner->selected);
+    if (buffer.size() > kMaxStreamBytes)
+        throw std::out_of_range("BucketCipher: range exceeds the keystream of one nonce.");
+    byte iv[AES::BLOCKSIZE], aad[12];
+    counterBlock(nonce, iv);
+    rangeAad(first_slot, slots, pass, aad);
+    byte* data = reinterpret_cast<byte*>(&buffer[0]);
+    ctx->gcm_seal.EncryptAndAuthenticate(data, tag, kTagBytes, iv, 12, aad, sizeof(aad), data, buffer.size());
+    owner->processed += buffer.size();
+}
+
+bool BucketCipher::Lease::open(std::string& buffer, const CtrNonce& nonce, int first_slot, int slots, uint32_t pass,
+                               const uint8_t* tag) {
+    requireAes(owner->selected);
+    byte iv[AES::BLOCKSIZE], aad[12];
+    counterBlock(nonce, iv);
+    rangeAad(first_slot, slots, pass, aad);
+    byte* data = reinterpret_cast<byte*>(&buffer[0]);
+    owner->processed += buffer.size();
+    return ctx->gcm_open.DecryptAndVerify(data, tag, kTagBytes, iv, 12, aad, sizeof(aad), data, buffer.size());
+}
+
+void BucketCipher::process(uint8_t* data, size_t len, const CtrNonce& nonce, uint64_t stream_offset) {
+    lease().process(data, len, nonce, stream_offset);
+}
+
+void BucketCipher::process(std::string& buffer, const CtrNonce& nonce, uint64_t stream_offset) {
+    lease().process(buffer, nonce, stream_offset);
+}
+
+void BucketCipher::seal(std::string& buffer, const CtrNonce& nonce, int first_slot, int slots, uint32_t pass, uint8_t* tag) {
+    lease().seal(buffer, nonce, first_slot, slots, pass, tag);
+}
+
+bool BucketCipher::open(std::string& buffer, const CtrNonce& nonce, int first_slot, int slots, uint32_t pass,
+                        const uint8_t* tag) {
+    return lease().open(buffer, nonce, first_slot, slots, pass, tag);
+}
@@ -0,0 +1,169 @@
+#ifndef BUCKET_CIPHER_H
+#define BUCKET_CIPHER_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "chacha20.h"
+
+/*
+ * BucketCipher:
+ * AES-CTR over a whole bucket at once. The serialized records of a bucket (or
+ * of a block of it) are laid out back to back in one buffer, and the buffer
+ * goes through a single ProcessData call on a CTR context that is keyed once
+ * and reused. A 512-slot bucket therefore pays for one IV setup instead of 512
+ * CTR objects, key schedules and StringSource/StreamTransformationFilter
+ * pipelines.
+ *
+ * Nonces are derived from where and when a record was written. Every sort
+ * takes a run id and every encrypted range a fresh write epoch, and the
+ * initial CTR counter block of a bucket is
+ *     run id (32 bits) | epoch (32) | level (8) | bucket (24) | block (32)
+ * A record's keystream starts at its byte offset in the bucket (slot * record
+ * width), so no two records ever share keystream under one key. Given its
+ * position and epoch, any block of any bucket decrypts on its own, in any
+ * order.
+ *
+ * In RecordMode::GCM a stored range (a bucket, or a WORKING_SIZE block in the
+ * constant variant) is sealed with AES-GCM instead. The first 96 bits of the
+ * same nonce are the IV, and the range's first slot and length are
+ * authenticated with it. The range carries one 16-byte tag, not one tag per
+ * element, and opens only at the position it was sealed for.
+ *
+ * The epoch comes back from untrusted memory along with the record, so on
+ * its own it cannot tell a range from an older copy of itself. The caller
+ * therefore also authenticates a write pass: how many times the range had
+ * been sealed before in this run. The enclave knows that count from its
+ * data-independent schedule, so an older copy of the range (a rollback)
+ * fails the tag check.
+ *
+ * The keystream itself comes from AES-CTR or, with StreamCipher::ChaCha20,
+ * from ChaCha20 (chacha20.h) under the same 96-bit nonce: run id | epoch |
+ * level | bucket, with the block counter derived from the byte offset. Hosts
+ * without AES-NI run ChaCha20 several times faster than table-based AES.
+ * GCM is AES-only. The cipher is picked at build time (-DBUCKET_CIPHER_CHACHA20
+ * makes ChaCha20 the default) or at run time (RECORD_CIPHER, use()).
+ *
+ * Every method is thread-safe. The key is fixed at construction; the keyed
+ * CTR and GCM contexts (their AES key schedules and GHASH tables expanded
+ * once) live in a pool. A worker takes one with lease() and has it to itself
+ * until the Lease goes out of scope, so threads never share a context and never
+ * re-key. process(), seal() and open() on the cipher itself lease a context for
+ * the one call. The pool grows to the number of threads that ever used the
+ * cipher at the same time and no further.
+ */
+enum class RecordMode { CTR, GCM };
+
+// RECORD_MODE=ctr (the default) or gcm; anything else throws std::invalid_argument.
+RecordMode record_mode_from_env();
+
+enum class StreamCipher { AES, ChaCha20 };
+
+#ifdef BUCKET_CIPHER_CHACHA20
+const StreamCipher kDefaultStreamCipher = StreamCipher::ChaCha20;
+#else
+const StreamCipher kDefaultStreamCipher = StreamCipher::AES;
+#endif
+
+// RECORD_CIPHER=aes, chacha20 or auto (fastest_stream_cipher()); unset gives
+// kDefaultStreamCipher and anything else throws std::invalid_argument.
+StreamCipher record_cipher_from_env();
+// Times both ciphers on this CPU once and returns the faster.
+StreamCipher fastest_stream_cipher();
+const char* stream_cipher_name(StreamCipher cipher);
+
+struct CtrNonce {
+    uint32_t run;
+    uint32_t epoch;
+    int level;   // 0..255
+    int bucket;  // 0..2^24-1
+};
+
+class BucketCipher {
+    struct Context;  // Keeps Crypto++ out of this header.
+    struct Subkeys;
+
+public:
+    // The key only derives two independent subkeys, one for AES-128 and one
+    // for ChaCha20, so the two ciphers never share key material.
+    static const size_t kKeyBytes = 32;
+    static const size_t kTagBytes = 16;
+
+    // Exclusive use of one pooled context; see process(), seal() and open()
+    // below for what the calls do.
+    class Lease {
+    public:
+        Lease(Lease&& other) : owner(other.owner), ctx(other.ctx) { other.ctx = nullptr; }
+        ~Lease();
+
+        void process(uint8_t* data, size_t len, const CtrNonce& nonce, uint64_t stream_offset = 0);
+        void process(std::string& buffer, const CtrNonce& nonce, uint64_t stream_offset = 0);
+        void seal(std::string& buffer, const CtrNonce& nonce, int first_slot, int slots, uint32_t pass, uint8_t* tag);
+        bool open(std::string& buffer, const CtrNonce& nonce, int first_slot, int slots, uint32_t pass, const uint8_t* tag);
+
+    private:
+        friend class BucketCipher;
+        Lease(BucketCipher* owner, Context* ctx) : owner(owner), ctx(ctx) {}
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        BucketCipher* owner;
+        Context* ctx;
+    };
+
+    // Random key.
+    BucketCipher();
+    explicit BucketCipher(const uint8_t* key);
+    ~BucketCipher();
+
+    // Ids that are never handed out twice by this cipher (so never twice
+    // under its key). Throws std::overflow_error when the 32 bits run out.
+    uint32_t new_run();
+    uint32_t new_epoch();
+
+    // An idle context, or a new one keyed from the cipher's key.
+    Lease lease();
+
+    // Cipher of process() from now on (kDefaultStreamCipher until changed). seal() and open()
+    // throw std::logic_error under ChaCha20.
+    void use(StreamCipher cipher) { selected = cipher; }
+    StreamCipher stream_cipher() const { return selected; }
+
+    // Encrypts or decrypts (CTR is symmetric) `len` bytes in place, starting
+    // `stream_offset` bytes into the keystream of `nonce`.
+    void process(uint8_t* data, size_t len, const CtrNonce& nonce, uint64_t stream_offset = 0);
+    void process(std::string& buffer, const CtrNonce& nonce, uint64_t stream_offset = 0);
+
+    // AES-GCM over the `slots` records starting at `first_slot`, laid out in
+    // `buffer`, written for the `pass`-th time: encrypts in place and writes
+    // kTagBytes of tag. open() verifies and decrypts in place, and fails for
+    // any other position or pass; on false the buffer contents are unspecified.
+    void seal(std::string& buffer, const CtrNonce& nonce, int first_slot, int slots, uint32_t pass, uint8_t* tag);
+    bool open(std::string& buffer, const CtrNonce& nonce, int first_slot, int slots, uint32_t pass, const uint8_t* tag);
+
+    // Bytes run through the cipher so far.
+    uint64_t bytes_processed() const { return processed; }
+    // Contexts keyed so far.
+    size_t contexts() const;
+
+private:
+    explicit BucketCipher(const Subkeys& keys);
+    BucketCipher(const BucketCipher&) = delete;
+    BucketCipher& operator=(const BucketCipher&) = delete;
+
+    uint8_t aes_key[16];
+    ChaCha20 chacha;
+    std::atomic<StreamCipher> selected;
+    mutable std::mutex pool_mutex;
+    std::vector<std::unique_ptr<Context>> pool;
+    std::vector<Context*> idle;
+    std::atomic<uint64_t> processed;
+    std::atomic<uint32_t> runs, epochs;
+};
+
+#endif // BUCKET_CIPHER_H
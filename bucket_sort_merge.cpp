@@ -1,17 +1,20 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <memory>
 #include <vector>
 #include <string>
 #include "nlohmann/json.hpp"
 #include "oblivious_sort_merge.h"
 #include <chrono>
+#include <thread>
 
 using json = nlohmann::json;
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <input_file>\n";
+        std::cerr << "Usage: " << argv[0] << " <input_file> [storage_backend]\n";
         return 1;
     }
     
@@ -39,6 +42,45 @@ int main(int argc, char* argv[]) {
     // Create an UntrustedMemory and Enclave.
     UntrustedMemory untrusted;
     Enclave enclave(&untrusted);
+    // Per-phase projection of the SGX boundary costs (see enclave_cost.h).
+    EnclaveCostSimulator cost(sgx_model_from_env());
+    enclave.cost = &cost;
+    // RECORD_MODE=gcm seals every stored range with AES-GCM (see bucket_cipher.h).
+    // RECORD_CIPHER=chacha20 (or auto, on a CPU where it is faster) swaps the
+    // AES-CTR keystream for ChaCha20; GCM records need AES.
+    try {
+        enclave.record_mode = record_mode_from_env();
+        enclave.cipher.use(record_cipher_from_env());
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    if (enclave.record_mode == RecordMode::GCM && enclave.cipher.stream_cipher() != StreamCipher::AES) {
+        std::cerr << "Error: RECORD_MODE=gcm needs the AES stream cipher, not "
+                  << stream_cipher_name(enclave.cipher.stream_cipher()) << ".\n";
+        return 1;
+    }
+    if (enclave.record_mode == RecordMode::GCM)
+        std::cout << "Record mode: AES-GCM, one tag per stored range.\n";
+    std::cout << "Record cipher: " << stream_cipher_name(enclave.cipher.stream_cipher()) << ".\n";
+    // Encrypt and decrypt the ranges of each batch on every core.
+    enclave.crypto_threads = std::max(1u, std::thread::hardware_concurrency());
+    // Optional: keep the buckets in a storage backend instead of RAM
+    // (memory, mmap:<path>, remote:<latency_ms>[:<MBps>], remote@<host>:<port>).
+    std::unique_ptr<StorageBackend> backend;
+    if (argc > 2) {
+        size_t max_payload = 0;
+        for (const auto& row : inputRows)
+            max_payload = std::max(max_payload, row.payload.size());
+        try {
+            backend = make_storage_backend(argv[2]);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        untrusted.use_backend(backend.get(), enclave.recordBytes(max_payload));
+        std::cout << "Using " << backend->name() << " storage backend (" << argv[2] << ").\n";
+    }
     
     // Choose a bucket size (e.g., 32).
     int bucket_size = 512;
@@ -51,6 +93,12 @@ int main(int argc, char* argv[]) {
     std::cout << "Done oblivious bucket sort with bucket size " << bucket_size << "...\n";
     std::chrono::duration<double> elapsed = end - start;
     std::cout << "Elapsed time: " << elapsed.count() << " s\n";
+    if (backend)
+        std::cout << "Backend requests: " << backend->stats().requests << " (" << backend->stats().bytes_read
+                  << " bytes read, " << backend->stats().bytes_written << " bytes written)\n";
+    std::cout << "Enclave transitions: " << untrusted.transitions.transitions << " ("
+              << untrusted.transitions.saved() << " saved by batching)\n";
+    std::cout << cost.report();
     // Write the sorted output to a file as a valid JSON array.
     std::string outputFileName = "sorted_output_oblivious.json";
     std::ofstream ofs(outputFileName);
@@ -6,6 +6,7 @@
 #include <string>
 #include <cctype>
 #include <algorithm>
+#include <memory>
 #include "nlohmann/json.hpp"
 #include "oblivious_sort_string.h"
 
@@ -24,7 +25,7 @@ std::string trim(const std::string &s) {
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <input_file>\n";
+        std::cerr << "Usage: " << argv[0] << " <input_file> [storage_backend]\n";
         return 1;
     }
     
@@ -64,6 +65,25 @@ int main(int argc, char* argv[]) {
     // Create an UntrustedMemory and Enclave.
     UntrustedMemory untrusted;
     Enclave enclave(&untrusted);
+    // Per-phase projection of the SGX boundary costs (see enclave_cost.h).
+    EnclaveCostSimulator cost(sgx_model_from_env());
+    enclave.cost = &cost;
+    // Optional: keep the buckets in a storage backend instead of RAM
+    // (memory, mmap:<path>, remote:<latency_ms>[:<MBps>], remote@<host>:<port>).
+    std::unique_ptr<StorageBackend> backend;
+    if (argc > 2) {
+        size_t max_payload = 0;
+        for (const auto& value : inputValues)
+            max_payload = std::max(max_payload, value.size());
+        try {
+            backend = make_storage_backend(argv[2]);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        untrusted.use_backend(backend.get(), Enclave::recordBytes(max_payload));
+        std::cout << "Using " << backend->name() << " storage backend (" << argv[2] << ").\n";
+    }
     
     // Choose a bucket size (experiment with this value, e.g. 16, 32, or 64).
     int bucket_size = 32;
@@ -71,6 +91,12 @@ int main(int argc, char* argv[]) {
     
     // Sort the strings using your oblivious_sort (make sure it supports strings).
     std::vector<std::string> sortedOblivious = enclave.oblivious_sort(inputValues, bucket_size);
+    if (backend)
+        std::cout << "Backend requests: " << backend->stats().requests << " (" << backend->stats().bytes_read
+                  << " bytes read, " << backend->stats().bytes_written << " bytes written)\n";
+    std::cout << "Enclave transitions: " << untrusted.transitions.transitions << " ("
+              << untrusted.transitions.saved() << " saved by batching)\n";
+    std::cout << cost.report();
     
     // Write the sorted output to a file as a valid JSON array.
     std::string outputFileName = "sorted_output_oblivious.json";
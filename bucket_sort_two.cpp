@@ -3,15 +3,19 @@
 #include <sstream>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <memory>
 #include "nlohmann/json.hpp"
 #include "oblivious_sort_two.h"
 #include <chrono>
+#include <thread>
+#include <cstdlib>
 
 using json = nlohmann::json;
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <input_file>\n";
+        std::cerr << "Usage: " << argv[0] << " <input_file> [storage_backend]\n";
         return 1;
     }
     
@@ -38,7 +42,75 @@ int main(int argc, char* argv[]) {
     
     // Create an UntrustedMemory and Enclave.
     UntrustedMemory untrusted;
-    Enclave enclave(&untrusted);
+    Enclave<AesCtrPolicy> enclave(&untrusted);
+    // Per-phase projection of the SGX boundary costs (see enclave_cost.h).
+    EnclaveCostSimulator cost(sgx_model_from_env());
+    enclave.cost = &cost;
+    // RECORD_MODE=gcm seals every stored range with AES-GCM (see bucket_cipher.h).
+    // RECORD_CIPHER=chacha20 (or auto, on a CPU where it is faster) swaps the
+    // AES-CTR keystream for ChaCha20; GCM records need AES.
+    try {
+        enclave.record_mode = record_mode_from_env();
+        enclave.cipher.use(record_cipher_from_env());
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    if (enclave.record_mode == RecordMode::GCM && enclave.cipher.stream_cipher() != StreamCipher::AES) {
+        std::cerr << "Error: RECORD_MODE=gcm needs the AES stream cipher, not "
+                  << stream_cipher_name(enclave.cipher.stream_cipher()) << ".\n";
+        return 1;
+    }
+    if (enclave.record_mode == RecordMode::GCM)
+        std::cout << "Record mode: AES-GCM, one tag per stored range.\n";
+    std::cout << "Record cipher: " << stream_cipher_name(enclave.cipher.stream_cipher()) << ".\n";
+    // Encrypt and decrypt the ranges of each batch on every core.
+    enclave.crypto_threads = std::max(1u, std::thread::hardware_concurrency());
+    // Merge-split on every core as well, each pair as soon as its inputs are
+    // written rather than level by level (see performButterflyNetworkDataflow).
+    enclave.merge_threads = enclave.crypto_threads;
+    enclave.dataflow = true;
+    // Take as many levels per pass over the buckets as fit in about 1 MiB.
+    enclave.block_levels = 0;
+    // BUTTERFLY_ARITY=k merge-splits 2^k buckets per node on k key bits at once
+    // (see bench_kary_merge for the trade-off).
+    if (const char* arity = std::getenv("BUTTERFLY_ARITY")) {
+        enclave.arity_bits = std::max(1, std::atoi(arity));
+        std::cout << "Butterfly arity: " << (1 << enclave.arity_bits) << " buckets per merge-split.\n";
+    }
+    // BUTTERFLY_TOPOLOGY=standard|bit-reversed|in-place picks the bucket pairing
+    // schedule (butterfly_topology.h); blocking and k-ary nodes need in-place.
+    if (const char* topology = std::getenv("BUTTERFLY_TOPOLOGY")) {
+        try {
+            enclave.topology = topology_from_name(topology);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        if (enclave.arity_bits > 1 && enclave.topology != TopologyKind::InPlace) {
+            std::cerr << "Error: BUTTERFLY_ARITY needs the in-place topology.\n";
+            return 1;
+        }
+        std::cout << "Butterfly topology: " << topology_name(enclave.topology) << ".\n";
+    }
+    // Optional: keep the buckets in a storage backend instead of RAM
+    // (memory, mmap:<path>, remote:<latency_ms>[:<MBps>], remote@<host>:<port>).
+    std::unique_ptr<StorageBackend> backend;
+    if (argc > 2) {
+        size_t max_payload = 0;
+        for (const auto& row : inputRows)
+            max_payload = std::max(max_payload, row.payload.size());
+        try {
+            backend = make_storage_backend(argv[2]);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        untrusted.use_backend(backend.get(), enclave.recordBytes(max_payload));
+        // Hide the storage latency behind merge-split compute.
+        enclave.pipelined_io = true;
+        std::cout << "Using " << backend->name() << " storage backend (" << argv[2] << ").\n";
+    }
     
     // Choose a bucket size (e.g., 32).
     int bucket_size = 512;
@@ -51,6 +123,12 @@ int main(int argc, char* argv[]) {
     std::cout << "Done oblivious bucket sort with bucket size " << bucket_size << "...\n";
     std::chrono::duration<double> elapsed = end - start;
     std::cout << "Elapsed time: " << elapsed.count() << " s\n";
+    if (backend)
+        std::cout << "Backend requests: " << backend->stats().requests << " (" << backend->stats().bytes_read
+                  << " bytes read, " << backend->stats().bytes_written << " bytes written)\n";
+    std::cout << "Enclave transitions: " << untrusted.transitions.transitions << " ("
+              << untrusted.transitions.saved() << " saved by batching)\n";
+    std::cout << cost.report();
     // Write the sorted output to a file as a valid JSON array.
     std::string outputFileName = "sorted_output_oblivious.json";
     std::ofstream ofs(outputFileName);
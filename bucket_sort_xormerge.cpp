@@ -1,6 +1,8 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <memory>
 #include <vector>
 #include <string>
 #include "nlohmann/json.hpp"
@@ -11,7 +13,7 @@ using json = nlohmann::json;
 
 int main(int argc, char* argv[]){
     if(argc < 2){
-        std::cerr << "Usage: " << argv[0] << " <input_file>\n";
+        std::cerr << "Usage: " << argv[0] << " <input_file> [storage_backend]\n";
         return 1;
     }
     std::string inputFileName = argv[1];
@@ -32,6 +34,25 @@ int main(int argc, char* argv[]){
     
     UntrustedMemory untrusted;
     Enclave enclave(&untrusted);
+    // Per-phase projection of the SGX boundary costs (see enclave_cost.h).
+    EnclaveCostSimulator cost(sgx_model_from_env());
+    enclave.cost = &cost;
+    // Optional: keep the buckets in a storage backend instead of RAM
+    // (memory, mmap:<path>, remote:<latency_ms>[:<MBps>], remote@<host>:<port>).
+    std::unique_ptr<StorageBackend> backend;
+    if(argc > 2){
+        size_t max_payload = 0;
+        for(const auto &row : inputRows)
+            max_payload = std::max(max_payload, row.payload.size());
+        try{
+            backend = make_storage_backend(argv[2]);
+        }catch(const std::exception& e){
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        untrusted.use_backend(backend.get(), Enclave::recordBytes(max_payload));
+        std::cout << "Using " << backend->name() << " storage backend (" << argv[2] << ").\n";
+    }
     
     int bucket_size = 256;
     std::cout << "Starting oblivious bucket sort with bucket size " << bucket_size << "...\n";
@@ -42,6 +63,12 @@ int main(int argc, char* argv[]){
     std::cout << "Done oblivious bucket sort with bucket size " << bucket_size << "...\n";
     std::chrono::duration<double> elapsed = end - start;
     std::cout << "Elapsed time: " << elapsed.count() << " s\n";
+    if(backend)
+        std::cout << "Backend requests: " << backend->stats().requests << " (" << backend->stats().bytes_read
+                  << " bytes read, " << backend->stats().bytes_written << " bytes written)\n";
+    std::cout << "Enclave transitions: " << untrusted.transitions.transitions << " ("
+              << untrusted.transitions.saved() << " saved by batching)\n";
+    std::cout << cost.report();
     
     std::string outputFileName = "sorted_output_oblivious.json";
     std::ofstream ofs(outputFileName);
@@ -3,6 +3,8 @@
 #include <sstream>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <memory>
 #include "nlohmann/json.hpp"
 #include "oblivious_sort_two.h"
 #include <chrono>
@@ -11,7 +13,7 @@ using json = nlohmann::json;
 
 int main(int argc, char* argv[]){
     if(argc < 2){
-        std::cerr << "Usage: " << argv[0] << " <input_file>\n";
+        std::cerr << "Usage: " << argv[0] << " <input_file> [storage_backend]\n";
         return 1;
     }
     std::string inputFileName = argv[1];
@@ -31,7 +33,28 @@ int main(int argc, char* argv[]){
     std::cout << "Loaded " << inputRows.size() << " rows from " << inputFileName << ".\n";
     
     UntrustedMemory untrusted;
-    Enclave enclave(&untrusted);
+    Enclave<XorPolicy> enclave(&untrusted);
+    // Per-phase projection of the SGX boundary costs (see enclave_cost.h).
+    EnclaveCostSimulator cost(sgx_model_from_env());
+    enclave.cost = &cost;
+    // Optional: keep the buckets in a storage backend instead of RAM
+    // (memory, mmap:<path>, remote:<latency_ms>[:<MBps>], remote@<host>:<port>).
+    std::unique_ptr<StorageBackend> backend;
+    if(argc > 2){
+        size_t max_payload = 0;
+        for(const auto &row : inputRows)
+            max_payload = std::max(max_payload, row.payload.size());
+        try{
+            backend = make_storage_backend(argv[2]);
+        }catch(const std::exception& e){
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        untrusted.use_backend(backend.get(), enclave.recordBytes(max_payload));
+        // Hide the storage latency behind merge-split compute.
+        enclave.pipelined_io = true;
+        std::cout << "Using " << backend->name() << " storage backend (" << argv[2] << ").\n";
+    }
     
     int bucket_size = 256;
     std::cout << "Starting oblivious bucket sort with bucket size " << bucket_size << "...\n";
@@ -42,6 +65,12 @@ int main(int argc, char* argv[]){
     std::cout << "Done oblivious bucket sort with bucket size " << bucket_size << "...\n";
     std::chrono::duration<double> elapsed = end - start;
     std::cout << "Elapsed time: " << elapsed.count() << " s\n";
+    if(backend)
+        std::cout << "Backend requests: " << backend->stats().requests << " (" << backend->stats().bytes_read
+                  << " bytes read, " << backend->stats().bytes_written << " bytes written)\n";
+    std::cout << "Enclave transitions: " << untrusted.transitions.transitions << " ("
+              << untrusted.transitions.saved() << " saved by batching)\n";
+    std::cout << cost.report();
     
     std::string outputFileName = "sorted_output_oblivious.json";
     std::ofstream ofs(outputFileName);
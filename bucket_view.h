@@ -0,0 +1,52 @@
+#ifndef BUCKET_VIEW_H
+#define BUCKET_VIEW_H
+
+#include <vector>
+#include <cstddef>
+
+/*
+ * BucketView:
+ * Non-owning view of `size` consecutive elements, used to hand the enclave a
+ * bucket that lives in untrusted storage without copying it. A
+ * BucketView<const T> is a read-only view; BucketView<T> lets the enclave
+ * write its output in place. Views are invalidated when the level they point
+ * into is recycled by the LevelArena.
+ */
+template <typename T>
+struct BucketView {
+    T* data;
+    int size;
+
+    BucketView() : data(nullptr), size(0) {}
+    BucketView(T* d, int n) : data(d), size(n) {}
+
+    // Allows BucketView<T> to be passed where a BucketView<const T> is expected.
+    template <typename U>
+    BucketView(const BucketView<U>& other) : data(other.data), size(other.size) {}
+
+    T& operator[](int i) const { return data[i]; }
+    T* begin() const { return data; }
+    T* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+
+    // View of `count` elements starting at `offset`, clipped to the end of this view.
+    BucketView subview(int offset, int count) const {
+        if (offset > size)
+            offset = size;
+        if (count > size - offset)
+            count = size - offset;
+        return BucketView(data + offset, count);
+    }
+};
+
+template <typename T>
+BucketView<T> make_bucket_view(std::vector<T>& v) {
+    return BucketView<T>(v.data(), static_cast<int>(v.size()));
+}
+
+template <typename T>
+BucketView<const T> make_bucket_view(const std::vector<T>& v) {
+    return BucketView<const T>(v.data(), static_cast<int>(v.size()));
+}
+
+#endif // BUCKET_VIEW_H
@@ -0,0 +1,54 @@
+#ifndef BUTTERFLY_ROUTING_CHECK_H
+#define BUTTERFLY_ROUTING_CHECK_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bucket_batch.h"
+
+/*
+ * Check of a finished butterfly, shared by the test_butterfly_topology*
+ * tests. Every variant has its own Enclave and Element (they cannot be
+ * linked into one test), so this is a template over the enclave.
+ *
+ * butterfly_routing_error loads the B buckets of level L and returns what is
+ * wrong with them, or "" when every real element sits in the bucket its key
+ * names, all n of them are left, and the bucket loads pass a chi-square test
+ * against the uniform distribution.
+ */
+template <class Enclave>
+std::string butterfly_routing_error(Enclave& enclave, int n, int B, int L, int Z) {
+    std::vector<BucketRange> ranges;
+    for (int b = 0; b < B; b++)
+        ranges.push_back(BucketRange{ L, b, 0, Z });
+    auto buckets = enclave.loadBuckets(ranges);
+    std::vector<int> load(B, 0);
+    int real = 0, misplaced = 0;
+    for (int b = 0; b < B; b++)
+        for (const auto& e : buckets[b]) {
+            if (e.is_dummy)
+                continue;
+            real++;
+            load[b]++;
+            if (e.key != b)
+                misplaced++;
+        }
+    if (real != n)
+        return std::to_string(real) + " of " + std::to_string(n) + " elements left";
+    if (misplaced != 0)
+        return std::to_string(misplaced) + " elements outside their key's bucket";
+
+    // Chi-square of the bucket loads against n / B each, B - 1 degrees of
+    // freedom; the bound is about six standard deviations above the mean.
+    double expected = static_cast<double>(n) / B, chi2 = 0;
+    for (int c : load)
+        chi2 += (c - expected) * (c - expected) / expected;
+    double df = B - 1;
+    if (B > 1 && chi2 >= df + 6 * std::sqrt(2 * df))
+        return "bucket loads not uniform (chi2 " + std::to_string(chi2) + ", " + std::to_string(B - 1) +
+               " degrees of freedom)";
+    return "";
+}
+
+#endif // BUTTERFLY_ROUTING_CHECK_H
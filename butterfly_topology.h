@@ -0,0 +1,138 @@
+#ifndef BUTTERFLY_TOPOLOGY_H
+#define BUTTERFLY_TOPOLOGY_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+/*
+ * ButterflyTopology:
+ * Which buckets the butterfly merge-splits together at each level, and where
+ * the two halves go. Every form routes each real element to the bucket whose
+ * index equals its random key after L = log2(B) levels, so the final bin
+ * assignment is the uniform one drawn at initialization. The schedule only
+ * depends on B, never on the data.
+ *
+ *   standard     - the form of oblivious_sort_simple: level i merge-splits
+ *                  base + k and base + k + 2^i inside each block of 2^(i+1)
+ *                  buckets and writes base + 2k and base + 2k + 1. It routes
+ *                  key bit L-1-i, most significant first.
+ *   bit-reversed - the standard form with every bucket index bit-reversed;
+ *                  it routes key bit i, least significant first.
+ *   in-place     - level i merge-splits x and x + 2^i (x with bit i clear)
+ *                  and writes the halves back to x and x + 2^i, routing key
+ *                  bit i. A bucket never moves, and the first k levels stay
+ *                  inside runs of 2^k consecutive buckets, so the levels can
+ *                  be blocked (block()) and a node can route several bits at
+ *                  once.
+ *
+ * A ButterflyNode reads buckets `in` at `level`, takes them through `levels`
+ * levels and writes them to buckets `out` at level + levels. A pair node
+ * (levels == 1, two buckets) sends the reals whose key bit is 0 to out[0]
+ * and the rest to out[1].
+ */
+enum class TopologyKind { Standard, BitReversed, InPlace };
+
+struct ButterflyNode {
+    int level;
+    int levels;
+    std::vector<int> in;
+    std::vector<int> out;
+};
+
+inline const char* topology_name(TopologyKind kind) {
+    switch (kind) {
+    case TopologyKind::Standard: return "standard";
+    case TopologyKind::BitReversed: return "bit-reversed";
+    default: return "in-place";
+    }
+}
+
+// "standard", "bit-reversed" or "in-place"; throws std::invalid_argument otherwise.
+inline TopologyKind topology_from_name(const std::string& name) {
+    if (name == "standard")
+        return TopologyKind::Standard;
+    if (name == "bit-reversed")
+        return TopologyKind::BitReversed;
+    if (name == "in-place")
+        return TopologyKind::InPlace;
+    throw std::invalid_argument("Unknown butterfly topology '" + name + "' (standard, bit-reversed or in-place).");
+}
+
+class ButterflyTopology {
+public:
+    ButterflyTopology(TopologyKind kind, int levels) : form(kind), L(levels) {
+        if (levels < 0 || levels > 30)
+            throw std::invalid_argument("ButterflyTopology: level count out of range.");
+    }
+
+    TopologyKind kind() const { return form; }
+    int levels() const { return L; }
+    int buckets() const { return 1 << L; }
+    // Whether block() is available: nodes write back to the buckets they read.
+    bool in_place() const { return form == TopologyKind::InPlace; }
+
+    // Key bit routed at `level`.
+    int key_bit(int level) const {
+        return form == TopologyKind::Standard ? L - 1 - level : level;
+    }
+
+    // The B/2 pair nodes of `level`.
+    std::vector<ButterflyNode> pairs(int level) const {
+        std::vector<ButterflyNode> nodes;
+        nodes.reserve(buckets() / 2);
+        if (form == TopologyKind::InPlace) {
+            int stride = 1 << level;
+            for (int x = 0; x < buckets(); x++)
+                if ((x & stride) == 0)
+                    nodes.push_back(ButterflyNode{ level, 1, { x, x + stride }, { x, x + stride } });
+            return nodes;
+        }
+        int half = 1 << level;
+        for (int base = 0; base < buckets(); base += 2 * half)
+            for (int k = 0; k < half; k++) {
+                ButterflyNode node{ level, 1, { base + k, base + k + half }, { base + 2 * k, base + 2 * k + 1 } };
+                if (form == TopologyKind::BitReversed)
+                    for (int* b : { &node.in[0], &node.in[1], &node.out[0], &node.out[1] })
+                        *b = reverse(*b);
+                nodes.push_back(node);
+            }
+        return nodes;
+    }
+
+    // In-place only: the nodes that take every bucket through `levels` levels
+    // from `level` on, one per group of 2^levels buckets that only differ in
+    // bits level .. level + levels - 1. in[j] (= out[j]) is the bucket whose
+    // index reads j in those bits, so the group's own butterfly pairs
+    // positions j and j + 2^s at its s-th level.
+    std::vector<ButterflyNode> block(int level, int levels) const {
+        if (!in_place())
+            throw std::logic_error("ButterflyTopology: only the in-place form can be blocked.");
+        int width = 1 << levels;
+        int low = 1 << level;
+        std::vector<ButterflyNode> nodes;
+        nodes.reserve(buckets() / width);
+        for (int g = 0; g < buckets() / width; g++) {
+            int base = (g & (low - 1)) | ((g >> level) << (level + levels));
+            ButterflyNode node{ level, levels, std::vector<int>(width), std::vector<int>() };
+            for (int j = 0; j < width; j++)
+                node.in[j] = base | (j << level);
+            node.out = node.in;
+            nodes.push_back(node);
+        }
+        return nodes;
+    }
+
+private:
+    int reverse(int x) const {
+        int r = 0;
+        for (int b = 0; b < L; b++)
+            r |= ((x >> b) & 1) << (L - 1 - b);
+        return r;
+    }
+
+    TopologyKind form;
+    int L;
+};
+
+#endif // BUTTERFLY_TOPOLOGY_H
@@ -0,0 +1,177 @@
+#include "chacha20.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define CHACHA20_X86 1
+#endif
+
+namespace {
+    const uint64_t kMaxBlocks = uint64_t(1) << 32;
+
+    uint32_t load32(const uint8_t* p) {
+        return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+    }
+
+    void store32(uint8_t* p, uint32_t v) {
+        p[0] = static_cast<uint8_t>(v);
+        p[1] = static_cast<uint8_t>(v >> 8);
+        p[2] = static_cast<uint8_t>(v >> 16);
+        p[3] = static_cast<uint8_t>(v >> 24);
+    }
+
+    uint32_t rotl(uint32_t v, int n) {
+        return (v << n) | (v >> (32 - n));
+    }
+
+#define CHACHA_QR(a, b, c, d)                    \
+    a += b; d ^= a; d = rotl(d, 16);             \
+    c += d; b ^= c; b = rotl(b, 12);             \
+    a += b; d ^= a; d = rotl(d, 8);              \
+    c += d; b ^= c; b = rotl(b, 7);
+
+    // The 16-word input block: constants, key, counter, nonce.
+    void initState(uint32_t* s, const uint32_t* key, uint32_t counter, const uint8_t* nonce) {
+        s[0] = 0x61707865; s[1] = 0x3320646e; s[2] = 0x79622d32; s[3] = 0x6b206574;
+        std::memcpy(s + 4, key, 8 * sizeof(uint32_t));
+        s[12] = counter;
+        s[13] = load32(nonce);
+        s[14] = load32(nonce + 4);
+        s[15] = load32(nonce + 8);
+    }
+
+    // One 64-byte keystream block.
+    void block(const uint32_t* in, uint8_t* out) {
+        uint32_t x[16];
+        std::memcpy(x, in, sizeof(x));
+        for (int round = 0; round < 10; round++) {
+            CHACHA_QR(x[0], x[4], x[8], x[12]);
+            CHACHA_QR(x[1], x[5], x[9], x[13]);
+            CHACHA_QR(x[2], x[6], x[10], x[14]);
+            CHACHA_QR(x[3], x[7], x[11], x[15]);
+            CHACHA_QR(x[0], x[5], x[10], x[15]);
+            CHACHA_QR(x[1], x[6], x[11], x[12]);
+            CHACHA_QR(x[2], x[7], x[8], x[13]);
+            CHACHA_QR(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; i++)
+            store32(out + 4 * i, x[i] + in[i]);
+    }
+
+#ifdef CHACHA20_X86
+#define CHACHA_ROTL4(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define CHACHA_QR4(a, b, c, d)                                                     \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = CHACHA_ROTL4(d, 16);     \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = CHACHA_ROTL4(b, 12);     \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = CHACHA_ROTL4(d, 8);      \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = CHACHA_ROTL4(b, 7);
+
+    // XORs four consecutive blocks (counters in[12] .. in[12] + 3) into data.
+    __attribute__((target("sse2")))
+    void xorFourBlocks(const uint32_t* in, uint8_t* data) {
+        __m128i s[16], x[16];
+        for (int i = 0; i < 16; i++)
+            s[i] = _mm_set1_epi32(static_cast<int>(in[i]));
+        s[12] = _mm_add_epi32(s[12], _mm_setr_epi32(0, 1, 2, 3));
+        for (int i = 0; i < 16; i++)
+            x[i] = s[i];
+        for (int round = 0; round < 10; round++) {
+            CHACHA_QR4(x[0], x[4], x[8], x[12]);
+            CHACHA_QR4(x[1], x[5], x[9], x[13]);
+            CHACHA_QR4(x[2], x[6], x[10], x[14]);
+            CHACHA_QR4(x[3], x[7], x[11], x[15]);
+            CHACHA_QR4(x[0], x[5], x[10], x[15]);
+            CHACHA_QR4(x[1], x[6], x[11], x[12]);
+            CHACHA_QR4(x[2], x[7], x[8], x[13]);
+            CHACHA_QR4(x[3], x[4], x[9], x[14]);
+        }
+        // Lane j of word i belongs to block j: transpose each group of four
+        // words into 16 bytes of each block.
+        for (int g = 0; g < 4; g++) {
+            __m128i a0 = _mm_add_epi32(x[4 * g], s[4 * g]);
+            __m128i a1 = _mm_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+            __m128i a2 = _mm_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+            __m128i a3 = _mm_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+            __m128i t0 = _mm_unpacklo_epi32(a0, a1), t1 = _mm_unpacklo_epi32(a2, a3);
+            __m128i t2 = _mm_unpackhi_epi32(a0, a1), t3 = _mm_unpackhi_epi32(a2, a3);
+            __m128i blocks[4] = { _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                                  _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3) };
+            for (int j = 0; j < 4; j++) {
+                __m128i* p = reinterpret_cast<__m128i*>(data + 64 * j + 16 * g);
+                _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), blocks[j]));
+            }
+        }
+    }
+#undef CHACHA_QR4
+#undef CHACHA_ROTL4
+
+    bool haveSSE2() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+#undef CHACHA_QR
+} // anonymous namespace
+
+const size_t ChaCha20::kKeyBytes;
+const size_t ChaCha20::kNonceBytes;
+const size_t ChaCha20::kBlockBytes;
+
+ChaCha20::ChaCha20(const uint8_t* key) {
+    for (int i = 0; i < 8; i++)
+        key_words[i] = load32(key + 4 * i);
+}
+
+ChaCha20::~ChaCha20() {
+    std::memset(key_words, 0, sizeof(key_words));
+}
+
+const char* ChaCha20::kernel_name() {
+#ifdef CHACHA20_X86
+    if (haveSSE2())
+        return "sse2";
+#endif
+    return "scalar";
+}
+
+void ChaCha20::process(uint8_t* data, size_t len, const uint8_t* nonce, uint64_t stream_offset) const {
+    if (len == 0)
+        return;
+    uint64_t counter = stream_offset / kBlockBytes;
+    size_t skip = stream_offset % kBlockBytes;
+    if (counter + (skip + len + kBlockBytes - 1) / kBlockBytes > kMaxBlocks)
+        throw std::out_of_range("ChaCha20: past the last block of the nonce.");
+    uint32_t state[16];
+    initState(state, key_words, static_cast<uint32_t>(counter), nonce);
+    uint8_t ks[kBlockBytes];
+    // A partial first block when the offset is not block-aligned.
+    if (skip != 0) {
+        block(state, ks);
+        size_t n = std::min(len, kBlockBytes - skip);
+        for (size_t i = 0; i < n; i++)
+            data[i] ^= ks[skip + i];
+        data += n;
+        len -= n;
+        state[12]++;
+    }
+#ifdef CHACHA20_X86
+    static const bool sse2 = haveSSE2();
+    if (sse2) {
+        for (; len >= 4 * kBlockBytes; data += 4 * kBlockBytes, len -= 4 * kBlockBytes) {
+            xorFourBlocks(state, data);
+            state[12] += 4;
+        }
+    }
+#endif
+    for (; len > 0; state[12]++) {
+        block(state, ks);
+        size_t n = std::min(len, kBlockBytes);
+        for (size_t i = 0; i < n; i++)
+            data[i] ^= ks[i];
+        data += n;
+        len -= n;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef CHACHA20_H
+#define CHACHA20_H
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * ChaCha20:
+ * The RFC 8439 stream cipher (256-bit key, 96-bit nonce, 32-bit block
+ * counter), in portable C++ with no table lookups. It is the record cipher
+ * for hosts without AES-NI, where AES-CTR falls back to table-based code (see
+ * StreamCipher in bucket_cipher.h).
+ *
+ * Long runs are generated four blocks at a time with SSE2 (one block per
+ * 32-bit lane) where the CPU has it, and one block at a time otherwise.
+ * process() is const and keeps no state between calls, so one ChaCha20 can
+ * serve any number of threads.
+ */
+class ChaCha20 {
+public:
+    static const size_t kKeyBytes = 32;
+    static const size_t kNonceBytes = 12;
+    static const size_t kBlockBytes = 64;
+
+    explicit ChaCha20(const uint8_t* key);
+    ~ChaCha20();
+
+    // XORs `len` bytes in place with the keystream of `nonce`, starting
+    // `stream_offset` bytes in (block counter stream_offset / 64). Throws
+    // std::out_of_range past the 2^32 blocks of one nonce.
+    void process(uint8_t* data, size_t len, const uint8_t* nonce, uint64_t stream_offset) const;
+
+    // "sse2" or "scalar": the multi-block kernel process() uses here.
+    static const char* kernel_name();
+
+private:
+    uint32_t key_words[8];
+};
+
+#endif // CHACHA20_H
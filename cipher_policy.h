@@ -0,0 +1,100 @@
+#ifndef CIPHER_POLICY_H
+#define CIPHER_POLICY_H
+
+#include <string>
+#include <atomic>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+#include "bucket_cipher.h"
+#include "xor_keystream.h"
+
+/*
+ * Cipher policies:
+ * The cipher of a RecordEnclave (record_enclave.h), given as a template
+ * argument so the record I/O calls it directly: no virtual dispatch, and the
+ * whole cipher inlines away for NoCipherPolicy. A policy holds the key and
+ * has BucketCipher's interface:
+ *     static const char* name();
+ *     uint32_t new_run();  uint32_t new_epoch();
+ *     Lease lease();       // process(), seal() and open() for one thread
+ *     bool seals() const;  // whether seal() and open() (RecordMode::GCM) work
+ * All of them are stream ciphers, so encrypting and decrypting is the same
+ * process() call.
+ *
+ *   AesCtrPolicy   - BucketCipher on AES (the two/merge/constant default;
+ *                    use() can still switch it to ChaCha20);
+ *   ChaCha20Policy - BucketCipher on the ChaCha20 keystream;
+ *   XorPolicy      - the XOR variants' ChaCha20 keystream (xor_keystream.h) with
+ *                    SIMD XOR, the cipher of xortwo;
+ *   NoCipherPolicy - leaves the bytes alone (the cost of sorting alone).
+ */
+class AesCtrPolicy : public BucketCipher {
+public:
+    static const char* name() { return "aes-ctr"; }
+    AesCtrPolicy() { use(StreamCipher::AES); }
+    bool seals() const { return stream_cipher() == StreamCipher::AES; }
+};
+
+class ChaCha20Policy : public BucketCipher {
+public:
+    static const char* name() { return "chacha20"; }
+    ChaCha20Policy() { use(StreamCipher::ChaCha20); }
+    bool seals() const { return stream_cipher() == StreamCipher::AES; }
+};
+
+// Run and epoch ids of the policies without a BucketCipher, and their
+// seal()/open(), which throw: GCM needs AES.
+class UnsealedPolicy {
+public:
+    UnsealedPolicy() : runs(0), epochs(0) {}
+    uint32_t new_run() { return next(runs); }
+    uint32_t new_epoch() { return next(epochs); }
+    bool seals() const { return false; }
+    void seal(std::string&, const CtrNonce&, int, int, uint32_t, uint8_t*) const { unsealed(); }
+    bool open(std::string&, const CtrNonce&, int, int, uint32_t, const uint8_t*) const {
+        unsealed();
+        return false;
+    }
+
+private:
+    static uint32_t next(std::atomic<uint32_t>& ids) {
+        uint32_t id = ++ids;
+        if (id == 0)
+            throw std::overflow_error("cipher policy: nonce ids exhausted.");
+        return id;
+    }
+    static void unsealed() { throw std::logic_error("cipher policy: GCM records need AES."); }
+
+    std::atomic<uint32_t> runs, epochs;
+};
+
+class NoCipherPolicy : public UnsealedPolicy {
+public:
+    typedef const NoCipherPolicy& Lease;
+    static const char* name() { return "none"; }
+    Lease lease() const { return *this; }
+    void process(uint8_t*, size_t, const CtrNonce&, uint64_t = 0) const {}
+    void process(std::string&, const CtrNonce&, uint64_t = 0) const {}
+};
+
+class XorPolicy : public UnsealedPolicy {
+public:
+    typedef const XorPolicy& Lease;
+    static const char* name() { return "xor"; }
+    explicit XorPolicy(uint64_t key = 0xdeadbeef) : keystream(key) {}
+    Lease lease() const { return *this; }
+    void process(uint8_t* data, size_t len, const CtrNonce& nonce, uint64_t stream_offset = 0) const {
+        keystream.apply(data, len, XorKeystream::nonce(nonce.run, nonce.epoch, nonce.level, nonce.bucket),
+                        stream_offset);
+    }
+    void process(std::string& buffer, const CtrNonce& nonce, uint64_t stream_offset = 0) const {
+        process(reinterpret_cast<uint8_t*>(&buffer[0]), buffer.size(), nonce, stream_offset);
+    }
+
+private:
+    XorKeystream keystream;
+};
+
+#endif // CIPHER_POLICY_H
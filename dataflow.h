@@ -0,0 +1,131 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+
+/*
+ * DataflowGraph:
+ * A set of tasks 0 .. size() - 1 and "runs after" edges between them, run on
+ * a ThreadPool without barriers: a task starts as soon as every task it
+ * depends on has finished. Each worker keeps a deque of ready tasks. It pushes
+ * the tasks its own work made ready and pops them from the back (newest
+ * first, so a chain of dependent tasks tends to stay on one core). An idle
+ * worker steals the oldest task from the front of another worker's deque.
+ *
+ * For the butterfly, a task is one bucket pair of one level and its edges
+ * lead from the pairs that write its inputs. The levels then run as a
+ * wavefront instead of one after another.
+ *
+ * The graph must be acyclic. run() can be called any number of times. The
+ * first exception thrown by a task stops the run and is rethrown by run().
+ */
+class DataflowGraph {
+public:
+    explicit DataflowGraph(size_t tasks) : successors(tasks), predecessors(tasks, 0) {}
+
+    size_t size() const { return successors.size(); }
+
+    // `to` runs after `from`. Repeated edges are ignored.
+    void add_edge(size_t from, size_t to) {
+        if (from >= size() || to >= size() || from == to)
+            throw std::out_of_range("DataflowGraph: edge between unknown tasks.");
+        std::vector<size_t>& out = successors[from];
+        if (std::find(out.begin(), out.end(), to) != out.end())
+            return;
+        out.push_back(to);
+        predecessors[to]++;
+    }
+
+    // Calls body(task, worker) once per task on at most `max_threads` workers
+    // of `pool` (the caller included). `worker` is in [0, max_threads) and no
+    // two tasks run on the same worker at the same time, so per-worker state
+    // can be indexed by it.
+    template <typename F>
+    void run(ThreadPool& pool, int max_threads, F body) {
+        size_t n = size();
+        size_t workers = std::min(n, static_cast<size_t>(std::max(1, std::min(max_threads, pool.size()))));
+        if (n == 0)
+            return;
+        std::unique_ptr<std::atomic<int>[]> pending(new std::atomic<int>[n]);
+        std::unique_ptr<ReadyQueue[]> queues(new ReadyQueue[workers]);
+        size_t roots = 0;
+        for (size_t t = 0; t < n; t++) {
+            pending[t] = predecessors[t];
+            if (predecessors[t] == 0)
+                queues[roots++ % workers].tasks.push_back(t);
+        }
+        if (roots == 0)
+            throw std::logic_error("DataflowGraph: every task waits on another (cycle).");
+
+        std::atomic<size_t> remaining(n);
+        std::atomic<bool> failed(false);
+        pool.run(workers, static_cast<int>(workers), [&](size_t self, int) {
+            while (remaining > 0 && !failed) {
+                size_t task;
+                if (!queues[self].pop_back(task) && !steal(queues.get(), workers, self, task)) {
+                    // Every ready task is taken; the ones running will make more.
+                    std::this_thread::yield();
+                    continue;
+                }
+                try {
+                    body(task, static_cast<int>(self));
+                } catch (...) {
+                    failed = true;
+                    throw;
+                }
+                for (size_t next : successors[task])
+                    if (--pending[next] == 0)
+                        queues[self].push_back(next);
+                remaining--;
+            }
+        });
+    }
+
+private:
+    struct ReadyQueue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+
+        void push_back(size_t t) {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(t);
+        }
+        bool pop_back(size_t& t) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty())
+                return false;
+            t = tasks.back();
+            tasks.pop_back();
+            return true;
+        }
+        bool pop_front(size_t& t) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty())
+                return false;
+            t = tasks.front();
+            tasks.pop_front();
+            return true;
+        }
+    };
+
+    static bool steal(ReadyQueue* queues, size_t workers, size_t self, size_t& task) {
+        for (size_t k = 1; k < workers; k++)
+            if (queues[(self + k) % workers].pop_front(task))
+                return true;
+        return false;
+    }
+
+    std::vector<std::vector<size_t>> successors;
+    std::vector<int> predecessors;
+};
+
+#endif // DATAFLOW_H
@@ -0,0 +1,136 @@
+#include "enclave_cost.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    double envDouble(const char* name, double fallback) {
+        const char* value = std::getenv(name);
+        if (!value || !*value)
+            return fallback;
+        char* end = nullptr;
+        double parsed = std::strtod(value, &end);
+        if (end == value || *end != '\0' || parsed < 0)
+            throw std::invalid_argument(std::string(name) + ": not a non-negative number: " + value);
+        return parsed;
+    }
+} // anonymous namespace
+
+SgxCostModel sgx_model_from_env() {
+    SgxCostModel m;
+    m.epc_bytes = static_cast<size_t>(envDouble("SGX_EPC_MB", m.epc_bytes / double(1 << 20)) * (1 << 20));
+    m.ocall_us = envDouble("SGX_OCALL_US", m.ocall_us);
+    m.page_fault_us = envDouble("SGX_PAGE_FAULT_US", m.page_fault_us);
+    m.boundary_gbps = envDouble("SGX_BOUNDARY_GBPS", m.boundary_gbps);
+    return m;
+}
+
+EnclaveCostSimulator::EnclaveCostSimulator(const SgxCostModel& model)
+    : cost_model(model), in_phase(false) {
+    if (model.page_bytes == 0 || model.boundary_gbps <= 0)
+        throw std::invalid_argument("EnclaveCostSimulator: page size and boundary bandwidth must be positive.");
+}
+
+void EnclaveCostSimulator::begin_phase(const std::string& name, const TransitionStats& t, size_t resident_bytes) {
+    if (in_phase)
+        throw std::logic_error("EnclaveCostSimulator: phase " + current.name + " is still running.");
+    current = PhaseCost();
+    current.name = name;
+    current.resident_bytes = resident_bytes;
+    start_calls = t;
+    in_phase = true;
+    start_time = std::chrono::high_resolution_clock::now();
+}
+
+void EnclaveCostSimulator::end_phase(const TransitionStats& t) {
+    if (!in_phase)
+        return;
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+    current.native_s = elapsed.count();
+    current.ocalls = t.transitions - start_calls.transitions;
+    current.ranges = t.ranges - start_calls.ranges;
+    project(current);
+    done.push_back(current);
+    in_phase = false;
+}
+
+void EnclaveCostSimulator::on_load(size_t bytes) {
+    if (!in_phase)
+        return;
+    current.bytes_in += bytes;
+    if (bytes > current.peak_load_bytes)
+        current.peak_load_bytes = bytes;
+}
+
+void EnclaveCostSimulator::on_store(size_t bytes) {
+    if (!in_phase)
+        return;
+    current.bytes_out += bytes;
+    if (bytes > current.peak_store_bytes)
+        current.peak_store_bytes = bytes;
+}
+
+// Every byte moved through the enclave and every resident byte is touched at
+// least once; beyond the EPC a touched page is resident only with probability
+// EPC / working set.
+void EnclaveCostSimulator::project(PhaseCost& p) const {
+    const SgxCostModel& m = cost_model;
+    size_t ws = p.working_set();
+    if (ws > m.epc_bytes) {
+        double miss = double(ws - m.epc_bytes) / ws;
+        double touched_pages = double(p.bytes_in + p.bytes_out + p.resident_bytes) / m.page_bytes;
+        p.page_faults = static_cast<uint64_t>(touched_pages * miss + 0.5);
+    }
+    p.compute_s = p.native_s * m.compute_slowdown;
+    p.ocall_s = p.ocalls * m.ocall_us * 1e-6;
+    p.transfer_s = (p.bytes_in + p.bytes_out) / (m.boundary_gbps * 1e9);
+    p.paging_s = p.page_faults * m.page_fault_us * 1e-6;
+}
+
+PhaseCost EnclaveCostSimulator::total() const {
+    PhaseCost t;
+    t.name = "total";
+    for (const auto& p : done) {
+        t.native_s += p.native_s;
+        t.ocalls += p.ocalls;
+        t.ranges += p.ranges;
+        t.bytes_in += p.bytes_in;
+        t.bytes_out += p.bytes_out;
+        t.page_faults += p.page_faults;
+        t.compute_s += p.compute_s;
+        t.ocall_s += p.ocall_s;
+        t.transfer_s += p.transfer_s;
+        t.paging_s += p.paging_s;
+        // The peak working set over all phases.
+        if (p.working_set() > t.working_set()) {
+            t.resident_bytes = p.resident_bytes;
+            t.peak_load_bytes = p.peak_load_bytes;
+            t.peak_store_bytes = p.peak_store_bytes;
+        }
+    }
+    return t;
+}
+
+std::string EnclaveCostSimulator::report() const {
+    std::ostringstream oss;
+    char line[256];
+    std::snprintf(line, sizeof(line), "Projected SGX cost (EPC %.1f MB, ocall %.1f us, page fault %.1f us, %.1f GB/s boundary):\n",
+                  cost_model.epc_bytes / double(1 << 20), cost_model.ocall_us, cost_model.page_fault_us,
+                  cost_model.boundary_gbps);
+    oss << line;
+    std::snprintf(line, sizeof(line), "  %-11s %10s %10s %12s %10s %10s %10s %10s\n",
+                  "phase", "native s", "ocalls", "crossed MB", "WS MB", "faults", "paging s", "SGX s");
+    oss << line;
+    std::vector<PhaseCost> rows = done;
+    rows.push_back(total());
+    for (const auto& p : rows) {
+        std::snprintf(line, sizeof(line), "  %-11s %10.4f %10llu %12.2f %10.2f %10llu %10.4f %10.4f\n",
+                      p.name.c_str(), p.native_s, static_cast<unsigned long long>(p.ocalls),
+                      (p.bytes_in + p.bytes_out) / double(1 << 20), p.working_set() / double(1 << 20),
+                      static_cast<unsigned long long>(p.page_faults), p.paging_s, p.projected_s());
+        oss << line;
+    }
+    return oss.str();
+}
@@ -0,0 +1,109 @@
+#ifndef ENCLAVE_COST_H
+#define ENCLAVE_COST_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#include "bucket_batch.h"
+
+/*
+ * Enclave boundary cost simulator:
+ * Projects what a run would cost inside an SGX enclave from what the
+ * simulation actually did. Per phase (initialize, butterfly, extract, final
+ * sort) it records:
+ *   - ocalls: calls into UntrustedMemory (see TransitionStats);
+ *   - bytes crossing the boundary: encrypted elements loaded into and stored
+ *     out of the enclave by Enclave::loadBuckets/storeBuckets;
+ *   - working set: data the phase keeps resident in the enclave plus its
+ *     largest load batch and largest store batch;
+ *   - EPC page faults: when the working set exceeds the EPC, each page
+ *     touched misses with probability (working set - EPC) / working set.
+ * The projected runtime adds the costs of ocalls, boundary copies and page
+ * faults to the measured compute time.
+ */
+struct SgxCostModel {
+    size_t epc_bytes = size_t(93) << 20;  // Usable EPC (128 MB minus SGX metadata).
+    size_t page_bytes = 4096;
+    double ocall_us = 8.0;                 // Enclave exit and re-entry.
+    double boundary_gbps = 4.0;            // Copy + memory encryption bandwidth, GB/s.
+    double page_fault_us = 40.0;           // Evict (EWB) and reload (ELDU) one EPC page.
+    double compute_slowdown = 1.0;         // In-enclave compute relative to the simulation.
+};
+
+// Default model, overridden by SGX_EPC_MB, SGX_OCALL_US, SGX_PAGE_FAULT_US
+// and SGX_BOUNDARY_GBPS when they are set.
+SgxCostModel sgx_model_from_env();
+
+struct PhaseCost {
+    std::string name;
+    double native_s = 0;          // Measured wall-clock time.
+    uint64_t ocalls = 0;
+    uint64_t ranges = 0;          // Bucket ranges served by those ocalls.
+    uint64_t bytes_in = 0;        // Untrusted -> enclave.
+    uint64_t bytes_out = 0;       // Enclave -> untrusted.
+    size_t resident_bytes = 0;
+    size_t peak_load_bytes = 0;
+    size_t peak_store_bytes = 0;
+    uint64_t page_faults = 0;
+    // Projected components, in seconds.
+    double compute_s = 0, ocall_s = 0, transfer_s = 0, paging_s = 0;
+
+    size_t working_set() const { return resident_bytes + peak_load_bytes + peak_store_bytes; }
+    double projected_s() const { return compute_s + ocall_s + transfer_s + paging_s; }
+};
+
+class EnclaveCostSimulator {
+public:
+    explicit EnclaveCostSimulator(const SgxCostModel& model = SgxCostModel());
+
+    // Phases do not nest. `resident_bytes` is data held in the enclave for the
+    // whole phase (input, output); `t` is the UntrustedMemory call counter.
+    void begin_phase(const std::string& name, const TransitionStats& t, size_t resident_bytes);
+    void end_phase(const TransitionStats& t);
+    // Called by Enclave::loadBuckets/storeBuckets with the encrypted bytes of one batch.
+    void on_load(size_t bytes);
+    void on_store(size_t bytes);
+
+    const SgxCostModel& model() const { return cost_model; }
+    const std::vector<PhaseCost>& phases() const { return done; }
+    PhaseCost total() const;
+    // Human-readable table of every phase and the total.
+    std::string report() const;
+    void clear() { done.clear(); }
+
+private:
+    void project(PhaseCost& p) const;
+
+    SgxCostModel cost_model;
+    std::vector<PhaseCost> done;
+    PhaseCost current;
+    TransitionStats start_calls;
+    std::chrono::high_resolution_clock::time_point start_time;
+    bool in_phase;
+};
+
+// Runs one phase for the lifetime of the scope; a no-op when `simulator` is null.
+class CostPhase {
+public:
+    CostPhase(EnclaveCostSimulator* simulator, const char* name, const TransitionStats& t, size_t resident_bytes = 0)
+        : sim(simulator), calls(t) {
+        if (sim)
+            sim->begin_phase(name, t, resident_bytes);
+    }
+    ~CostPhase() {
+        if (sim)
+            sim->end_phase(calls);
+    }
+
+private:
+    CostPhase(const CostPhase&) = delete;
+    CostPhase& operator=(const CostPhase&) = delete;
+
+    EnclaveCostSimulator* sim;
+    const TransitionStats& calls;
+};
+
+#endif // ENCLAVE_COST_H
@@ -0,0 +1,78 @@
+#ifndef IO_THREAD_H
+#define IO_THREAD_H
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+/*
+ * IoThread:
+ * A single background thread that runs submitted jobs one at a time, in
+ * submission order. The butterfly uses it to move untrusted-memory traffic
+ * (read + decrypt, encrypt + write) off the thread doing merge-splits.
+ *
+ * Because jobs run strictly in FIFO order, a read submitted after a write
+ * always observes that write; callers rely on this instead of extra locking.
+ * The destructor finishes every queued job before joining.
+ */
+class IoThread {
+public:
+    IoThread() : stopping(false), worker(&IoThread::run, this) {}
+
+    ~IoThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_one();
+        worker.join();
+    }
+
+    // Queues `job` and returns a future for its result (or exception).
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> submit(F job) {
+        typedef typename std::result_of<F()>::type R;
+        std::shared_ptr<std::packaged_task<R()>> task =
+            std::make_shared<std::packaged_task<R()>>(std::move(job));
+        std::future<R> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back([task]() { (*task)(); });
+        }
+        ready.notify_one();
+        return result;
+    }
+
+private:
+    IoThread(const IoThread&) = delete;
+    IoThread& operator=(const IoThread&) = delete;
+
+    void run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> queue;
+    bool stopping;
+    std::thread worker; // Declared last so it starts after the queue is ready.
+};
+
+#endif // IO_THREAD_H
@@ -0,0 +1,106 @@
+#ifndef LEVEL_ARENA_H
+#define LEVEL_ARENA_H
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstddef>
+
+#include "bucket_view.h"
+
+/*
+ * LevelArena:
+ * Double-buffered storage engine for the levels of the butterfly network.
+ *
+ * performButterflyNetwork only ever reads level l and writes level l+1, so
+ * instead of keeping all L+1 levels alive we keep two contiguous, preallocated
+ * slabs of B*Z slots. Level l lives in slab (l & 1); writing level l+1 reuses
+ * the slab that held level l-1. Bucket lookups are plain index arithmetic and
+ * peak memory is 2*B*Z slots regardless of the number of levels.
+ *
+ * Reads are checked per bucket: bucket b of level l stays readable until
+ * level l+2 writes bucket b, so a butterfly that runs levels as a wavefront
+ * (see dataflow.h) can still read level l while level l+2 is being written
+ * into other buckets of the slab.
+ *
+ * T is the Element type of the variant using the arena.
+ */
+template <typename T>
+class LevelArena {
+public:
+    LevelArena() : B(0), Z(0) {
+        resident[0] = resident[1] = -1;
+    }
+
+    // Preallocates both slabs for B buckets of Z slots each.
+    void reset(int num_buckets, int bucket_size) {
+        if (num_buckets <= 0 || bucket_size <= 0)
+            throw std::invalid_argument("LevelArena requires a positive bucket count and size.");
+        B = num_buckets;
+        Z = bucket_size;
+        size_t slots = static_cast<size_t>(B) * static_cast<size_t>(Z);
+        for (int s = 0; s < 2; s++) {
+            slabs[s].assign(slots, T());
+            holder[s].assign(B, -1);
+            resident[s] = -1;
+        }
+    }
+
+    int num_buckets() const { return B; }
+    int bucket_size() const { return Z; }
+
+    // Returns true if `level` is the newest level written to its slab.
+    bool is_resident(int level) const {
+        return level >= 0 && resident[level & 1] == level;
+    }
+
+    // First slot of a bucket at a level that has already been written.
+    const T* read_slot(int level, int bucket_index) const {
+        size_t off = offset(bucket_index);
+        if (level < 0 || holder[level & 1][bucket_index] != level)
+            throw std::out_of_range("LevelArena: level " + std::to_string(level) + " is not resident.");
+        return slabs[level & 1].data() + off;
+    }
+
+    // First slot of a bucket at `level`. The first write to a level claims
+    // the slab, discarding the level two steps behind it.
+    T* write_slot(int level, int bucket_index) {
+        if (level < 0)
+            throw std::out_of_range("LevelArena: negative level.");
+        size_t off = offset(bucket_index);
+        holder[level & 1][bucket_index] = level;
+        if (level > resident[level & 1])
+            resident[level & 1] = level;
+        return slabs[level & 1].data() + off;
+    }
+
+    // Read-only view of a bucket; no elements are copied.
+    BucketView<const T> read_view(int level, int bucket_index) const {
+        return BucketView<const T>(read_slot(level, bucket_index), Z);
+    }
+
+    // Writable view of a bucket so the enclave can produce its output in place.
+    BucketView<T> write_view(int level, int bucket_index) {
+        return BucketView<T>(write_slot(level, bucket_index), Z);
+    }
+
+    // Number of bytes reserved by the two slabs (excluding heap-owned payloads).
+    size_t bytes_reserved() const {
+        return (slabs[0].capacity() + slabs[1].capacity()) * sizeof(T);
+    }
+
+private:
+    size_t offset(int bucket_index) const {
+        if (bucket_index < 0 || bucket_index >= B)
+            throw std::out_of_range("LevelArena: bucket index " + std::to_string(bucket_index) + " out of range.");
+        return static_cast<size_t>(bucket_index) * static_cast<size_t>(Z);
+    }
+
+    int B;
+    int Z;
+    std::vector<T> slabs[2];
+    std::vector<int> holder[2]; // Level held by each bucket of a slab.
+    int resident[2];
+};
+
+#endif // LEVEL_ARENA_H
@@ -0,0 +1,172 @@
+#include "mapped_slot_store.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+    // Every slot starts with the length of the record it holds.
+    const size_t kLengthBytes = sizeof(uint32_t);
+
+    std::runtime_error sysError(const std::string& what) {
+        return std::runtime_error("MappedSlotStore: " + what + ": " + std::strerror(errno));
+    }
+} // anonymous namespace
+
+MappedSlotStore::MappedSlotStore()
+    : fd(-1), base(nullptr), mapped_bytes(0), B(0), Z(0),
+      max_record(0), slot_bytes(0), readahead(4) {
+    resident[0] = resident[1] = -1;
+}
+
+MappedSlotStore::~MappedSlotStore() {
+    close();
+}
+
+void MappedSlotStore::open(const std::string& path, int num_buckets, int bucket_size, size_t record_bytes) {
+    if (num_buckets <= 0 || bucket_size <= 0)
+        throw std::invalid_argument("MappedSlotStore requires a positive bucket count and size.");
+    if (record_bytes == 0 || record_bytes > UINT32_MAX)
+        throw std::invalid_argument("MappedSlotStore: record size must be between 1 and 2^32-1 bytes.");
+    close();
+
+    B = num_buckets;
+    Z = bucket_size;
+    max_record = record_bytes;
+    // Keep slots 8-byte aligned so the length prefix is never split.
+    slot_bytes = (kLengthBytes + record_bytes + 7) & ~static_cast<size_t>(7);
+    mapped_bytes = 2 * static_cast<size_t>(B) * static_cast<size_t>(Z) * slot_bytes;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        throw sysError("cannot create " + path);
+    file_path = path;
+    if (::ftruncate(fd, static_cast<off_t>(mapped_bytes)) != 0) {
+        std::runtime_error err = sysError("cannot size " + path);
+        close();
+        throw err;
+    }
+    void* p = ::mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        std::runtime_error err = sysError("cannot map " + path);
+        close();
+        throw err;
+    }
+    base = static_cast<char*>(p);
+    advise(0, mapped_bytes, MADV_SEQUENTIAL);
+    resident[0] = resident[1] = -1;
+    holder[0].assign(B, -1);
+    holder[1].assign(B, -1);
+}
+
+void MappedSlotStore::close() {
+    if (base != nullptr) {
+        ::munmap(base, mapped_bytes);
+        base = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+        ::unlink(file_path.c_str());
+    }
+    file_path.clear();
+    mapped_bytes = 0;
+    resident[0] = resident[1] = -1;
+    holder[0].clear();
+    holder[1].clear();
+}
+
+bool MappedSlotStore::is_resident(int level) const {
+    return level >= 0 && resident[level & 1] == level;
+}
+
+size_t MappedSlotStore::bucket_offset(int level, int bucket_index) const {
+    if (base == nullptr)
+        throw std::logic_error("MappedSlotStore: store is not open.");
+    if (level < 0)
+        throw std::out_of_range("MappedSlotStore: negative level.");
+    if (bucket_index < 0 || bucket_index >= B)
+        throw std::out_of_range("MappedSlotStore: bucket index " + std::to_string(bucket_index) + " out of range.");
+    size_t slab = static_cast<size_t>(level & 1) * static_cast<size_t>(B) * static_cast<size_t>(Z);
+    return (slab + static_cast<size_t>(bucket_index) * static_cast<size_t>(Z)) * slot_bytes;
+}
+
+size_t MappedSlotStore::slot_offset(int level, int bucket_index, int slot) const {
+    if (slot < 0 || slot >= Z)
+        throw std::out_of_range("MappedSlotStore: slot " + std::to_string(slot) + " out of range.");
+    return bucket_offset(level, bucket_index) + static_cast<size_t>(slot) * slot_bytes;
+}
+
+void MappedSlotStore::write_record(int level, int bucket_index, int slot, const char* data, size_t len) {
+    if (len > max_record)
+        throw std::length_error("MappedSlotStore: record of " + std::to_string(len) +
+                                " bytes does not fit a " + std::to_string(max_record) + "-byte slot.");
+    char* dst = base + slot_offset(level, bucket_index, slot);
+    uint32_t n = static_cast<uint32_t>(len);
+    std::memcpy(dst, &n, kLengthBytes);
+    std::memcpy(dst + kLengthBytes, data, len);
+    holder[level & 1][bucket_index] = level;
+    if (level > resident[level & 1])
+        resident[level & 1] = level;
+}
+
+const char* MappedSlotStore::read_record(int level, int bucket_index, int slot, size_t& len) const {
+    const char* src = base + slot_offset(level, bucket_index, slot);
+    if (holder[level & 1][bucket_index] != level)
+        throw std::out_of_range("MappedSlotStore: level " + std::to_string(level) + " is not resident.");
+    uint32_t n;
+    std::memcpy(&n, src, kLengthBytes);
+    if (n > max_record)
+        throw std::runtime_error("MappedSlotStore: corrupt slot length.");
+    len = n;
+    return src + kLengthBytes;
+}
+
+// madvise wants page-aligned ranges. Widening the range is always safe here:
+// the mapping is MAP_SHARED, so dropped pages are simply re-read from the file.
+void MappedSlotStore::advise(size_t offset, size_t len, int advice) const {
+    if (base == nullptr || len == 0)
+        return;
+    static const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t start = offset & ~(page - 1);
+    size_t end = offset + len;
+    if (end > mapped_bytes)
+        end = mapped_bytes;
+    // Hints are advisory; failures are ignored.
+    (void)::madvise(base + start, end - start, advice);
+}
+
+void MappedSlotStore::finished_reading(int level, int bucket_index) {
+    size_t bucket_bytes = static_cast<size_t>(Z) * slot_bytes;
+    // The reader never comes back to this bucket: drop it from the mapping.
+    advise(bucket_offset(level, bucket_index), bucket_bytes, MADV_DONTNEED);
+    // Read-ahead: start faulting in the bucket `readahead` steps ahead.
+    int ahead = bucket_index + readahead;
+    if (readahead > 0 && ahead < B)
+        advise(bucket_offset(level, ahead), bucket_bytes, MADV_WILLNEED);
+}
+
+void MappedSlotStore::finished_writing(int level, int bucket_index) {
+    size_t bucket_bytes = static_cast<size_t>(Z) * slot_bytes;
+    size_t off = bucket_offset(level, bucket_index);
+    // Write-behind: start writeback of this bucket now instead of letting dirty
+    // pages pile up until the kernel is under memory pressure.
+#ifdef __linux__
+    (void)::sync_file_range(fd, static_cast<off_t>(off), static_cast<off_t>(bucket_bytes), SYNC_FILE_RANGE_WRITE);
+#else
+    static const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t start = off & ~(page - 1);
+    (void)::msync(base + start, off + bucket_bytes - start, MS_ASYNC);
+#endif
+    advise(off, bucket_bytes, MADV_DONTNEED);
+    // A finished level is read next, from its first bucket.
+    if (bucket_index == B - 1 && readahead > 0) {
+        int count = readahead < B ? readahead : B;
+        advise(bucket_offset(level, 0), static_cast<size_t>(count) * bucket_bytes, MADV_WILLNEED);
+    }
+}
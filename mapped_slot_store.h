@@ -0,0 +1,76 @@
+#ifndef MAPPED_SLOT_STORE_H
+#define MAPPED_SLOT_STORE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/*
+ * MappedSlotStore:
+ * File-backed counterpart of LevelArena for inputs that do not fit in RAM.
+ *
+ * The file holds two slabs of B x Z fixed-size slots, one for even and one for
+ * odd levels, exactly like the arena. Each slot is a 4-byte length followed by
+ * up to record_bytes bytes of ciphertext. The file is mapped MAP_SHARED and the
+ * kernel pages it in and out; the store only tells it what the butterfly is
+ * going to do next:
+ *   - a level is read front to back once, so the mapping is MADV_SEQUENTIAL,
+ *     buckets a few steps ahead of the reader get MADV_WILLNEED and buckets
+ *     that have been consumed get MADV_DONTNEED;
+ *   - a written bucket is never touched again until the next level, so its
+ *     pages are handed to writeback right away (write-behind) and dropped from
+ *     the mapping.
+ * As in the arena, reads are checked per bucket (a bucket of level l is
+ * readable until level l+2 writes that bucket).
+ *
+ * The file is scratch space: it is created by open() and removed by close().
+ */
+class MappedSlotStore {
+public:
+    MappedSlotStore();
+    ~MappedSlotStore();
+
+    // Creates `path` and maps two slabs of B x Z slots of record_bytes each.
+    void open(const std::string& path, int num_buckets, int bucket_size, size_t record_bytes);
+    void close();
+    bool is_open() const { return base != nullptr; }
+
+    int num_buckets() const { return B; }
+    int bucket_size() const { return Z; }
+    size_t record_bytes() const { return max_record; }
+    size_t file_bytes() const { return mapped_bytes; }
+    bool is_resident(int level) const;
+
+    // Number of buckets ahead of the reader that are prefetched (default 4).
+    void set_readahead(int buckets) { readahead = buckets < 0 ? 0 : buckets; }
+
+    void write_record(int level, int bucket_index, int slot, const char* data, size_t len);
+    // Returns a pointer to the record stored in a slot and its length in `len`.
+    const char* read_record(int level, int bucket_index, int slot, size_t& len) const;
+
+    // Access-pattern hints, called once a whole bucket has been read or written.
+    void finished_reading(int level, int bucket_index);
+    void finished_writing(int level, int bucket_index);
+
+private:
+    MappedSlotStore(const MappedSlotStore&) = delete;
+    MappedSlotStore& operator=(const MappedSlotStore&) = delete;
+
+    size_t bucket_offset(int level, int bucket_index) const;
+    size_t slot_offset(int level, int bucket_index, int slot) const;
+    void advise(size_t offset, size_t len, int advice) const;
+
+    std::string file_path;
+    int fd;
+    char* base;
+    size_t mapped_bytes;
+    int B;
+    int Z;
+    size_t max_record;
+    size_t slot_bytes;
+    int readahead;
+    int resident[2];
+    std::vector<int> holder[2]; // Level held by each bucket of a slab.
+};
+
+#endif // MAPPED_SLOT_STORE_H
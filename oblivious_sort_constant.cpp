@@ -3,196 +3,97 @@
 #include <algorithm>
 #include <random>
 #include <cstring>
+#include <iterator>
 #include <cassert>
 #include <cmath>
 #include <iomanip>
-// --------------------- Crypto++ Headers ---------------------
-#include <cryptopp/aes.h>
-#include <cryptopp/modes.h>
-#include <cryptopp/filters.h>
-#include <cryptopp/osrng.h>
-#include <cstring>
-
-// --------------------- Crypto++ Helper Functions ---------------------
-namespace {
-    using namespace CryptoPP;
-    // Global AES key and IV for encryption within the enclave.
-    SecByteBlock aesKey(AES::DEFAULT_KEYLENGTH);
-    byte aesIV[AES::BLOCKSIZE];
-    bool aesInitialized = false;
-
-    // Initialize the AES key and IV once.
-    void initAES() {
-        if (!aesInitialized) {
-            AutoSeededRandomPool prng;
-            prng.GenerateBlock(aesKey, aesKey.size());
-            prng.GenerateBlock(aesIV, sizeof(aesIV));
-            aesInitialized = true;
-        }
-    }
 
+// Fixed working buffer size for streaming operations.
+const int WORKING_SIZE = 64;
 
-
-// Encrypt with explicit binary handling
-std::string encrypt_blob(const std::string &plaintext) {
-    initAES();
-    std::string ciphertext;
-    CTR_Mode<AES>::Encryption encryptor;
-    encryptor.SetKeyWithIV(aesKey, aesKey.size(), aesIV);
-    StringSource ss(
-        plaintext, 
-        true,
-        new StreamTransformationFilter(
-            encryptor,
-            new StringSink(ciphertext)
-        )
-    );
-    
-    return ciphertext;
-}
-
-// Decrypt with explicit binary handling
-std::string decrypt_blob(const std::string &ciphertext) {
-    initAES();
-    std::string plaintext;
-    CTR_Mode<AES>::Decryption decryptor;
-    decryptor.SetKeyWithIV(aesKey, aesKey.size(), aesIV);
-    StringSource ss(
-        ciphertext, 
-        true,
-        new StreamTransformationFilter(
-            decryptor,
-            new StringSink(plaintext)
-        )
-    );
-    return plaintext;
+// ----- External-memory merge-split helpers -----
+//
+// The merge-split and the final permutation never hold a whole bucket in the
+// enclave: the buckets they work on are treated as one array of WORKING_SIZE
+// blocks left in untrusted memory, and every step loads at most two blocks.
+// Enclave memory is therefore 2 * WORKING_SIZE elements whatever Z is, and
+// the block schedule depends only on Z, never on the data.
+
+// Elements per block: WORKING_SIZE, or the whole bucket when Z is smaller.
+static int blockSize(int Z) {
+    return std::min(WORKING_SIZE, Z);
 }
 
-    // Serialize an Element into a binary string.
-    // We pack the following in order: 
-    // - sorting (4 bytes, int)
-    // - key (4 bytes, int)
-    // - is_dummy flag (1 byte)
-    // - payload length (4 bytes, uint32_t)
-    // - payload content.
-    std::string serializeElement(const Element &e) {
-        std::string out;
-        out.append(reinterpret_cast<const char*>(&e.sorting), sizeof(e.sorting));
-        out.append(reinterpret_cast<const char*>(&e.key), sizeof(e.key));
-        char flag = e.is_dummy ? 1 : 0;
-        out.append(&flag, sizeof(flag));
-        uint32_t payload_len = static_cast<uint32_t>(e.payload.size());
-        out.append(reinterpret_cast<const char*>(&payload_len), sizeof(payload_len));
-        out.append(e.payload);
-        return out;
+// Write passes of externalBitonicMerge over n slots: every stage rewrites
+// each block once.
+static uint32_t mergePasses(int n, int W) {
+    uint32_t passes = 0;
+    for (int k = 2 * W; k <= n; k *= 2) {
+        for (int j = k / 2; j >= W; j /= 2)
+            passes++;
+        passes++; // The stages inside each block.
     }
-    // Deserialize a binary string back into an Element.
-    Element deserializeElement(const std::string &data) {
-        const size_t header_size = sizeof(int) + sizeof(int) + 1 + sizeof(uint32_t); // 4+4+1+4 = 13 bytes
-        if (data.size() < header_size) {
-            std::cout<<data<<std::endl;
-            throw std::runtime_error("Decrypted blob too short to contain header.");
-        }
-        Element e;
-        size_t offset = 0;
-        std::memcpy(&e.sorting, data.data() + offset, sizeof(e.sorting));
-        offset += sizeof(e.sorting);
-        std::memcpy(&e.key, data.data() + offset, sizeof(e.key));
-        offset += sizeof(e.key);
-        char flag;
-        std::memcpy(&flag, data.data() + offset, sizeof(flag));
-        e.is_dummy = (flag != 0);
-        offset += sizeof(flag);
-        uint32_t payload_len;
-        std::memcpy(&payload_len, data.data() + offset, sizeof(payload_len));
-        offset += sizeof(payload_len);
-        if (offset + payload_len > data.size()) {
-            throw std::out_of_range("Decrypted blob payload length out of range.");
-        }
-        e.payload = data.substr(offset, payload_len);
-        return e;
-    }
-    
-} // end anonymous namespace
+    return passes;
+}
 
-// Fixed working buffer size for streaming operations.
-const int WORKING_SIZE = 64;
-// ----- UntrustedMemory Methods -----
+// Write pass the blocks of `level` are at once the butterfly has written it:
+// level 0 is written once by initializeBuckets, later levels by a
+// merge-split (one pass of sorted runs, then the merge of two buckets).
+static uint32_t levelPass(int level, int Z) {
+    return level == 0 ? 0 : mergePasses(2 * Z, blockSize(Z));
+}
 
-std::vector<Element> UntrustedMemory::read_bucket(int level, int bucket_index) {
-    std::pair<int,int> key = { level, bucket_index };
-    return storage[key];
+// Block g of the array formed by `buckets` at `level`, in that order.
+static BucketRange arrayBlock(int level, const std::vector<int>& buckets, int g, int W, int Z) {
+    int index = g * W;
+    return BucketRange{ level, buckets[index / Z], index % Z, W };
 }
 
-void UntrustedMemory::write_bucket(int level, int bucket_index, const std::vector<Element>& bucket) {
-    std::pair<int,int> key = { level, bucket_index };
-    storage[key] = bucket;
+// Key compared by the network. A dummy carries its tag, 1, in `key`; a
+// real element's tag (0 or 2) comes from its routing bit, so its own key is
+// kept for the next level. bit_index < 0 compares the keys themselves.
+static int sortKey(const Element& e, int bit_index) {
+    if (bit_index < 0 || e.is_dummy)
+        return e.key;
+    return ((e.key >> bit_index) & 1) << 1;
 }
 
-std::vector<std::string> UntrustedMemory::get_access_log() {
-    return access_log;
+static void compareExchange(Element& a, Element& b, bool ascending, int bit_index) {
+    int ka = sortKey(a, bit_index), kb = sortKey(b, bit_index);
+    if ((ascending && ka > kb) || (!ascending && ka < kb))
+        std::swap(a, b);
 }
 
-std::vector<Element> UntrustedMemory::read_bucket_block(int level, int bucket_index, int offset, int block_size) {
-    std::pair<int,int> key = { level, bucket_index };
-    const std::vector<Element>& bucket = storage[key];
-    int end = std::min(static_cast<int>(bucket.size()), offset + block_size);
-    std::vector<Element> block(bucket.begin() + offset, bucket.begin() + end);
-    return block;
+// Bitonic stages j = top, top/2, ..., 1 of merge size k on one block whose
+// first element sits at array index `base` (the direction follows the index).
+static void blockStages(std::vector<Element>& block, int base, int k, int top, int bit_index) {
+    int W = static_cast<int>(block.size());
+    for (int j = top; j > 0; j /= 2)
+        for (int t = 0; t < W; t++) {
+            int partner = t ^ j;
+            if (partner > t)
+                compareExchange(block[t], block[partner], ((base + t) & k) == 0, bit_index);
+        }
 }
 
-void UntrustedMemory::write_bucket_block(int level, int bucket_index, int offset, const std::vector<Element>& block) {
-    std::pair<int,int> key = { level, bucket_index };
-    std::vector<Element>& bucket = storage[key];
-    if (bucket.size() < static_cast<size_t>(offset + block.size()))
-        bucket.resize(offset + block.size());
-    for (size_t i = 0; i < block.size(); i++) {
-        bucket[offset + i] = block[i];
-    }
+// Every stage with k <= block size: block g ends up sorted ascending when g is
+// even and descending when g is odd, ready for Enclave::externalBitonicMerge.
+static void sortRuns(std::vector<Element>& block, int base, int bit_index) {
+    for (int k = 2; k <= static_cast<int>(block.size()); k *= 2)
+        blockStages(block, base, k, k / 2, bit_index);
 }
 
 // ----- Enclave Methods -----
 
-Enclave::Enclave(UntrustedMemory* u) : untrusted(u) {
+Enclave::Enclave(UntrustedMemory* u) : RecordEnclave<Element>(u) {
     std::random_device rd;
     rng.seed(rd());
 }
-// Updated encryption: serialize the entire Element (including the is_dummy flag)
-// and encrypt the resulting blob. The cleartext fields are then overwritten.
-std::vector<Element> Enclave::encryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> encrypted;
-    for (const auto &elem : bucket) {
-        // Serialize the complete element.
-        std::string serialized = serializeElement(elem);
-        // Encrypt the serialized data.
-        std::string encrypted_blob = encrypt_blob(serialized);
-        // Create a new Element that hides cleartext information.
-        Element encElem;
-        encElem.sorting = 0;   // Overwrite with dummy value.
-        encElem.key = 0;       // Overwrite with dummy value.
-        encElem.is_dummy = false; // The actual flag is hidden inside the blob.
-        // Store the encrypted blob in the payload field.
-        encElem.payload = encrypted_blob;
-        encrypted.push_back(encElem);
-    }
-    return encrypted;
-}
-
-// Updated decryption: decrypt each element's blob and deserialize to recover all fields.
-std::vector<Element> Enclave::decryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> decrypted;
-    for (const auto &encElem : bucket) {
-        // Decrypt the blob stored in the payload.
-        std::string decrypted_blob = decrypt_blob(encElem.payload);
-        // Deserialize to recover the original Element.
-        Element elem = deserializeElement(decrypted_blob);
-        decrypted.push_back(elem);
-    }
-    return decrypted;
-}
-
 
 std::pair<int,int> Enclave::computeBucketParameters(int n, int Z) {
+    // The block bitonic network needs a power-of-two bucket.
+    if (Z <= 0 || (Z & (Z - 1)) != 0)
+        throw std::invalid_argument("Bucket size must be a power of two.");
     int minimalB = static_cast<int>(std::ceil((2.0 * n) / Z));
     int safety_factor = 16; // Increase safety
     int B_required = minimalB * safety_factor;
@@ -206,250 +107,146 @@ std::pair<int,int> Enclave::computeBucketParameters(int n, int Z) {
 }
 
 // Initialize buckets by dividing the input evenly and padding with dummies,
-// writing each bucket block-by-block.
-// Change the signature to match the header:
+// building and writing each bucket one block at a time.
 void Enclave::initializeBuckets(const std::vector<Element>& input_array, int B, int Z) {
     int n = input_array.size();
+    beginRun(input_array);
+    untrusted->allocate(B, Z);
     int group_size = (n + B - 1) / B; // ceiling(n/B)
+    int W = blockSize(Z);
+    std::uniform_int_distribution<int> key_dist(0, B - 1);
     for (int i = 0; i < B; i++) {
-        std::vector<Element> bucket;
         int start = i * group_size;
         int end = std::min(start + group_size, n);
-        for (int j = start; j < end; j++) {
-            std::uniform_int_distribution<int> key_dist(0, B - 1);
-            int random_key = key_dist(rng);
-            // Use the sorting value and payload from the input Element.
-            bucket.push_back(Element{ input_array[j].sorting, input_array[j].payload, random_key, false });
-        }
-        if (bucket.size() > static_cast<size_t>(Z / 2))
+        if (end - start > Z / 2)
             throw std::overflow_error("Bucket overflow in initializeBuckets: too many real elements.");
-        // Create dummy elements correctly: sorting=0, payload="", key=0, is_dummy=true.
-        while (bucket.size() < static_cast<size_t>(Z))
-            bucket.push_back(Element{ 0, "", 0, true });
-        std::vector<Element> encrypted_bucket = encryptBucket(bucket);
-        for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-            int block_size = std::min(WORKING_SIZE, Z - offset);
-            std::vector<Element> block(encrypted_bucket.begin() + offset, encrypted_bucket.begin() + offset + block_size);
-            untrusted->write_bucket_block(0, i, offset, block);
-        }
-    }
-}
-
-// In-memory bitonic sort and merge (since Z is constant, these use O(1) storage).
-void Enclave::bitonicMerge(std::vector<Element>& a, int low, int cnt, bool ascending) {
-    if (cnt > 1) {
-        int k = cnt / 2;
-        for (int i = low; i < low + k; i++) {
-            if ((ascending && a[i].key > a[i+k].key) ||
-                (!ascending && a[i].key < a[i+k].key))
-                std::swap(a[i], a[i+k]);
+        for (int offset = 0; offset < Z; offset += W) {
+            std::vector<Element> block;
+            block.reserve(W);
+            for (int j = start + offset; j < start + offset + W; j++) {
+                // Use the sorting value and payload from the input Element.
+                if (j < end)
+                    block.push_back(Element{ input_array[j].sorting, input_array[j].payload, key_dist(rng), false });
+                else
+                    block.push_back(Element{ 0, "", 0, true });
+            }
+            storeBuckets({ BucketRange{ 0, i, offset, W } }, { make_bucket_view(block) });
         }
-        bitonicMerge(a, low, k, ascending);
-        bitonicMerge(a, low+k, k, ascending);
     }
 }
 
-void Enclave::bitonicSort(std::vector<Element>& a, int low, int cnt, bool ascending) {
-    if (cnt > 1) {
-        int k = cnt / 2;
-        bitonicSort(a, low, k, true);
-        bitonicSort(a, low+k, k, false);
-        bitonicMerge(a, low, cnt, ascending);
-    }
-}
-
-// Streaming merge: Merge two sorted subarrays [start, mid) and [mid, end)
-// using a fixed-size working buffer.
-void Enclave::constantSpaceMerge(std::vector<Element>& arr, int start, int mid, int end) {
-    int left = start, right = mid, out = start;
-    std::vector<Element> buffer;
-    buffer.reserve(WORKING_SIZE);
-    while (left < mid && right < end) {
-        buffer.clear();
-        while ((int)buffer.size() < WORKING_SIZE && left < mid && right < end) {
-            if (arr[left].key <= arr[right].key)
-                buffer.push_back(arr[left++]);
-            else
-                buffer.push_back(arr[right++]);
+// Merges the sorted runs left by sortRuns into one ascending array: the
+// buckets.size() * Z slots of `buckets` at `level`. Stages that span
+// blocks compare two blocks slot by slot; the rest finish inside each block.
+// Each stage reads every block at `pass` and writes it at pass + 1, so the
+// blocks end at pass + mergePasses(buckets.size() * Z, W).
+uint32_t Enclave::externalBitonicMerge(int level, const std::vector<int>& buckets, int Z, int bit_index, uint32_t pass) {
+    int W = blockSize(Z);
+    int n = static_cast<int>(buckets.size()) * Z;
+    int blocks = n / W;
+    for (int k = 2 * W; k <= n; k *= 2) {
+        for (int j = k / 2; j >= W; j /= 2) {
+            for (int g = 0; g < blocks; g++) {
+                int h = g ^ (j / W);
+                if (h < g)
+                    continue;
+                std::vector<BucketRange> ranges{ arrayBlock(level, buckets, g, W, Z),
+                                                 arrayBlock(level, buckets, h, W, Z) };
+                std::vector<std::vector<Element>> pair = loadBuckets(ranges, pass);
+                bool ascending = ((g * W) & k) == 0;
+                for (int t = 0; t < W; t++)
+                    compareExchange(pair[0][t], pair[1][t], ascending, bit_index);
+                storeBuckets(ranges, make_bucket_views(pair), pass + 1);
+            }
+            pass++;
         }
-        while ((int)buffer.size() < WORKING_SIZE && left < mid)
-            buffer.push_back(arr[left++]);
-        while ((int)buffer.size() < WORKING_SIZE && right < end)
-            buffer.push_back(arr[right++]);
-        for (size_t i = 0; i < buffer.size(); i++) {
-            arr[out + i] = buffer[i];
+        for (int g = 0; g < blocks; g++) {
+            std::vector<BucketRange> ranges{ arrayBlock(level, buckets, g, W, Z) };
+            std::vector<Element> block = std::move(loadBuckets(ranges, pass)[0]);
+            blockStages(block, g * W, k, W / 2, bit_index);
+            storeBuckets(ranges, { make_bucket_view(block) }, pass + 1);
         }
-        out += buffer.size();
+        pass++;
     }
-    while (left < mid)
-        arr[out++] = arr[left++];
-    while (right < end)
-        arr[out++] = arr[right++];
+    return pass;
 }
 
-// Streaming block-based bitonic sort: Sort an array (of size 2Z) using block merges.
-void Enclave::constantSpaceBitonicSort(std::vector<Element>& arr) {
-    int n = arr.size();
-    for (int start = 0; start < n; start += WORKING_SIZE) {
-        int len = std::min(WORKING_SIZE, n - start);
-        bitonicSort(arr, start, len, true);
-    }
-    int current_block_size = WORKING_SIZE;
-    while (current_block_size < n) {
-        for (int start = 0; start < n; start += 2 * current_block_size) {
-            int mid = std::min(start + current_block_size, n);
-            int end = std::min(start + 2 * current_block_size, n);
-            constantSpaceMerge(arr, start, mid, end);
-        }
-        current_block_size *= 2;
-    }
-}
-
-// Modified merge_split_bitonic that streams the processing of two buckets.
-// The parameter Z is passed in so that we know the bucket size.
-std::pair<std::vector<Element>, std::vector<Element>> Enclave::merge_split_bitonic(
-    const std::vector<Element>& bucket1,
-    const std::vector<Element>& bucket2,
-    int level, int total_levels, int Z) {
-
-    int L = total_levels;
-    int bit_index = L - 1 - level;
-
-    // Streaming count: Process each bucket in blocks.
+// External merge-split of the pair node.in at node.level into node.out at
+// level+1, on key bit `bit_index`. Both buckets are streamed block by block
+// in one pass that counts the real elements bound for each side, tags every
+// dummy 1, sorts each block and writes it to level+1; externalBitonicMerge
+// then finishes the sort there. The array ends as the count0 reals tagged 0,
+// the dummies, then the count1 reals tagged 2, so with both counts at most Z
+// the first Z slots (the 0s and Z - count0 dummies) land in node.out[0] and
+// the last Z in node.out[1], without knowing the counts before tagging.
+void Enclave::merge_split_external(const ButterflyNode& node, int bit_index, int Z) {
+    int level = node.level;
+    int W = blockSize(Z);
+    int blocks = 2 * Z / W;
+
+    uint32_t in_pass = levelPass(level, Z);
     int count0 = 0, count1 = 0;
-    for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-        int block_size = std::min(WORKING_SIZE, Z - offset);
-        for (int i = 0; i < block_size; i++) {
-            const Element &e = bucket1[offset + i];
-            if (!e.is_dummy) {
-                if (((e.key >> bit_index) & 1) == 0)
-                    count0++;
-                else
-                    count1++;
-            }
-        }
-        for (int i = 0; i < block_size; i++) {
-            const Element &e = bucket2[offset + i];
-            if (!e.is_dummy) {
-                if (((e.key >> bit_index) & 1) == 0)
-                    count0++;
-                else
-                    count1++;
-            }
+    for (int g = 0; g < blocks; g++) {
+        std::vector<Element> block = std::move(loadBuckets({ arrayBlock(level, node.in, g, W, Z) }, in_pass)[0]);
+        for (Element &e : block) {
+            if (e.is_dummy)
+                e.key = 1;
+            else if (((e.key >> bit_index) & 1) == 0)
+                count0++;
+            else
+                count1++;
         }
+        sortRuns(block, g * W, bit_index);
+        storeBuckets({ arrayBlock(level + 1, node.out, g, W, Z) }, { make_bucket_view(block) });
     }
     if (count0 > Z || count1 > Z)
         throw std::overflow_error("Bucket overflow occurred in merge_split.");
-
-    int needed_dummies0 = Z - count0;
-    int needed_dummies1 = Z - count1;
-    int assigned_dummies0 = 0, assigned_dummies1 = 0;
-
-    // Stream the two buckets into a combined array block-by-block.
-    std::vector<Element> combined(2 * Z);
-    for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-        int block_size = std::min(WORKING_SIZE, Z - offset);
-        for (int i = 0; i < block_size; i++) {
-            Element e = bucket1[offset + i];
-            if (!e.is_dummy) {
-                int bit_val = (e.key >> bit_index) & 1;
-                e.key = (bit_val << 1);
-            }
-            combined[offset + i] = e;
-        }
-        for (int i = 0; i < block_size; i++) {
-            Element e = bucket2[offset + i];
-            if (!e.is_dummy) {
-                int bit_val = (e.key >> bit_index) & 1;
-                e.key = (bit_val << 1);
-            }
-            combined[Z + offset + i] = e;
-        }
-    }
-    // Stream-tag dummy elements.
-    for (int offset = 0; offset < 2 * Z; offset += WORKING_SIZE) {
-        int block_size = std::min(WORKING_SIZE, 2 * Z - offset);
-        for (int i = 0; i < block_size; i++) {
-            int idx = offset + i;
-            if (combined[idx].is_dummy) {
-                if (assigned_dummies0 < needed_dummies0) {
-                    combined[idx].key = 1;
-                    assigned_dummies0++;
-                } else {
-                    combined[idx].key = 3;
-                    assigned_dummies1++;
-                }
-            }
-        }
-    }
-    // Sort the combined array using our constant-space bitonic sort.
-    constantSpaceBitonicSort(combined);
-    // Stream-copy sorted results into two output buckets.
-    std::vector<Element> out_bucket0(Z), out_bucket1(Z);
-    for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-        int block_size = std::min(WORKING_SIZE, Z - offset);
-        for (int i = 0; i < block_size; i++) {
-            out_bucket0[offset + i] = combined[offset + i];
-            out_bucket1[offset + i] = combined[Z + offset + i];
-        }
-    }
-    return { out_bucket0, out_bucket1 };
+    externalBitonicMerge(level + 1, node.out, Z, bit_index, 0);
 }
 
-// Process the butterfly network using block-based I/O.
+// Process the butterfly network with external merge-splits. The pairs and
+// the key bit of each level come from the topology (see butterfly_topology.h).
 void Enclave::performButterflyNetwork(int B, int L, int Z) {
-    for (int level = 0; level < L; level++) {
-        for (int i = 0; i < B; i += 2) {
-            std::vector<Element> bucket1_enc, bucket2_enc;
-            for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-                auto block1 = untrusted->read_bucket_block(level, i, offset, WORKING_SIZE);
-                bucket1_enc.insert(bucket1_enc.end(), block1.begin(), block1.end());
-                auto block2 = untrusted->read_bucket_block(level, i+1, offset, WORKING_SIZE);
-                bucket2_enc.insert(bucket2_enc.end(), block2.begin(), block2.end());
-            }
-            std::vector<Element> bucket1 = decryptBucket(bucket1_enc);
-            std::vector<Element> bucket2 = decryptBucket(bucket2_enc);
-            auto merge_result = merge_split_bitonic(bucket1, bucket2, level, L, Z);
-            std::vector<Element> out_bucket0 = encryptBucket(merge_result.first);
-            std::vector<Element> out_bucket1 = encryptBucket(merge_result.second);
-
-            for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-                int block_size = std::min(WORKING_SIZE, Z - offset);
-                std::vector<Element> block0(out_bucket0.begin() + offset, out_bucket0.begin() + offset + block_size);
-                std::vector<Element> block1(out_bucket1.begin() + offset, out_bucket1.begin() + offset + block_size);
-                untrusted->write_bucket_block(level+1, i, offset, block0);
-                untrusted->write_bucket_block(level+1, i+1, offset, block1);
-            }
-        }
-    }
+    ButterflyTopology topo(topology, L);
+    if (topo.buckets() != B)
+        throw std::invalid_argument("performButterflyNetwork: B must be 2^L.");
+    for (int level = 0; level < L; level++)
+        for (const ButterflyNode& node : topo.pairs(level))
+            merge_split_external(node, topo.key_bit(level), Z);
 }
 
-// Stream extraction of final elements.
+// Stream extraction of final elements: each bucket is permuted in place and
+// then read back one block at a time.
 std::vector<Element> Enclave::extractFinalElements(int B, int L, int Z) {
     std::vector<Element> final_elements;
-    // Assume we know Z (the bucket size) from the original oblivious_sort call.
+    int W = blockSize(Z);
     for (int i = 0; i < B; i++) {
-        std::vector<Element> bucket_enc;
-        for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-            auto block = untrusted->read_bucket_block(L, i, offset, WORKING_SIZE);
-            bucket_enc.insert(bucket_enc.end(), block.begin(), block.end());
+        uint32_t pass = obliviousPermuteBucket(L, i, Z);
+        for (int offset = 0; offset < Z; offset += W) {
+            std::vector<std::vector<Element>> blocks = loadBuckets({ BucketRange{ L, i, offset, W } }, pass);
+            for (const auto &elem : blocks[0])
+                if (!elem.is_dummy)
+                    final_elements.push_back(elem);
         }
-        std::vector<Element> bucket = decryptBucket(bucket_enc);
-        obliviousPermuteBucket(bucket);
-        for (const auto &elem : bucket)
-            if (!elem.is_dummy)
-                final_elements.push_back(elem);
     }
     return final_elements;
 }
 
-
-// Oblivious permutation on a bucket using in-memory bitonic sort (bucket size is constant).
-void Enclave::obliviousPermuteBucket(std::vector<Element>& bucket) {
-    for (auto &elem : bucket) {
-        elem.key = rng();
+// Oblivious permutation of a bucket in untrusted memory: random keys, then
+// the same block bitonic network sorts the bucket by them. Returns the write
+// pass the bucket's blocks are left at.
+uint32_t Enclave::obliviousPermuteBucket(int level, int bucket_index, int Z) {
+    int W = blockSize(Z);
+    uint32_t pass = levelPass(level, Z);
+    for (int offset = 0; offset < Z; offset += W) {
+        std::vector<BucketRange> ranges{ BucketRange{ level, bucket_index, offset, W } };
+        std::vector<Element> block = std::move(loadBuckets(ranges, pass)[0]);
+        for (auto &elem : block)
+            elem.key = rng();
+        sortRuns(block, offset, -1);
+        storeBuckets(ranges, { make_bucket_view(block) }, pass + 1);
     }
-    bitonicSort(bucket, 0, bucket.size(), true);
+    return externalBitonicMerge(level, { bucket_index }, Z, -1, pass + 1);
 }
 
 // Final non-oblivious sort of extracted elements. (If final_elements is large, use external sort.)
@@ -469,8 +266,21 @@ std::vector<Element> Enclave::oblivious_sort(const std::vector<Element>& input_a
     int Z = bucket_size; // Define Z here.
     auto params = computeBucketParameters(n, Z);
     int B = params.first, L = params.second;
-    initializeBuckets(input_array, B, Z);
-    performButterflyNetwork(B, L, Z);
-    std::vector<Element> final_elements = extractFinalElements(B, L, Z);
+    // Input and output both stay resident in the enclave.
+    size_t data_bytes = cost ? blockBytes(make_bucket_view(input_array)) : 0;
+    {
+        CostPhase phase(cost, "initialize", untrusted->transitions, data_bytes);
+        initializeBuckets(input_array, B, Z);
+    }
+    {
+        CostPhase phase(cost, "butterfly", untrusted->transitions);
+        performButterflyNetwork(B, L, Z);
+    }
+    std::vector<Element> final_elements;
+    {
+        CostPhase phase(cost, "extract", untrusted->transitions, data_bytes);
+        final_elements = extractFinalElements(B, L, Z);
+    }
+    CostPhase phase(cost, "final sort", untrusted->transitions, 2 * data_bytes);
     return finalSort(final_elements);
 }
\ No newline at end of file
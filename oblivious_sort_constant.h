@@ -2,7 +2,6 @@
 #define OBLIVIOUS_SORT_CONSTANT_H
 
 #include <vector>
-#include <map>
 #include <string>
 #include <sstream>
 #include <cmath>
@@ -11,6 +10,9 @@
 #include <algorithm>
 #include <utility>
 
+#include "record_enclave.h"
+#include "butterfly_topology.h"
+
 /*
  * Element:
  * Represents a data element used in oblivious sorting.
@@ -31,39 +33,21 @@ struct Element {
     bool is_dummy;
 };
 
-class UntrustedMemory {
-public:
-    // Storage: keys are pairs (level, bucket_index), values are encrypted buckets.
-    std::map<std::pair<int, int>, std::vector<Element>> storage;
-    std::vector<std::string> access_log;
-
-    // Reads an encrypted bucket from untrusted memory.
-    std::vector<Element> read_bucket(int level, int bucket_index);
-    // Writes an encrypted bucket to untrusted memory.
-    void write_bucket(int level, int bucket_index, const std::vector<Element>& bucket);
-    // Returns an access log.
-    std::vector<std::string> get_access_log();
+typedef UntrustedBuckets<Element, SealedRecords<Element>> UntrustedMemory;
 
-    // Block-based I/O for streaming operations.
-    std::vector<Element> read_bucket_block(int level, int bucket_index, int offset, int block_size);
-    void write_bucket_block(int level, int bucket_index, int offset, const std::vector<Element>& block);
-};
-
-class Enclave {
+// The butterfly; record I/O comes from RecordEnclave (see record_enclave.h).
+class Enclave : public RecordEnclave<Element> {
 public:
-    UntrustedMemory* untrusted;
     std::mt19937 rng; // Random number generator.
+    // Which buckets each level merge-splits and where the halves go (see
+    // butterfly_topology.h).
+    TopologyKind topology = TopologyKind::InPlace;
 
     // Fixed encryption key for simulation.
     //static constexpr int encryption_key = 0xdeadbeef;
 
     Enclave(UntrustedMemory* u);
 
-    // Encrypts a bucket by serializing each Element (including the dummy flag)
-    // into a single blob and then encrypting that blob using Crypto++.
-    static std::vector<Element> encryptBucket(const std::vector<Element>& bucket);
-    // Decrypts a bucket by decrypting each element's blob and deserializing it.
-    static std::vector<Element> decryptBucket(const std::vector<Element>& bucket);
     void printHexa(const std::string& label, const std::string& data);
     // Computes bucket parameters (B: number of buckets, L: number of levels)
     // given the input size n and bucket capacity Z.
@@ -80,18 +64,13 @@ public:
     // Main oblivious sort function that now works on vector<Element>.
     std::vector<Element> oblivious_sort(const std::vector<Element>& input_array, int bucket_size);
 
-    // In-memory bitonic sort functions.
-    void bitonicMerge(std::vector<Element>& a, int low, int cnt, bool ascending);
-    void bitonicSort(std::vector<Element>& a, int low, int cnt, bool ascending);
-
-    // Streaming/block-based helper functions.
-    void constantSpaceMerge(std::vector<Element>& arr, int start, int mid, int end);
-    void constantSpaceBitonicSort(std::vector<Element>& arr);
-    std::pair<std::vector<Element>, std::vector<Element>> merge_split_bitonic(
-        const std::vector<Element>& bucket1,
-        const std::vector<Element>& bucket2,
-        int level, int total_levels, int Z);
-    void obliviousPermuteBucket(std::vector<Element>& bucket);
+    // External-memory helpers (see oblivious_sort_constant.cpp): at most two
+    // WORKING_SIZE blocks are decrypted in the enclave at any time. The merge
+    // and the permutation take the write pass the blocks are at and return
+    // the pass they leave them at.
+    uint32_t externalBitonicMerge(int level, const std::vector<int>& buckets, int Z, int bit_index, uint32_t pass);
+    void merge_split_external(const ButterflyNode& node, int bit_index, int Z);
+    uint32_t obliviousPermuteBucket(int level, int bucket_index, int Z);
 };
 
 #endif // OBLIVIOUS_SORT_CONSTANT_H
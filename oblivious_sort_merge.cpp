@@ -5,149 +5,12 @@
 #include <cstring>
 #include <cstdint>
 
-// Include Crypto++ headers for stronger encryption.
-#include <cryptopp/aes.h>
-#include <cryptopp/modes.h>
-#include <cryptopp/filters.h>
-#include <cryptopp/osrng.h>
-
-// Anonymous namespace for helper functions.
-namespace {
-    using namespace CryptoPP;
-
-    // Global AES key and IV for encryption within the enclave.
-    SecByteBlock aesKey(AES::DEFAULT_KEYLENGTH);
-    byte aesIV[AES::BLOCKSIZE];
-    bool aesInitialized = false;
-
-    // Initialize the AES key and IV once.
-    void initAES() {
-        if (!aesInitialized) {
-            AutoSeededRandomPool prng;
-            prng.GenerateBlock(aesKey, aesKey.size());
-            prng.GenerateBlock(aesIV, sizeof(aesIV));
-            aesInitialized = true;
-        }
-    }
-
-    // Encrypt a string using AES in CTR mode.
-    std::string encrypt_string(const std::string &s) {
-        initAES();
-        std::string ciphertext;
-        CTR_Mode<AES>::Encryption encryptor;
-        encryptor.SetKeyWithIV(aesKey, aesKey.size(), aesIV);
-        StringSource ss(s, true,
-            new StreamTransformationFilter(encryptor,
-                new StringSink(ciphertext)
-            )
-        );
-        return ciphertext;
-    }
-
-    // Decrypt a string using AES in CTR mode.
-    std::string decrypt_string(const std::string &s) {
-        initAES();
-        std::string recovered;
-        CTR_Mode<AES>::Decryption decryptor;
-        decryptor.SetKeyWithIV(aesKey, aesKey.size(), aesIV);
-        StringSource ss(s, true,
-            new StreamTransformationFilter(decryptor,
-                new StringSink(recovered)
-            )
-        );
-        return recovered;
-    }
-
-    // --- Serialization Helpers ---
-    // Serializes an Element into a binary string.
-    std::string serializeElement(const Element& e) {
-        std::string out;
-        // Append the 4-byte sorting value.
-        out.append(reinterpret_cast<const char*>(&e.sorting), sizeof(e.sorting));
-        // Append the 4-byte key.
-        out.append(reinterpret_cast<const char*>(&e.key), sizeof(e.key));
-        // Append the is_dummy flag as a single byte.
-        char flag = e.is_dummy ? 1 : 0;
-        out.append(&flag, sizeof(flag));
-        // Append the payload length (4 bytes) followed by the payload itself.
-        uint32_t payload_size = e.payload.size();
-        out.append(reinterpret_cast<const char*>(&payload_size), sizeof(payload_size));
-        out.append(e.payload);
-        return out;
-    }
-
-    // Deserializes a binary string back into an Element.
-    Element deserializeElement(const std::string& data) {
-        Element e;
-        size_t offset = 0;
-        std::memcpy(&e.sorting, data.data() + offset, sizeof(e.sorting));
-        offset += sizeof(e.sorting);
-        std::memcpy(&e.key, data.data() + offset, sizeof(e.key));
-        offset += sizeof(e.key);
-        char flag;
-        std::memcpy(&flag, data.data() + offset, sizeof(flag));
-        e.is_dummy = (flag != 0);
-        offset += sizeof(flag);
-        uint32_t payload_size;
-        std::memcpy(&payload_size, data.data() + offset, sizeof(payload_size));
-        offset += sizeof(payload_size);
-        e.payload = data.substr(offset, payload_size);
-        return e;
-    }
-} // anonymous namespace
-
-// ----- UntrustedMemory Methods -----
-std::vector<Element> UntrustedMemory::read_bucket(int level, int bucket_index) {
-    std::pair<int, int> key = { level, bucket_index };
-    return storage[key];
-}
-
-void UntrustedMemory::write_bucket(int level, int bucket_index, const std::vector<Element>& bucket) {
-    std::pair<int, int> key = { level, bucket_index };
-    storage[key] = bucket;
-}
-
-std::vector<std::string> UntrustedMemory::get_access_log() {
-    return access_log;
-}
-
 // ----- Enclave Methods -----
-Enclave::Enclave(UntrustedMemory* u) : untrusted(u) {
+Enclave::Enclave(UntrustedMemory* u) : RecordEnclave<Element>(u) {
     std::random_device rd;
     rng.seed(rd());
 }
 
-// Updated encryption: Serialize and encrypt the entire Element structure, including the dummy flag.
-std::vector<Element> Enclave::encryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> encrypted = bucket;
-    for (auto& elem : encrypted) {
-        // Serialize the complete Element (all fields).
-        std::string serialized = serializeElement(elem);
-        // Encrypt the serialized data.
-        std::string encrypted_blob = encrypt_string(serialized);
-        // Overwrite the cleartext fields to prevent leakage.
-        elem.sorting = 0;
-        elem.key = 0;
-        elem.is_dummy = false; // The true flag is now hidden in the blob.
-        // Store the encrypted blob in the payload.
-        elem.payload = encrypted_blob;
-    }
-    return encrypted;
-}
-
-// Updated decryption: Decrypt and deserialize the encrypted blob to recover the entire Element.
-std::vector<Element> Enclave::decryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> decrypted;
-    for (const auto& enc_elem : bucket) {
-        // Decrypt the blob stored in the payload.
-        std::string decrypted_blob = decrypt_string(enc_elem.payload);
-        // Deserialize to recover the original Element.
-        Element e = deserializeElement(decrypted_blob);
-        decrypted.push_back(e);
-    }
-    return decrypted;
-}
-
 std::pair<int,int> Enclave::computeBucketParameters(int n, int Z) {
     int minimalB = static_cast<int>(std::ceil((2.0 * n) / Z));
     int safety_factor = 1; // Increase safety if needed.
@@ -163,6 +26,8 @@ std::pair<int,int> Enclave::computeBucketParameters(int n, int Z) {
 
 void Enclave::initializeBuckets(const std::vector<Element>& input_array, int B, int Z) {
     int n = input_array.size();
+    beginRun(input_array);
+    untrusted->allocate(B, Z);
     std::vector<Element> elements;
     std::uniform_int_distribution<int> key_dist(0, B - 1);
     for (const Element &elem : input_array) {
@@ -180,14 +45,15 @@ void Enclave::initializeBuckets(const std::vector<Element>& input_array, int B,
         else
             groups[i] = std::vector<Element>(); // Empty group.
     }
+    std::vector<BucketRange> ranges;
     for (int i = 0; i < B; i++) {
-        std::vector<Element> bucket = groups[i];
         // Pad with dummy elements until bucket reaches size Z.
-        while (bucket.size() < static_cast<size_t>(Z))
-            bucket.push_back(Element{ 0, 0, true, "" });
-        
-        untrusted->write_bucket(0, i, encryptBucket(bucket));
+        while (groups[i].size() < static_cast<size_t>(Z))
+            groups[i].push_back(Element{ 0, 0, true, "" });
+        ranges.push_back(BucketRange{ 0, i, 0, Z });
     }
+    // Level 0 goes out in batches of transition_budget buckets.
+    storeBuckets(ranges, make_bucket_views(groups));
 }
 
 // --- New merge_split function (no bitonic sort) ---
@@ -196,15 +62,19 @@ std::pair<std::vector<Element>, std::vector<Element>> Enclave::merge_split(
     const std::vector<Element>& bucket1,
     const std::vector<Element>& bucket2,
     int level, int total_levels, int Z) {
-    
-    int L = total_levels;
-    int bit_index = L - 1 - level;
+    return merge_split_on_bit(bucket1, bucket2, total_levels - 1 - level, Z);
+}
+
+std::pair<std::vector<Element>, std::vector<Element>> Enclave::merge_split_on_bit(
+    const std::vector<Element>& bucket1,
+    const std::vector<Element>& bucket2,
+    int bit_index, int Z) {
     
     // Combine the two buckets (each of size Z) into one vector of size 2Z.
     std::vector<Element> combined = bucket1;
     combined.insert(combined.end(), bucket2.begin(), bucket2.end());
     
-    // Partition the real (non-dummy) elements based on the (i+1)-th MSB.
+    // Partition the real (non-dummy) elements on the routed key bit.
     std::vector<Element> out_bucket0;
     std::vector<Element> out_bucket1;
     
@@ -232,15 +102,30 @@ std::pair<std::vector<Element>, std::vector<Element>> Enclave::merge_split(
 }
 
 void Enclave::performButterflyNetwork(int B, int L, int Z) {
+    // Each batch loads whole bucket pairs in one call, merge-splits them and
+    // stores the results in one more call. The pairs and the key bit of each
+    // level come from the topology (see butterfly_topology.h).
+    ButterflyTopology topo(topology, L);
+    int pairs_per_batch = units_per_batch(transition_budget, 2, B / 2);
     for (int level = 0; level < L; level++) {
-        for (int i = 0; i < B; i += 2) {
-            std::vector<Element> bucket1_enc = untrusted->read_bucket(level, i);
-            std::vector<Element> bucket2_enc = untrusted->read_bucket(level, i + 1);
-            std::vector<Element> bucket1 = decryptBucket(bucket1_enc);
-            std::vector<Element> bucket2 = decryptBucket(bucket2_enc);
-            auto buckets = merge_split(bucket1, bucket2, level, L, Z);
-            untrusted->write_bucket(level + 1, i, encryptBucket(buckets.first));
-            untrusted->write_bucket(level + 1, i + 1, encryptBucket(buckets.second));
+        std::vector<ButterflyNode> nodes = topo.pairs(level);
+        for (size_t first = 0; first < nodes.size(); first += pairs_per_batch) {
+            size_t last = std::min(nodes.size(), first + pairs_per_batch);
+            std::vector<BucketRange> in, out;
+            for (size_t k = first; k < last; k++)
+                for (int j = 0; j < 2; j++) {
+                    in.push_back(BucketRange{ level, nodes[k].in[j], 0, Z });
+                    out.push_back(BucketRange{ level + 1, nodes[k].out[j], 0, Z });
+                }
+            std::vector<std::vector<Element>> buckets = loadBuckets(in);
+            std::vector<std::vector<Element>> results;
+            results.reserve(buckets.size());
+            for (size_t k = 0; k < buckets.size(); k += 2) {
+                auto split = merge_split_on_bit(buckets[k], buckets[k + 1], topo.key_bit(level), Z);
+                results.push_back(std::move(split.first));
+                results.push_back(std::move(split.second));
+            }
+            storeBuckets(out, make_bucket_views(results));
         }
     }
 }
@@ -257,13 +142,18 @@ void Enclave::obliviousPermuteBucket(std::vector<Element>& bucket) {
 
 std::vector<Element> Enclave::extractFinalElements(int B, int L) {
     std::vector<Element> final_elements;
-    for (int i = 0; i < B; i++) {
-        std::vector<Element> bucket_enc = untrusted->read_bucket(L, i);
-        std::vector<Element> bucket = decryptBucket(bucket_enc);
-        obliviousPermuteBucket(bucket);
-        for (const auto& elem : bucket)
-            if (!elem.is_dummy)
-                final_elements.push_back(elem);
+    int Z = untrusted->bucket_size();
+    int per_batch = units_per_batch(transition_budget, 1, B);
+    for (int first = 0; first < B; first += per_batch) {
+        std::vector<BucketRange> ranges;
+        for (int i = first; i < std::min(B, first + per_batch); i++)
+            ranges.push_back(BucketRange{ L, i, 0, Z });
+        for (auto& bucket : loadBuckets(ranges)) {
+            obliviousPermuteBucket(bucket);
+            for (const auto& elem : bucket)
+                if (!elem.is_dummy)
+                    final_elements.push_back(elem);
+        }
     }
     return final_elements;
 }
@@ -282,8 +172,21 @@ std::vector<Element> Enclave::oblivious_sort(const std::vector<Element>& input_a
     int Z = bucket_size;
     auto params = computeBucketParameters(n, Z);
     int B = params.first, L = params.second;
-    initializeBuckets(input_array, B, Z);
-    performButterflyNetwork(B, L, Z);
-    std::vector<Element> final_elements = extractFinalElements(B, L);
+    // Input and output both stay resident in the enclave.
+    size_t data_bytes = cost ? blockBytes(make_bucket_view(input_array)) : 0;
+    {
+        CostPhase phase(cost, "initialize", untrusted->transitions, data_bytes);
+        initializeBuckets(input_array, B, Z);
+    }
+    {
+        CostPhase phase(cost, "butterfly", untrusted->transitions);
+        performButterflyNetwork(B, L, Z);
+    }
+    std::vector<Element> final_elements;
+    {
+        CostPhase phase(cost, "extract", untrusted->transitions, data_bytes);
+        final_elements = extractFinalElements(B, L);
+    }
+    CostPhase phase(cost, "final sort", untrusted->transitions, 2 * data_bytes);
     return finalSort(final_elements);
 }
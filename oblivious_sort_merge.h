@@ -2,7 +2,6 @@
 #define OBLIVIOUS_SORT_MERGE_H
 
 #include <vector>
-#include <map>
 #include <string>
 #include <sstream>
 #include <cmath>
@@ -11,6 +10,9 @@
 #include <algorithm>
 #include <utility>
 
+#include "record_enclave.h"
+#include "butterfly_topology.h"
+
 // Represents a data element with a numeric sorting column and a variable-length payload.
 struct Element {
     int sorting;        // Numeric sorting column.
@@ -19,26 +21,19 @@ struct Element {
     std::string payload; // Variable-length payload.
 };
 
-class UntrustedMemory {
-public:
-    std::map<std::pair<int, int>, std::vector<Element>> storage;
-    std::vector<std::string> access_log;
-
-    std::vector<Element> read_bucket(int level, int bucket_index);
-    void write_bucket(int level, int bucket_index, const std::vector<Element>& bucket);
-    std::vector<std::string> get_access_log();
-};
+typedef UntrustedBuckets<Element, SealedRecords<Element>> UntrustedMemory;
 
-class Enclave {
+// The butterfly; record I/O comes from RecordEnclave (see record_enclave.h).
+class Enclave : public RecordEnclave<Element> {
 public:
-    UntrustedMemory* untrusted;
     std::mt19937 rng;
+    // Which buckets each level merge-splits and where the halves go (see
+    // butterfly_topology.h).
+    TopologyKind topology = TopologyKind::InPlace;
 
     static constexpr int encryption_key = 0xdeadbeef;
 
     Enclave(UntrustedMemory* u);
-    static std::vector<Element> encryptBucket(const std::vector<Element>& bucket);
-    static std::vector<Element> decryptBucket(const std::vector<Element>& bucket);
 
     std::pair<int, int> computeBucketParameters(int n, int Z);
     void initializeBuckets(const std::vector<Element>& input_array, int B, int Z);
@@ -50,6 +45,12 @@ public:
         const std::vector<Element>& bucket1,
         const std::vector<Element>& bucket2,
         int level, int total_levels, int Z);
+    // merge_split on key bit `bit_index` instead of L-1-level. Keys are left
+    // intact, so later levels can route on them.
+    std::pair<std::vector<Element>, std::vector<Element>> merge_split_on_bit(
+        const std::vector<Element>& bucket1,
+        const std::vector<Element>& bucket2,
+        int bit_index, int Z);
     void obliviousPermuteBucket(std::vector<Element>& bucket);
 };
 
@@ -9,36 +9,62 @@
 // -------------------------
 // UntrustedMemory Methods
 // -------------------------
+void UntrustedMemory::allocate(int B, int Z) {
+    storage.reset(B, Z);
+}
+
 std::vector<Element> UntrustedMemory::read_bucket(int level, int bucket_index) {
-    std::pair<int, int> key = {level, bucket_index};
-    std::ostringstream oss;
-    oss << "Read bucket at level " << level << ", index " << bucket_index;
-    access_log.push_back(oss.str());
-    return storage[key];
+    trace.record(TRACE_READ, level, bucket_index, 0, storage.bucket_size());
+    const Element* slot = storage.read_slot(level, bucket_index);
+    bytes_copied += storage.bucket_size() * sizeof(Element);
+    return std::vector<Element>(slot, slot + storage.bucket_size());
 }
 
 void UntrustedMemory::write_bucket(int level, int bucket_index, const std::vector<Element>& bucket) {
-    std::pair<int, int> key = {level, bucket_index};
-    storage[key] = bucket;
-    std::ostringstream oss;
-    oss << "Write bucket at level " << level << ", index " << bucket_index;
-    access_log.push_back(oss.str());
+    trace.record(TRACE_WRITE, level, bucket_index, 0, storage.bucket_size());
+    if (bucket.size() != static_cast<size_t>(storage.bucket_size()))
+        throw std::invalid_argument("write_bucket: bucket size does not match the level arena.");
+    std::copy(bucket.begin(), bucket.end(), storage.write_slot(level, bucket_index));
+    bytes_copied += bucket.size() * sizeof(Element);
 }
 
 std::vector<std::string> UntrustedMemory::get_access_log() {
-    return access_log;
+    return trace.to_strings();
 }
 
 std::vector< std::vector<Element> > UntrustedMemory::read_level(int level) {
-    if (levels_storage.find(level) == levels_storage.end())
+    if (!storage.is_resident(level))
         return {};
-    // For simplicity, we do not log full-level accesses here.
-    return levels_storage[level];
+    std::vector< std::vector<Element> > buckets(storage.num_buckets());
+    for (int i = 0; i < storage.num_buckets(); i++) {
+        trace.record(TRACE_READ, level, i, 0, storage.bucket_size());
+        const Element* slot = storage.read_slot(level, i);
+        buckets[i].assign(slot, slot + storage.bucket_size());
+        bytes_copied += storage.bucket_size() * sizeof(Element);
+    }
+    return buckets;
 }
 
 void UntrustedMemory::write_level(int level, const std::vector< std::vector<Element> >& buckets) {
-    levels_storage[level] = buckets;
-    // Logging omitted for brevity.
+    if (buckets.size() != static_cast<size_t>(storage.num_buckets()))
+        throw std::invalid_argument("write_level: bucket count does not match the level arena.");
+    for (size_t i = 0; i < buckets.size(); i++) {
+        if (buckets[i].size() != static_cast<size_t>(storage.bucket_size()))
+            throw std::invalid_argument("write_level: bucket size does not match the level arena.");
+        trace.record(TRACE_WRITE, level, static_cast<int>(i), 0, storage.bucket_size());
+        std::copy(buckets[i].begin(), buckets[i].end(), storage.write_slot(level, i));
+        bytes_copied += buckets[i].size() * sizeof(Element);
+    }
+}
+
+BucketView<const Element> UntrustedMemory::view_bucket(int level, int bucket_index) const {
+    trace.record(TRACE_READ, level, bucket_index, 0, storage.bucket_size());
+    return storage.read_view(level, bucket_index);
+}
+
+BucketView<Element> UntrustedMemory::bucket_slot(int level, int bucket_index) {
+    trace.record(TRACE_WRITE, level, bucket_index, 0, storage.bucket_size());
+    return storage.write_view(level, bucket_index);
 }
 
 // -------------------------
@@ -50,24 +76,33 @@ Enclave::Enclave(UntrustedMemory *u) : untrusted(u) {
 }
 
 std::vector<Element> Enclave::encryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> encrypted = bucket;
-    for (auto &elem : encrypted) {
-        if (!elem.is_dummy) {
-            elem.value ^= encryption_key;
-            elem.key   ^= encryption_key;
-        }
-    }
+    std::vector<Element> encrypted(bucket.size());
+    encryptBucketInto(make_bucket_view(bucket), make_bucket_view(encrypted));
     return encrypted;
 }
 
-std::vector<Element> Enclave::decryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> decrypted = bucket;
-    for (auto &elem : decrypted) {
+// Encrypts a bucket directly into `out`, normally a slot handed out by UntrustedMemory::bucket_slot.
+void Enclave::encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out) {
+    if (bucket.size != out.size)
+        throw std::invalid_argument("encryptBucketInto: destination size does not match the bucket.");
+    for (int i = 0; i < bucket.size; i++) {
+        Element &elem = out[i];
+        elem = bucket[i];
         if (!elem.is_dummy) {
             elem.value ^= encryption_key;
             elem.key   ^= encryption_key;
         }
     }
+}
+
+std::vector<Element> Enclave::decryptBucket(const std::vector<Element>& bucket) {
+    return decryptBucket(make_bucket_view(bucket));
+}
+
+// Decrypts a bucket read through a view; XOR is symmetric so this reuses encryptBucketInto.
+std::vector<Element> Enclave::decryptBucket(BucketView<const Element> bucket) {
+    std::vector<Element> decrypted(bucket.size);
+    encryptBucketInto(bucket, make_bucket_view(decrypted));
     return decrypted;
 }
 
@@ -124,7 +159,7 @@ std::vector<int> Enclave::oblivious_sort(const std::vector<int>& input_array, in
     auto [B, L] = computeBucketParameters(n, Z);
 
     // Level 0 Initialization (Oblivious Random Bin Assignment)
-    std::vector< std::vector<Element> > level0(B);
+    untrusted->allocate(B, Z);
     std::vector<Element> elements;
     std::uniform_int_distribution<int> key_dist(0, B - 1);
     for (int x : input_array) {
@@ -140,34 +175,30 @@ std::vector<int> Enclave::oblivious_sort(const std::vector<int>& input_array, in
             bucket.assign(elements.begin() + start, elements.begin() + end);
         while (bucket.size() < static_cast<size_t>(Z))
             bucket.push_back(Element{0, 0, true});
-        level0[i] = encryptBucket(bucket);
+        encryptBucketInto(make_bucket_view(bucket), untrusted->bucket_slot(0, i));
     }
-    untrusted->write_level(0, level0);
 
-    // Merge-Split Phase
+    // Merge-Split Phase: buckets are decrypted out of, and encrypted into, the
+    // level arena through views instead of copying whole levels.
     for (int i = 0; i < L; i++) {
-        std::vector< std::vector<Element> > current_level = untrusted->read_level(i);
-        std::vector< std::vector<Element> > next_level(B);
         int block_size = 1 << (i + 1);
         for (int base = 0; base < B; base += block_size) {
             for (int k = 0; k < (1 << i); k++) {
                 int idx1 = base + k;
                 int idx2 = base + k + (1 << i);
-                std::vector<Element> bucket1 = decryptBucket(current_level[idx1]);
-                std::vector<Element> bucket2 = decryptBucket(current_level[idx2]);
+                std::vector<Element> bucket1 = decryptBucket(untrusted->view_bucket(i, idx1));
+                std::vector<Element> bucket2 = decryptBucket(untrusted->view_bucket(i, idx2));
                 auto [bucket0, bucket1_out] = merge_split(bucket1, bucket2, i, L, Z);
-                next_level[base + 2 * k]     = encryptBucket(bucket0);
-                next_level[base + 2 * k + 1] = encryptBucket(bucket1_out);
+                encryptBucketInto(make_bucket_view(bucket0), untrusted->bucket_slot(i + 1, base + 2 * k));
+                encryptBucketInto(make_bucket_view(bucket1_out), untrusted->bucket_slot(i + 1, base + 2 * k + 1));
             }
         }
-        untrusted->write_level(i + 1, next_level);
     }
 
     // Final Extraction and Sort
-    std::vector< std::vector<Element> > final_level = untrusted->read_level(L);
     std::vector<Element> final_elements;
     for (int i = 0; i < B; i++) {
-        std::vector<Element> bucket = decryptBucket(final_level[i]);
+        std::vector<Element> bucket = decryptBucket(untrusted->view_bucket(L, i));
         for (const auto &elem : bucket) {
             if (!elem.is_dummy)
                 final_elements.push_back(elem);
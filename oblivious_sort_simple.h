@@ -2,7 +2,6 @@
 #define OBLIVIOUS_SORT_H
 
 #include <vector>
-#include <map>
 #include <string>
 #include <sstream>
 #include <cmath>
@@ -11,6 +10,9 @@
 #include <algorithm>
 #include <utility>
 
+#include "level_arena.h"
+#include "access_trace.h"
+
 // Represents a data element for integers. For real elements, is_dummy is false.
 struct Element {
     int value;
@@ -21,11 +23,15 @@ struct Element {
 // UntrustedMemory simulates untrusted storage (outside the enclave) that holds encrypted buckets.
 class UntrustedMemory {
 public:
-    // Storage: keys are (level, bucket_index) and values are encrypted buckets.
-    std::map<std::pair<int, int>, std::vector<Element>> storage;
-    // Additional storage for entire levels.
-    std::map<int, std::vector< std::vector<Element> >> levels_storage;
-    std::vector<std::string> access_log;
+    // Storage: two preallocated B x Z slabs that alternate between even and odd levels.
+    // Both bucket and whole-level accesses go through the same arena.
+    LevelArena<Element> storage;
+    mutable AccessTrace trace; // Binary record of every bucket access (see access_trace.h).
+    // Bytes copied out of / into storage by the copying read/write functions.
+    size_t bytes_copied = 0;
+
+    // Preallocates the level arena for B buckets of Z elements.
+    void allocate(int B, int Z);
 
     // Read an encrypted bucket from untrusted memory.
     std::vector<Element> read_bucket(int level, int bucket_index);
@@ -39,6 +45,10 @@ public:
     // New methods: Read and write an entire level (array of buckets) from/to untrusted memory.
     std::vector< std::vector<Element> > read_level(int level);
     void write_level(int level, const std::vector< std::vector<Element> >& buckets);
+
+    // Zero-copy access: views into the level arena instead of copies.
+    BucketView<const Element> view_bucket(int level, int bucket_index) const;
+    BucketView<Element> bucket_slot(int level, int bucket_index);
 };
 
 // Enclave represents the trusted SGX enclave. It decrypts data from untrusted memory,
@@ -60,6 +70,11 @@ public:
     // Simulated decryption for integer buckets.
     static std::vector<Element> decryptBucket(const std::vector<Element>& bucket);
 
+    // View-based variants: decrypt straight out of untrusted storage and
+    // encrypt straight into a destination slot.
+    static std::vector<Element> decryptBucket(BucketView<const Element> bucket);
+    static void encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out);
+
     // Computes the bucket parameters (B: number of buckets, L: number of levels)
     // given the input size n and bucket capacity Z.
     std::pair<int, int> computeBucketParameters(int n, int Z);
@@ -1,31 +1,32 @@
 #include "oblivious_sort_string.h"
+#include "xor_keystream.h"
 #include <iostream>
 #include <algorithm>
 #include <random>
 #include <cstring>
 
-// Helper function to XOR encrypt/decrypt a string using the provided key.
-static std::string xor_encrypt_string(const std::string &s, int key) {
-    std::string result = s;
-    for (char &c : result) {
-        c = c ^ (key & 0xFF);
-    }
-    return result;
-}
-
-// ----- UntrustedMemory Methods -----
-std::vector<Element> UntrustedMemory::read_bucket(int level, int bucket_index) {
-    std::pair<int, int> key = { level, bucket_index };
-    return storage[key];
+// Payload keystream, keyed from encryption_key on first use (see xor_keystream.h).
+static const XorKeystream& payloadKeystream() {
+    static const XorKeystream keystream(static_cast<uint32_t>(Enclave::encryption_key));
+    return keystream;
 }
 
-void UntrustedMemory::write_bucket(int level, int bucket_index, const std::vector<Element>& bucket) {
-    std::pair<int, int> key = { level, bucket_index };
-    storage[key] = bucket;
+// XORs the values of the real elements of `block`, stored at `at`, as one
+// packed stream under the range's position nonce: the first starts at
+// offset 0, each next one where the previous one ended.
+static void applyPayloadStream(BucketView<Element> block, const BucketRange& at) {
+    XorKeystream::Nonce nonce = XorKeystream::position_nonce(at.level, at.bucket, at.offset);
+    uint64_t offset = 0;
+    for (auto& elem : block)
+        if (!elem.is_dummy) {
+            payloadKeystream().apply(elem.value, nonce, offset);
+            offset += elem.value.size();
+        }
 }
 
-std::vector<std::string> UntrustedMemory::get_access_log() {
-    return access_log;
+// Bytes held by an element, including its heap-allocated string.
+static size_t elementBytes(const Element& e) {
+    return sizeof(Element) + e.value.size();
 }
 
 // ----- Enclave Methods -----
@@ -35,25 +36,178 @@ Enclave::Enclave(UntrustedMemory* u) : untrusted(u) {
 }
 
 std::vector<Element> Enclave::encryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> encrypted = bucket;
-    for (auto& elem : encrypted) {
-        if (!elem.is_dummy) {
-            elem.value = xor_encrypt_string(elem.value, encryption_key);
+    std::vector<Element> encrypted(bucket.size());
+    encryptBucketInto(make_bucket_view(bucket), make_bucket_view(encrypted));
+    return encrypted;
+}
+
+// Encrypts a bucket directly into `out`, normally a slot handed out by UntrustedMemory::bucket_slot.
+void Enclave::encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out, const BucketRange& at) {
+    if (bucket.size != out.size)
+        throw std::invalid_argument("encryptBucketInto: destination size does not match the bucket.");
+    for (int i = 0; i < bucket.size; i++) {
+        Element& elem = out[i];
+        elem = bucket[i];
+        if (!elem.is_dummy)
             elem.key ^= encryption_key;
-        }
     }
-    return encrypted;
+    applyPayloadStream(out, at);
 }
 
 std::vector<Element> Enclave::decryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> decrypted = bucket;
-    for (auto& elem : decrypted) {
-        if (!elem.is_dummy) {
-            elem.value = xor_encrypt_string(elem.value, encryption_key);
+    return decryptBucket(make_bucket_view(bucket));
+}
+
+// Decrypts a bucket read through a view without copying the ciphertext first.
+std::vector<Element> Enclave::decryptBucket(BucketView<const Element> bucket, const BucketRange& at) {
+    std::vector<Element> decrypted(bucket.size);
+    // XOR is symmetric, so decryption reuses the encryption path.
+    encryptBucketInto(bucket, make_bucket_view(decrypted), at);
+    return decrypted;
+}
+
+void Enclave::encryptBucketInPlace(BucketView<Element> bucket, const BucketRange& at) {
+    for (auto& elem : bucket)
+        if (!elem.is_dummy)
             elem.key ^= encryption_key;
+    applyPayloadStream(bucket, at);
+}
+
+void Enclave::decryptBucketInPlace(BucketView<Element> bucket, const BucketRange& at) {
+    encryptBucketInPlace(bucket, at);
+}
+
+// Bytes of a block as it crosses the enclave boundary.
+static size_t blockBytes(BucketView<const Element> block) {
+    size_t bytes = 0;
+    for (const auto& e : block)
+        bytes += elementBytes(e);
+    return bytes;
+}
+
+std::vector<std::vector<Element>> Enclave::loadBuckets(const std::vector<BucketRange>& ranges) {
+    std::vector<std::vector<Element>> blocks;
+    blocks.reserve(ranges.size());
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted = untrusted->read_buckets(batch);
+            for (size_t k = 0; k < batch.size(); k++) {
+                if (cost)
+                    crossed += blockBytes(make_bucket_view(encrypted[k]));
+                blocks.push_back(decryptBucket(make_bucket_view(encrypted[k]), batch[k]));
+            }
+        } else {
+            std::vector<BucketView<const Element>> views = untrusted->view_buckets(batch);
+            for (size_t k = 0; k < batch.size(); k++) {
+                if (cost)
+                    crossed += blockBytes(views[k]);
+                blocks.push_back(decryptBucket(views[k], batch[k]));
+            }
         }
+        first = last;
     }
-    return decrypted;
+    if (cost)
+        cost->on_load(crossed);
+    return blocks;
+}
+
+void Enclave::storeBuckets(const std::vector<BucketRange>& ranges, const std::vector<BucketView<const Element>>& blocks) {
+    if (blocks.size() != ranges.size())
+        throw std::invalid_argument("storeBuckets: need one block per range.");
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted;
+            encrypted.reserve(batch.size());
+            for (size_t k = first; k < last; k++) {
+                encrypted.emplace_back(blocks[k].size);
+                encryptBucketInto(blocks[k], make_bucket_view(encrypted.back()), ranges[k]);
+                if (cost)
+                    crossed += blockBytes(make_bucket_view(encrypted.back()));
+            }
+            untrusted->write_buckets(batch, encrypted);
+        } else {
+            std::vector<BucketView<Element>> slots = untrusted->bucket_slots(batch);
+            for (size_t k = first; k < last; k++) {
+                encryptBucketInto(blocks[k], slots[k - first], ranges[k]);
+                if (cost)
+                    crossed += blockBytes(slots[k - first]);
+            }
+        }
+        first = last;
+    }
+    if (cost)
+        cost->on_store(crossed);
+}
+
+void Enclave::loadBucketsInto(const std::vector<BucketRange>& ranges, const std::vector<BucketView<Element>>& blocks) {
+    if (blocks.size() != ranges.size())
+        throw std::invalid_argument("loadBucketsInto: need one block per range.");
+    for (size_t k = 0; k < ranges.size(); k++)
+        if (blocks[k].size != ranges[k].length)
+            throw std::invalid_argument("loadBucketsInto: block size does not match the range.");
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted = untrusted->read_buckets(batch);
+            for (size_t k = first; k < last; k++) {
+                if (cost)
+                    crossed += blockBytes(make_bucket_view(encrypted[k - first]));
+                std::move(encrypted[k - first].begin(), encrypted[k - first].end(), blocks[k].begin());
+            }
+        } else {
+            std::vector<BucketView<const Element>> views = untrusted->view_buckets(batch);
+            for (size_t k = first; k < last; k++) {
+                if (cost)
+                    crossed += blockBytes(views[k - first]);
+                std::copy(views[k - first].begin(), views[k - first].end(), blocks[k].begin());
+            }
+        }
+        for (size_t k = first; k < last; k++)
+            decryptBucketInPlace(blocks[k], ranges[k]);
+        first = last;
+    }
+    if (cost)
+        cost->on_load(crossed);
+}
+
+void Enclave::storeBucketsFrom(const std::vector<BucketRange>& ranges, const std::vector<BucketView<Element>>& blocks) {
+    if (blocks.size() != ranges.size())
+        throw std::invalid_argument("storeBucketsFrom: need one block per range.");
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        for (size_t k = first; k < last; k++) {
+            encryptBucketInPlace(blocks[k], ranges[k]);
+            if (cost)
+                crossed += blockBytes(blocks[k]);
+        }
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted;
+            encrypted.reserve(batch.size());
+            for (size_t k = first; k < last; k++)
+                encrypted.emplace_back(blocks[k].begin(), blocks[k].end());
+            untrusted->write_buckets(batch, encrypted);
+        } else {
+            std::vector<BucketView<Element>> slots = untrusted->bucket_slots(batch);
+            for (size_t k = first; k < last; k++) {
+                if (slots[k - first].size != blocks[k].size)
+                    throw std::invalid_argument("storeBucketsFrom: block size does not match the slot.");
+                std::swap_ranges(blocks[k].begin(), blocks[k].end(), slots[k - first].begin());
+            }
+        }
+        first = last;
+    }
+    if (cost)
+        cost->on_store(crossed);
 }
 
 std::pair<int, int> Enclave::computeBucketParameters(int n, int Z) {
@@ -69,6 +223,7 @@ std::pair<int, int> Enclave::computeBucketParameters(int n, int Z) {
 
 void Enclave::initializeBuckets(const std::vector<std::string>& input_array, int B, int Z) {
     int n = input_array.size();
+    untrusted->allocate(B, Z);
     std::vector<Element> elements;
     std::uniform_int_distribution<int> key_dist(0, B - 1);
     for (const std::string &s : input_array) {
@@ -85,12 +240,15 @@ void Enclave::initializeBuckets(const std::vector<std::string>& input_array, int
         else
             groups[i] = std::vector<Element>(); // Empty group.
     }
+    std::vector<BucketRange> ranges;
     for (int i = 0; i < B; i++) {
-        std::vector<Element> bucket = groups[i];
-        while (bucket.size() < static_cast<size_t>(Z))
-            bucket.push_back(Element{ "", 0, true });
-        untrusted->write_bucket(0, i, encryptBucket(bucket));
+        // Pad with dummy elements until bucket reaches size Z.
+        while (groups[i].size() < static_cast<size_t>(Z))
+            groups[i].push_back(Element{ "", 0, true });
+        ranges.push_back(BucketRange{ 0, i, 0, Z });
     }
+    // Level 0 goes out in batches of transition_budget buckets.
+    storeBuckets(ranges, make_bucket_views(groups));
 }
 
 void Enclave::bitonicMerge(std::vector<Element>& a, int low, int cnt, bool ascending) {
@@ -121,12 +279,23 @@ std::pair<std::vector<Element>, std::vector<Element>> Enclave::merge_split_biton
     const std::vector<Element>& bucket2,
     int level, int total_levels, int Z) {
 
-    int L = total_levels;
-    int bit_index = L - 1 - level;
-
     // Combine the two buckets into one vector (size 2Z).
     std::vector<Element> combined = bucket1;
     combined.insert(combined.end(), bucket2.begin(), bucket2.end());
+    merge_split_in_place(combined, total_levels - 1 - level, total_levels, Z);
+
+    // After sorting, the first Z elements belong to output bucket 0, and the next Z to output bucket 1.
+    std::vector<Element> out_bucket0(combined.begin(), combined.begin() + Z);
+    std::vector<Element> out_bucket1(combined.begin() + Z, combined.end());
+
+    return { out_bucket0, out_bucket1 };
+}
+
+void Enclave::merge_split_in_place(std::vector<Element>& combined, int key_bit, int total_levels, int Z) {
+    int L = total_levels;
+    int bit_index = key_bit;
+    if (bit_index < 0 || bit_index >= std::max(L, 1) || L + 2 > 30)
+        throw std::invalid_argument("merge_split: key bit out of range.");
 
     // Count the number of real elements assigned to each target bucket.
     int count0 = 0, count1 = 0;
@@ -146,43 +315,58 @@ std::pair<std::vector<Element>, std::vector<Element>> Enclave::merge_split_biton
     int needed_dummies1 = Z - count1;
     int assigned_dummies0 = 0, assigned_dummies1 = 0;
 
+    // The tag goes above the key bits, so the key survives for later levels.
+    int key_mask = (1 << L) - 1;
     for (auto& elem : combined) {
+        int tag;
         if (elem.is_dummy) {
             if (assigned_dummies0 < needed_dummies0) {
-                elem.key = 1; // Tagged for bucket 0 dummy.
+                tag = 1; // Tagged for bucket 0 dummy.
                 assigned_dummies0++;
             }
             else {
-                elem.key = 3; // Tagged for bucket 1 dummy.
+                tag = 3; // Tagged for bucket 1 dummy.
                 assigned_dummies1++;
             }
         }
         else {
             int bit_val = (elem.key >> bit_index) & 1;
-            elem.key = (bit_val << 1); // 0 for bucket 0, 2 for bucket 1.
+            tag = (bit_val << 1); // 0 for bucket 0, 2 for bucket 1.
         }
+        elem.key = (tag << L) | (elem.key & key_mask);
     }
 
     // Perform bitonic sort on the combined vector using the composite keys.
     bitonicSort(combined, 0, combined.size(), true);
-
-    // After sorting, the first Z elements belong to output bucket 0, and the next Z to output bucket 1.
-    std::vector<Element> out_bucket0(combined.begin(), combined.begin() + Z);
-    std::vector<Element> out_bucket1(combined.begin() + Z, combined.end());
-
-    return { out_bucket0, out_bucket1 };
+    for (auto& elem : combined)
+        elem.key &= key_mask;
 }
 
 void Enclave::performButterflyNetwork(int B, int L, int Z) {
+    // Each batch loads whole bucket pairs in one call, merge-splits them and
+    // stores the results in one more call. A pair is loaded back to back into
+    // its work buffer, split there and stored from there; the buffers are
+    // reused by every batch of every level. The pairs and the key bit of each
+    // level come from the topology (see butterfly_topology.h).
+    ButterflyTopology topo(topology, L);
+    int pairs_per_batch = units_per_batch(transition_budget, 2, B / 2);
+    std::vector<std::vector<Element>> work(pairs_per_batch, std::vector<Element>(2 * Z));
     for (int level = 0; level < L; level++) {
-        for (int i = 0; i < B; i += 2) {
-            std::vector<Element> bucket1_enc = untrusted->read_bucket(level, i);
-            std::vector<Element> bucket2_enc = untrusted->read_bucket(level, i + 1);
-            std::vector<Element> bucket1 = decryptBucket(bucket1_enc);
-            std::vector<Element> bucket2 = decryptBucket(bucket2_enc);
-            auto [out_bucket0, out_bucket1] = merge_split_bitonic(bucket1, bucket2, level, L, Z);
-            untrusted->write_bucket(level + 1, i, encryptBucket(out_bucket0));
-            untrusted->write_bucket(level + 1, i + 1, encryptBucket(out_bucket1));
+        std::vector<ButterflyNode> nodes = topo.pairs(level);
+        for (size_t first = 0; first < nodes.size(); first += pairs_per_batch) {
+            size_t last = std::min(nodes.size(), first + pairs_per_batch);
+            std::vector<BucketRange> in, out;
+            std::vector<BucketView<Element>> blocks;
+            for (size_t k = first; k < last; k++)
+                for (int j = 0; j < 2; j++) {
+                    in.push_back(BucketRange{ level, nodes[k].in[j], 0, Z });
+                    out.push_back(BucketRange{ level + 1, nodes[k].out[j], 0, Z });
+                    blocks.push_back(make_bucket_view(work[k - first]).subview(j * Z, Z));
+                }
+            loadBucketsInto(in, blocks);
+            for (size_t p = 0; p < last - first; p++)
+                merge_split_in_place(work[p], topo.key_bit(level), L, Z);
+            storeBucketsFrom(out, blocks);
         }
     }
 }
@@ -199,14 +383,25 @@ void Enclave::obliviousPermuteBucket(std::vector<Element>& bucket) {
 
 std::vector<Element> Enclave::extractFinalElements(int B, int L) {
     std::vector<Element> final_elements;
-    for (int i = 0; i < B; i++) {
-        std::vector<Element> bucket_enc = untrusted->read_bucket(L, i);
-        std::vector<Element> bucket = decryptBucket(bucket_enc);
-        // Instead of using a non-oblivious shuffle, perform an oblivious permutation.
-        obliviousPermuteBucket(bucket);
-        for (const auto& elem : bucket)
-            if (!elem.is_dummy)
-                final_elements.push_back(elem);
+    int Z = untrusted->bucket_size();
+    int per_batch = units_per_batch(transition_budget, 1, B);
+    std::vector<std::vector<Element>> work(per_batch, std::vector<Element>(Z));
+    for (int first = 0; first < B; first += per_batch) {
+        std::vector<BucketRange> ranges;
+        std::vector<BucketView<Element>> blocks;
+        for (int i = first; i < std::min(B, first + per_batch); i++) {
+            ranges.push_back(BucketRange{ L, i, 0, Z });
+            blocks.push_back(make_bucket_view(work[i - first]));
+        }
+        loadBucketsInto(ranges, blocks);
+        for (size_t k = 0; k < ranges.size(); k++) {
+            std::vector<Element>& bucket = work[k];
+            // Instead of using a non-oblivious shuffle, perform an oblivious permutation.
+            obliviousPermuteBucket(bucket);
+            for (const auto& elem : bucket)
+                if (!elem.is_dummy)
+                    final_elements.push_back(elem);
+        }
     }
     return final_elements;
 }
@@ -227,8 +422,24 @@ std::vector<std::string> Enclave::oblivious_sort(const std::vector<std::string>&
     int n = input_array.size();
     int Z = bucket_size;
     auto [B, L] = computeBucketParameters(n, Z);
-    initializeBuckets(input_array, B, Z);
-    performButterflyNetwork(B, L, Z);
-    std::vector<Element> final_elements = extractFinalElements(B, L);
+    // Input and output both stay resident in the enclave.
+    size_t data_bytes = 0;
+    if (cost)
+        for (const std::string& s : input_array)
+            data_bytes += sizeof(Element) + s.size();
+    {
+        CostPhase phase(cost, "initialize", untrusted->transitions, data_bytes);
+        initializeBuckets(input_array, B, Z);
+    }
+    {
+        CostPhase phase(cost, "butterfly", untrusted->transitions);
+        performButterflyNetwork(B, L, Z);
+    }
+    std::vector<Element> final_elements;
+    {
+        CostPhase phase(cost, "extract", untrusted->transitions, data_bytes);
+        final_elements = extractFinalElements(B, L);
+    }
+    CostPhase phase(cost, "final sort", untrusted->transitions, 2 * data_bytes);
     return finalSort(final_elements);
 }
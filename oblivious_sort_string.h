@@ -2,8 +2,8 @@
 #define OBLIVIOUS_SORT_H
 
 #include <vector>
-#include <map>
 #include <string>
+#include <cstring>
 #include <sstream>
 #include <cmath>
 #include <random>
@@ -11,6 +11,10 @@
 #include <algorithm>
 #include <utility>
 
+#include "untrusted_memory.h"
+#include "enclave_cost.h"
+#include "butterfly_topology.h"
+
 // Represents a data element. For real elements, is_dummy is false.
 struct Element {
     std::string value;  // Changed from int to std::string.
@@ -18,35 +22,59 @@ struct Element {
     bool is_dummy;
 };
 
-// UntrustedMemory simulates untrusted storage (outside the enclave) that holds encrypted buckets.
-class UntrustedMemory {
-public:
-    // Storage: keys are (level, bucket_index) and values are encrypted buckets.
-    std::map<std::pair<int, int>, std::vector<Element>> storage;
-    std::vector<std::string> access_log;
-
-    // Read an encrypted bucket from untrusted memory.
-    std::vector<Element> read_bucket(int level, int bucket_index);
-
-    // Write an encrypted bucket to untrusted memory.
-    void write_bucket(int level, int bucket_index, const std::vector<Element>& bucket);
-
-    // Retrieve the access log.
-    std::vector<std::string> get_access_log();
+// Storage backend records: the (encrypted) key, the dummy flag and the value bytes.
+struct StringRecords {
+    static const size_t kHeaderBytes = sizeof(int) + sizeof(char);
+
+    // Record bytes for values of up to max_value bytes.
+    static size_t size(size_t max_value) { return kHeaderBytes + max_value; }
+    // Bytes held by an element, including its heap-allocated string.
+    static size_t bytes(const Element& e) { return sizeof(Element) + e.value.size(); }
+    static std::string encode(const Element& e) {
+        std::string out;
+        out.reserve(kHeaderBytes + e.value.size());
+        out.append(reinterpret_cast<const char*>(&e.key), sizeof(e.key));
+        char flag = e.is_dummy ? 1 : 0;
+        out.append(&flag, sizeof(flag));
+        out.append(e.value);
+        return out;
+    }
+    static Element decode(const std::string& record) {
+        if (record.size() < kHeaderBytes)
+            throw std::runtime_error("decodeRecord: truncated record.");
+        Element e;
+        std::memcpy(&e.key, record.data(), sizeof(e.key));
+        e.is_dummy = record[sizeof(int)] != 0;
+        e.value = record.substr(kHeaderBytes);
+        return e;
+    }
 };
 
+typedef UntrustedBuckets<Element, StringRecords> UntrustedMemory;
+
 // Enclave represents the trusted SGX enclave. It decrypts data from untrusted memory,
 // performs the oblivious sort operations, and reencrypts data when writing back.
 class Enclave {
 public:
     UntrustedMemory* untrusted;
     std::mt19937 rng; // Random number generator.
+    // Most bucket ranges per call into untrusted memory (<= 0: no limit). Bigger
+    // batches mean fewer transitions but more buckets held in the enclave.
+    int transition_budget = 16;
+    // Which buckets each level merge-splits and where the halves go (see
+    // butterfly_topology.h).
+    TopologyKind topology = TopologyKind::InPlace;
+    // Optional boundary cost accounting per phase (see enclave_cost.h).
+    EnclaveCostSimulator* cost = nullptr;
 
     // A fixed key for our simulated encryption.
     static constexpr int encryption_key = 0xdeadbeef;
 
     // Constructor: initializes the enclave with a pointer to untrusted memory.
     Enclave(UntrustedMemory* u);
+    // Bytes of a backend record for payloads of up to max_payload bytes
+    // (see UntrustedMemory::use_backend).
+    static size_t recordBytes(size_t max_payload) { return StringRecords::size(max_payload); }
 
     // Simulated encryption: XOR each field with encryption_key.
     static std::vector<Element> encryptBucket(const std::vector<Element>& bucket);
@@ -54,6 +82,27 @@ public:
     // Simulated decryption.
     static std::vector<Element> decryptBucket(const std::vector<Element>& bucket);
 
+    // View-based variants: decrypt straight out of untrusted storage and
+    // encrypt straight into a destination slot.
+    // `at` is where the bucket is stored; it picks the payload keystream offset.
+    static std::vector<Element> decryptBucket(BucketView<const Element> bucket, const BucketRange& at = BucketRange());
+    static void encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out,
+                                  const BucketRange& at = BucketRange());
+    // In-place variants: transform a bucket where it sits, with no new vector.
+    static void encryptBucketInPlace(BucketView<Element> bucket, const BucketRange& at = BucketRange());
+    static void decryptBucketInPlace(BucketView<Element> bucket, const BucketRange& at = BucketRange());
+    // Decrypt ranges from / encrypt ranges into untrusted memory (through views
+    // when storage is in memory, through the backend otherwise), in calls of at
+    // most transition_budget ranges each.
+    std::vector<std::vector<Element>> loadBuckets(const std::vector<BucketRange>& ranges);
+    void storeBuckets(const std::vector<BucketRange>& ranges, const std::vector<BucketView<const Element>>& blocks);
+    // The same into / out of caller-owned blocks: each range is
+    // copied into its block (reusing the value strings) and decrypted there;
+    // each stored block is encrypted in place and swapped into its slot,
+    // leaving the block with the slot's old storage to reuse.
+    void loadBucketsInto(const std::vector<BucketRange>& ranges, const std::vector<BucketView<Element>>& blocks);
+    void storeBucketsFrom(const std::vector<BucketRange>& ranges, const std::vector<BucketView<Element>>& blocks);
+
     // Computes the bucket parameters (B: number of buckets, L: number of levels)
     // given the input size n and bucket capacity Z.
     std::pair<int, int> computeBucketParameters(int n, int Z);
@@ -83,6 +132,10 @@ public:
         const std::vector<Element>& bucket1,
         const std::vector<Element>& bucket2,
         int level, int total_levels, int Z);
+    // The same split on key bit `key_bit`, on a pair that sits back to back
+    // in one 2Z buffer; the first Z elements end up as bucket 0, the last Z as
+    // bucket 1. Keys are left intact for later levels.
+    void merge_split_in_place(std::vector<Element>& pair, int key_bit, int total_levels, int Z);
 
     // NEW: Oblivious permutation for a bucket using constant local storage.
     // It assigns a random label to each element and then obliviously sorts the bucket.
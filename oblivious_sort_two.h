@@ -2,7 +2,6 @@
 #define OBLIVIOUS_SORT_TWO_H
 
 #include <vector>
-#include <map>
 #include <string>
 #include <sstream>
 #include <cmath>
@@ -10,6 +9,18 @@
 #include <stdexcept>
 #include <algorithm>
 #include <utility>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <iterator>
+#include <cstring>
+#include <cstdint>
+
+#include "record_enclave.h"
+#include "cipher_policy.h"
+#include "butterfly_topology.h"
+#include "io_thread.h"
+#include "dataflow.h"
 
 // Represents a data element with a numeric sorting column and a variable-length payload.
 struct Element {
@@ -19,30 +30,58 @@ struct Element {
     std::string payload; // Variable-length payload.
 };
 
-class UntrustedMemory {
-public:
-    std::map<std::pair<int, int>, std::vector<Element>> storage;
-    std::vector<std::string> access_log;
+typedef UntrustedBuckets<Element, SealedRecords<Element>> UntrustedMemory;
 
-    std::vector<Element> read_bucket(int level, int bucket_index);
-    void write_bucket(int level, int bucket_index, const std::vector<Element>& bucket);
-    std::vector<std::string> get_access_log();
-};
+// The butterfly; record I/O comes from RecordEnclave (see record_enclave.h)
+// under the cipher policy Cipher (see cipher_policy.h). bucket_sort_two runs
+// Enclave<AesCtrPolicy> and bucket_sort_xortwo Enclave<XorPolicy>.
+template <typename Cipher>
+class Enclave : public RecordEnclave<Element, Cipher> {
+    typedef RecordEnclave<Element, Cipher> RecordIO;
 
-class Enclave {
 public:
-    UntrustedMemory* untrusted;
+    using RecordIO::untrusted;
+    using RecordIO::transition_budget;
+    using RecordIO::crypto_threads;
+    using RecordIO::cost;
+    using RecordIO::loadBuckets;
+    using RecordIO::storeBuckets;
+
     std::mt19937 rng;
+    // Run the butterfly with untrusted-memory I/O on a background thread
+    // (see performButterflyNetworkPipelined).
+    bool pipelined_io = false;
+    // Threads, the caller included, that merge-split the pairs of a batch and
+    // permute the final buckets in parallel. They come from one ThreadPool
+    // that is kept across levels and also runs the crypto_threads work. Given
+    // the same seed, the output is bit-identical for every count.
+    int merge_threads = 1;
+    // Run the butterfly as a dataflow graph on merge_threads workers (see
+    // performButterflyNetworkDataflow): no barrier between levels.
+    bool dataflow = false;
+    // Butterfly levels per pass over untrusted memory (see
+    // performButterflyNetwork): 1 is one pass per level, 0 takes as many as
+    // keep a group of 2^levels buckets within block_cache_bytes.
+    int block_levels = 1;
+    size_t block_cache_bytes = 1 << 20;
+    // Key bits routed per merge-split: with k > 1 every node merge-splits
+    // 2^k buckets on k bits at once (merge_split_kary), so the butterfly has
+    // L / k node levels, each with a sort of 2^k * Z elements.
+    int arity_bits = 1;
+    // Which buckets each level merge-splits and where the halves go (see
+    // butterfly_topology.h). Blocking and k-ary nodes need the in-place form.
+    TopologyKind topology = TopologyKind::InPlace;
 
     static constexpr int encryption_key = 0xdeadbeef;
 
     Enclave(UntrustedMemory* u);
-    static std::vector<Element> encryptBucket(const std::vector<Element>& bucket);
-    static std::vector<Element> decryptBucket(const std::vector<Element>& bucket);
-
+    // Fixed seed for the random keys and the final permutations.
+    Enclave(UntrustedMemory* u, uint32_t seed);
     std::pair<int, int> computeBucketParameters(int n, int Z);
     void initializeBuckets(const std::vector<Element>& input_array, int B, int Z);
     void performButterflyNetwork(int B, int L, int Z);
+    void performButterflyNetworkPipelined(int B, int L, int Z);
+    void performButterflyNetworkDataflow(int B, int L, int Z);
     std::vector<Element> extractFinalElements(int B, int L);
     std::vector<Element> finalSort(const std::vector<Element>& final_elements);
     std::vector<Element> oblivious_sort(const std::vector<Element>& input_array, int bucket_size);
@@ -53,7 +92,513 @@ public:
         const std::vector<Element>& bucket1,
         const std::vector<Element>& bucket2,
         int level, int total_levels, int Z);
-    void obliviousPermuteBucket(std::vector<Element>& bucket);
+    // merge_split_bitonic on key bit `key_bit` instead of L-1-level. Keys are
+    // left intact (merge_split_bitonic too), so later levels can route on them.
+    std::pair<std::vector<Element>, std::vector<Element>> merge_split_on_bit(
+        const std::vector<Element>& bucket1,
+        const std::vector<Element>& bucket2,
+        int key_bit, int total_levels, int Z);
+    // Takes buckets[first, first + width) (width = 2^levels, one in-place
+    // block node in order, see ButterflyTopology::block) through `levels`
+    // butterfly levels from `level` on, without leaving the enclave.
+    void merge_split_group(std::vector<std::vector<Element>>& buckets, size_t first, int width, int level,
+                           int levels, int total_levels, int Z);
+    // Routes the 2^bits buckets buckets[first + j * stride] on key bits
+    // key_shift .. key_shift + bits - 1: the j-th gets the real elements whose
+    // bits read j, topped up with dummies to Z. Keys are left intact.
+    void merge_split_kary(std::vector<std::vector<Element>>& buckets, size_t first, size_t stride, int bits,
+                          int key_shift, int total_levels, int Z);
+    void obliviousPermuteBucket(std::vector<Element>& bucket, std::mt19937& bucket_rng);
+
+private:
+    using RecordIO::beginRun;
+    using RecordIO::threadPool;
+    using RecordIO::recordWidth;
+    using RecordIO::blockBytes;
+
+    // block_levels, with 0 resolved for the current record width.
+    int blockLevels(int Z, int L) const;
+    // The nodes of the butterfly, stage by stage: per level, or per block of
+    // blockLevels() levels with the in-place topology.
+    std::vector<std::vector<ButterflyNode>> butterflySchedule(int L, int Z) const;
+    // Merge-splits one node whose buckets sit at buckets[first ..] in node order.
+    void mergeNode(const ButterflyNode& node, std::vector<std::vector<Element>>& buckets, size_t first, int L, int Z);
+    // The pool runs merge_threads and crypto_threads work.
+    int poolThreads() const { return std::max(merge_threads, crypto_threads); }
 };
 
+template <typename Cipher>
+Enclave<Cipher>::Enclave(UntrustedMemory* u) : RecordIO(u) {
+    std::random_device rd;
+    rng.seed(rd());
+}
+
+template <typename Cipher>
+Enclave<Cipher>::Enclave(UntrustedMemory* u, uint32_t seed) : RecordIO(u), rng(seed) {}
+
+template <typename Cipher>
+std::pair<int,int> Enclave<Cipher>::computeBucketParameters(int n, int Z) {
+    int minimalB = static_cast<int>(std::ceil((2.0 * n) / Z));
+    int safety_factor = 1; // Increase safety
+    int B_required = minimalB * safety_factor;
+    int B = 1;
+    while (B < B_required)
+        B *= 2;
+    int L = static_cast<int>(std::log2(B));
+    if (n > B * (Z / 2))
+        throw std::invalid_argument("Bucket size too small for input size.");
+    return {B, L};
+}
+
+template <typename Cipher>
+void Enclave<Cipher>::initializeBuckets(const std::vector<Element>& input_array, int B, int Z) {
+    int n = input_array.size();
+    beginRun(input_array);
+    untrusted->allocate(B, Z);
+    std::vector<Element> elements;
+    std::uniform_int_distribution<int> key_dist(0, B - 1);
+    for (const Element &elem : input_array) {
+        int random_key = key_dist(rng);
+        // Use the sorting and payload from the input.
+        elements.push_back(Element{ elem.sorting, random_key, false, elem.payload });
+    }
+    int group_size = (n + B - 1) / B;
+    std::vector<std::vector<Element>> groups(B);
+    for (int i = 0; i < B; i++) {
+        int start = i * group_size;
+        int end = std::min(start + group_size, n);
+        if (start < n)
+            groups[i] = std::vector<Element>(elements.begin() + start, elements.begin() + end);
+        else
+            groups[i] = std::vector<Element>(); // Empty group.
+    }
+    std::vector<BucketRange> ranges;
+    for (int i = 0; i < B; i++) {
+        // Pad with dummy elements until bucket reaches size Z.
+        while (groups[i].size() < static_cast<size_t>(Z))
+            groups[i].push_back(Element{ 0, 0, true, "" });
+        ranges.push_back(BucketRange{ 0, i, 0, Z });
+    }
+    // Level 0 goes out in batches of transition_budget buckets.
+    storeBuckets(ranges, make_bucket_views(groups));
+}
+
+template <typename Cipher>
+void Enclave<Cipher>::bitonicMerge(std::vector<Element>& a, int low, int cnt, bool ascending) {
+    if (cnt > 1) {
+        int k = cnt / 2;
+        for (int i = low; i < low + k; i++) {
+            if ((ascending && a[i].key > a[i + k].key) ||
+                (!ascending && a[i].key < a[i + k].key)) {
+                std::swap(a[i], a[i + k]);
+            }
+        }
+        bitonicMerge(a, low, k, ascending);
+        bitonicMerge(a, low + k, k, ascending);
+    }
+}
+
+template <typename Cipher>
+void Enclave<Cipher>::bitonicSort(std::vector<Element>& a, int low, int cnt, bool ascending) {
+    if (cnt > 1) {
+        int k = cnt / 2;
+        bitonicSort(a, low, k, true);
+        bitonicSort(a, low + k, k, false);
+        bitonicMerge(a, low, cnt, ascending);
+    }
+}
+
+template <typename Cipher>
+std::pair<std::vector<Element>, std::vector<Element>> Enclave<Cipher>::merge_split_bitonic(
+    const std::vector<Element>& bucket1,
+    const std::vector<Element>& bucket2,
+    int level, int total_levels, int Z) {
+    return merge_split_on_bit(bucket1, bucket2, total_levels - 1 - level, total_levels, Z);
+}
+
+template <typename Cipher>
+std::pair<std::vector<Element>, std::vector<Element>> Enclave<Cipher>::merge_split_on_bit(
+    const std::vector<Element>& bucket1,
+    const std::vector<Element>& bucket2,
+    int key_bit, int total_levels, int Z) {
+
+    int L = total_levels;
+    int bit_index = key_bit;
+    if (bit_index < 0 || bit_index >= std::max(L, 1) || L + 2 > 30)
+        throw std::invalid_argument("merge_split: key bit out of range.");
+
+    // Combine the two buckets into one vector (size 2Z).
+    std::vector<Element> combined = bucket1;
+    combined.insert(combined.end(), bucket2.begin(), bucket2.end());
+
+    // Count the number of real elements assigned to each target bucket.
+    int count0 = 0, count1 = 0;
+    for (const auto& elem : combined) {
+        if (!elem.is_dummy) {
+            if (((elem.key >> bit_index) & 1) == 0)
+                count0++;
+            else
+                count1++;
+        }
+    }
+    if (count0 > Z || count1 > Z)
+        throw std::overflow_error("Bucket overflow occurred in merge_split.");
+
+    int needed_dummies0 = Z - count0;
+    int assigned_dummies0 = 0;
+
+    // The tag goes above the key bits, so the key survives for later levels.
+    int key_mask = (1 << L) - 1;
+    for (auto& elem : combined) {
+        int tag;
+        if (elem.is_dummy) {
+            if (assigned_dummies0 < needed_dummies0) {
+                tag = 1; // Tag for bucket 0 dummy.
+                assigned_dummies0++;
+            }
+            else {
+                tag = 3; // Tag for bucket 1 dummy.
+            }
+        }
+        else {
+            int bit_val = (elem.key >> bit_index) & 1;
+            tag = (bit_val << 1); // 0 for bucket 0, 2 for bucket 1.
+        }
+        elem.key = (tag << L) | (elem.key & key_mask);
+    }
+
+    // Perform bitonic sort on the combined vector using the composite keys.
+    bitonicSort(combined, 0, combined.size(), true);
+    for (auto& elem : combined)
+        elem.key &= key_mask;
+
+    // After sorting, the first Z elements belong to bucket 0, the next Z to bucket 1.
+    std::vector<Element> out_bucket0(combined.begin(), combined.begin() + Z);
+    std::vector<Element> out_bucket1(combined.begin() + Z, combined.end());
+
+    return { out_bucket0, out_bucket1 };
+}
+
+template <typename Cipher>
+int Enclave<Cipher>::blockLevels(int Z, int L) const {
+    // A block holds at least one node of 2^arity_bits buckets.
+    if (block_levels > 0)
+        return std::min(std::max(block_levels, arity_bits), std::max(L, 1));
+    // A decrypted element holds its fields and a payload of the record width.
+    size_t bucket_bytes = static_cast<size_t>(Z) * (sizeof(Element) + recordWidth());
+    int k = 1;
+    while (k < L && (bucket_bytes << (k + 1)) <= block_cache_bytes)
+        k++;
+    return std::min(std::max(k, arity_bits), std::max(L, 1));
+}
+
+template <typename Cipher>
+std::vector<std::vector<ButterflyNode>> Enclave<Cipher>::butterflySchedule(int L, int Z) const {
+    ButterflyTopology topo(topology, L);
+    if (!topo.in_place() && arity_bits > 1)
+        throw std::invalid_argument("Butterfly: k-ary nodes need the in-place topology.");
+    // Only the in-place form can be blocked; the others go one level per stage.
+    int k = topo.in_place() ? blockLevels(Z, L) : 1;
+    std::vector<std::vector<ButterflyNode>> stages;
+    for (int level = 0; level < L; level += k)
+        stages.push_back(topo.in_place() ? topo.block(level, std::min(k, L - level)) : topo.pairs(level));
+    return stages;
+}
+
+template <typename Cipher>
+void Enclave<Cipher>::mergeNode(const ButterflyNode& node, std::vector<std::vector<Element>>& buckets, size_t first,
+                                int L, int Z) {
+    if (topology == TopologyKind::InPlace) {
+        merge_split_group(buckets, first, static_cast<int>(node.in.size()), node.level, node.levels, L, Z);
+        return;
+    }
+    auto split = merge_split_on_bit(buckets[first], buckets[first + 1],
+                                    ButterflyTopology(topology, L).key_bit(node.level), L, Z);
+    buckets[first] = std::move(split.first);
+    buckets[first + 1] = std::move(split.second);
+}
+
+template <typename Cipher>
+void Enclave<Cipher>::merge_split_group(std::vector<std::vector<Element>>& buckets, size_t first, int width,
+                                        int level, int levels, int total_levels, int Z) {
+    // Position j + 2^s pairs with j at the group's s-th level, on key bit level + s.
+    if (arity_bits > 1) {
+        // One node per 2^arity_bits positions; the last step routes what is left.
+        for (int s = 0; s < levels; s += arity_bits) {
+            int bits = std::min(arity_bits, levels - s);
+            size_t stride = size_t(1) << s;
+            for (size_t j = 0; j < static_cast<size_t>(width); j++)
+                if (((j >> s) & ((size_t(1) << bits) - 1)) == 0)
+                    merge_split_kary(buckets, first + j, stride, bits, level + s, total_levels, Z);
+        }
+        return;
+    }
+    for (int s = 0; s < levels; s++) {
+        size_t stride = size_t(1) << s;
+        for (size_t j = 0; j < static_cast<size_t>(width); j++) {
+            if (j & stride)
+                continue;
+            size_t a = first + j, b = first + j + stride;
+            auto split = merge_split_on_bit(buckets[a], buckets[b], level + s, total_levels, Z);
+            buckets[a] = std::move(split.first);
+            buckets[b] = std::move(split.second);
+        }
+    }
+}
+
+template <typename Cipher>
+void Enclave<Cipher>::merge_split_kary(std::vector<std::vector<Element>>& buckets, size_t first, size_t stride,
+                                       int bits, int key_shift, int total_levels, int Z) {
+    int L = total_levels;
+    int ways = 1 << bits;
+    int shift = key_shift;
+    if (shift < 0 || shift + bits > L || L + bits + 1 > 30)
+        throw std::invalid_argument("merge_split_kary: key bits out of range.");
+
+    std::vector<Element> combined;
+    combined.reserve(static_cast<size_t>(ways) * Z);
+    for (int j = 0; j < ways; j++)
+        combined.insert(combined.end(), std::make_move_iterator(buckets[first + j * stride].begin()),
+                        std::make_move_iterator(buckets[first + j * stride].end()));
+
+    std::vector<int> count(ways, 0);
+    for (const auto& elem : combined)
+        if (!elem.is_dummy)
+            count[(elem.key >> shift) & (ways - 1)]++;
+    for (int c : count)
+        if (c > Z)
+            throw std::overflow_error("Bucket overflow occurred in merge_split_kary.");
+
+    // Sort on (destination, dummy) above the key bits, so the key survives
+    // for the levels after this one. Dummies top up the destinations in order.
+    int key_mask = (1 << L) - 1;
+    int dest = 0;
+    for (auto& elem : combined) {
+        int tag;
+        if (elem.is_dummy) {
+            while (count[dest] == Z)
+                dest++;
+            count[dest]++;
+            tag = 2 * dest + 1;
+        } else {
+            tag = 2 * ((elem.key >> shift) & (ways - 1));
+        }
+        elem.key = (tag << L) | (elem.key & key_mask);
+    }
+
+    bitonicSort(combined, 0, combined.size(), true);
+
+    // Destination j is the j-th run of Z elements.
+    for (int j = 0; j < ways; j++) {
+        std::vector<Element>& out = buckets[first + j * stride];
+        out.assign(std::make_move_iterator(combined.begin() + j * Z),
+                   std::make_move_iterator(combined.begin() + (j + 1) * Z));
+        for (auto& elem : out)
+            elem.key &= key_mask;
+    }
+}
+
+template <typename Cipher>
+void Enclave<Cipher>::performButterflyNetwork(int B, int L, int Z) {
+    // The schedule comes from the topology (see butterfly_topology.h). With
+    // the in-place form the levels go in blocks of blockLevels(): each group
+    // of 2^levels buckets is loaded from the block's first level, taken
+    // through all of its levels in the enclave (merge_split_group) and stored
+    // at the block's last level, so untrusted memory sees about L / k passes
+    // instead of L. The schedule only depends on B, L and k. Each batch loads
+    // whole nodes in one call and stores them in one more call.
+    (void)B;
+    for (const auto& nodes : butterflySchedule(L, Z)) {
+        int width = static_cast<int>(nodes[0].in.size());
+        int level = nodes[0].level, levels = nodes[0].levels;
+        int per_batch = units_per_batch(transition_budget, width, static_cast<int>(nodes.size()));
+        for (size_t first = 0; first < nodes.size(); first += per_batch) {
+            size_t last = std::min(nodes.size(), first + per_batch);
+            std::vector<BucketRange> in, out;
+            for (size_t n = first; n < last; n++)
+                for (int j = 0; j < width; j++) {
+                    in.push_back(BucketRange{ level, nodes[n].in[j], 0, Z });
+                    out.push_back(BucketRange{ level + levels, nodes[n].out[j], 0, Z });
+                }
+            std::vector<std::vector<Element>> buckets = loadBuckets(in);
+            // The nodes are independent and each works on its own buckets.
+            threadPool().run(last - first, merge_threads, [&](size_t n, int) {
+                mergeNode(nodes[first + n], buckets, n * width, L, Z);
+            });
+            storeBuckets(out, make_bucket_views(buckets));
+        }
+    }
+}
+
+// Same stages and nodes as performButterflyNetwork, without the barrier
+// between stages: a node starts as soon as the nodes of the previous stage
+// that wrote its inputs, and the ones that read the buckets it overwrites
+// (its level shares a slab with the level two back, see level_arena.h), are
+// done, so later levels start while stragglers of earlier ones still run.
+// Each task loads and stores its node in one call; decryption and encryption
+// run on the task's worker.
+template <typename Cipher>
+void Enclave<Cipher>::performButterflyNetworkDataflow(int B, int L, int Z) {
+    std::vector<std::vector<ButterflyNode>> stages = butterflySchedule(L, Z);
+    // Tasks first[s] .. first[s + 1] - 1 are the nodes of stage s.
+    std::vector<size_t> first(stages.size() + 1, 0);
+    for (size_t s = 0; s < stages.size(); s++)
+        first[s + 1] = first[s] + stages[s].size();
+    DataflowGraph graph(first.back());
+    std::vector<size_t> writer(B), reader(B);
+    for (size_t s = 0; s < stages.size(); s++) {
+        for (size_t n = 0; n < stages[s].size(); n++) {
+            if (s > 0) {
+                for (int b : stages[s][n].in)
+                    graph.add_edge(writer[b], first[s] + n);
+                for (int b : stages[s][n].out)
+                    graph.add_edge(reader[b], first[s] + n);
+            }
+        }
+        for (size_t n = 0; n < stages[s].size(); n++) {
+            for (int b : stages[s][n].in)
+                reader[b] = first[s] + n;
+            for (int b : stages[s][n].out)
+                writer[b] = first[s] + n;
+        }
+    }
+    graph.run(threadPool(), merge_threads, [&](size_t task, int) {
+        size_t s = std::upper_bound(first.begin(), first.end(), task) - first.begin() - 1;
+        const ButterflyNode& node = stages[s][task - first[s]];
+        std::vector<BucketRange> in, out;
+        for (size_t j = 0; j < node.in.size(); j++) {
+            in.push_back(BucketRange{ node.level, node.in[j], 0, Z });
+            out.push_back(BucketRange{ node.level + node.levels, node.out[j], 0, Z });
+        }
+        std::vector<std::vector<Element>> buckets = loadBuckets(in);
+        mergeNode(node, buckets, 0, L, Z);
+        storeBuckets(out, make_bucket_views(buckets));
+    });
+}
+
+// Same pair nodes as performButterflyNetwork with one level per stage (no
+// blocking, binary nodes), but reads + decryption and encryption + writes run
+// on a dedicated I/O thread: while node i is being merge-split here, node i+1
+// is prefetched and the output of node i-1 is written behind. The I/O thread
+// serves jobs in order, so the first read of level l+1 is only issued after
+// the last write of level l.
+template <typename Cipher>
+void Enclave<Cipher>::performButterflyNetworkPipelined(int B, int L, int Z) {
+    (void)B;
+    if (L == 0)
+        return;
+    typedef std::pair<std::vector<Element>, std::vector<Element>> BucketPair;
+    ButterflyTopology topo(topology, L);
+    IoThread io;
+    auto fetch = [this, &io, Z](const ButterflyNode& node) {
+        int level = node.level, a = node.in[0], b = node.in[1];
+        return io.submit([this, level, a, b, Z]() {
+            std::vector<std::vector<Element>> pair = loadBuckets({ BucketRange{ level, a, 0, Z },
+                                                                   BucketRange{ level, b, 0, Z } });
+            return BucketPair(std::move(pair[0]), std::move(pair[1]));
+        });
+    };
+
+    std::vector<ButterflyNode> nodes = topo.pairs(0);
+    std::future<BucketPair> next = fetch(nodes[0]);
+    for (int level = 0; level < L; level++) {
+        std::vector<ButterflyNode> next_nodes = level + 1 < L ? topo.pairs(level + 1) : std::vector<ButterflyNode>();
+        std::vector<std::future<void>> writes;
+        for (size_t n = 0; n < nodes.size(); n++) {
+            BucketPair in = next.get();
+            bool last_pair = (n + 1 == nodes.size());
+            if (!last_pair)
+                next = fetch(nodes[n + 1]);
+            std::shared_ptr<BucketPair> out = std::make_shared<BucketPair>(
+                merge_split_on_bit(in.first, in.second, topo.key_bit(level), L, Z));
+            int a = nodes[n].out[0], b = nodes[n].out[1];
+            writes.push_back(io.submit([this, out, level, a, b, Z]() {
+                storeBuckets({ BucketRange{ level + 1, a, 0, Z }, BucketRange{ level + 1, b, 0, Z } },
+                             { make_bucket_view(out->first), make_bucket_view(out->second) });
+            }));
+            if (last_pair && level + 1 < L)
+                next = fetch(next_nodes[0]);
+        }
+        // Surface write errors before moving on.
+        for (auto& w : writes)
+            w.get();
+        nodes.swap(next_nodes);
+    }
+}
+
+template <typename Cipher>
+void Enclave<Cipher>::obliviousPermuteBucket(std::vector<Element>& bucket, std::mt19937& bucket_rng) {
+    for (auto &elem : bucket) {
+         elem.key = bucket_rng();
+    }
+    bitonicSort(bucket, 0, bucket.size(), true);
+}
+
+template <typename Cipher>
+std::vector<Element> Enclave<Cipher>::extractFinalElements(int B, int L) {
+    std::vector<Element> final_elements;
+    int Z = untrusted->bucket_size();
+    int per_batch = units_per_batch(transition_budget, 1, B);
+    for (int first = 0; first < B; first += per_batch) {
+        std::vector<BucketRange> ranges;
+        for (int i = first; i < std::min(B, first + per_batch); i++)
+            ranges.push_back(BucketRange{ L, i, 0, Z });
+        std::vector<std::vector<Element>> buckets = loadBuckets(ranges);
+        // One RNG per bucket, seeded in bucket order from the enclave's, so
+        // the permutations do not depend on which thread runs which bucket.
+        std::vector<uint32_t> seeds(buckets.size());
+        for (auto& seed : seeds)
+            seed = rng();
+        threadPool().run(buckets.size(), merge_threads, [&](size_t k, int) {
+            std::mt19937 bucket_rng(seeds[k]);
+            obliviousPermuteBucket(buckets[k], bucket_rng);
+        });
+        for (const auto& bucket : buckets)
+            for (const auto& elem : bucket)
+                if (!elem.is_dummy)
+                    final_elements.push_back(elem);
+    }
+    return final_elements;
+}
+
+template <typename Cipher>
+std::vector<Element> Enclave<Cipher>::finalSort(const std::vector<Element>& final_elements) {
+    std::vector<Element> sorted_elements = final_elements;
+    std::sort(sorted_elements.begin(), sorted_elements.end(),
+        [](const Element& a, const Element& b) {
+            return a.sorting < b.sorting; // Compare the numeric sorting column.
+        });
+    return sorted_elements;
+}
+
+template <typename Cipher>
+std::vector<Element> Enclave<Cipher>::oblivious_sort(const std::vector<Element>& input_array, int bucket_size) {
+    int n = input_array.size();
+    int Z = bucket_size;
+    auto params = computeBucketParameters(n, Z);
+    int B = params.first, L = params.second;
+    // Input and output both stay resident in the enclave.
+    size_t data_bytes = cost ? blockBytes(make_bucket_view(input_array)) : 0;
+    {
+        CostPhase phase(cost, "initialize", untrusted->transitions, data_bytes);
+        initializeBuckets(input_array, B, Z);
+    }
+    {
+        CostPhase phase(cost, "butterfly", untrusted->transitions);
+        if (pipelined_io)
+            performButterflyNetworkPipelined(B, L, Z);
+        else if (dataflow)
+            performButterflyNetworkDataflow(B, L, Z);
+        else
+            performButterflyNetwork(B, L, Z);
+    }
+    std::vector<Element> final_elements;
+    {
+        CostPhase phase(cost, "extract", untrusted->transitions, data_bytes);
+        final_elements = extractFinalElements(B, L);
+    }
+    CostPhase phase(cost, "final sort", untrusted->transitions, 2 * data_bytes);
+    return finalSort(final_elements);
+}
+
 #endif // OBLIVIOUS_SORT_TWO_H
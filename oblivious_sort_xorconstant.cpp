@@ -1,7 +1,9 @@
 #include "oblivious_sort_xorconstant.h"
+#include "xor_keystream.h"
 #include <iostream>
 #include <random>
 #include <cstring>
+#include <iterator>
 #include <cassert>
 #include <cmath>
 
@@ -9,48 +11,84 @@
 const int WORKING_SIZE = 64;
 
 // ----- XOR Helper Functions -----
-static std::string xor_encrypt_string(const std::string &s, int key) {
-    std::string result = s;
-    for (char &c : result) {
-        c = c ^ (key & 0xFF);
+// Payload keystream, keyed from encryption_key on first use (see xor_keystream.h).
+static const XorKeystream& payloadKeystream() {
+    static const XorKeystream keystream(static_cast<uint32_t>(Enclave::encryption_key));
+    return keystream;
+}
+
+// XORs the payloads of `block`, stored at `at`, as one packed stream under
+// the range's position nonce: the first starts at offset 0, each next one
+// where the previous one ended.
+static void applyPayloadStream(BucketView<Element> block, const BucketRange& at) {
+    XorKeystream::Nonce nonce = XorKeystream::position_nonce(at.level, at.bucket, at.offset);
+    uint64_t offset = 0;
+    for (auto& elem : block) {
+        payloadKeystream().apply(elem.payload, nonce, offset);
+        offset += elem.payload.size();
     }
-    return result;
 }
 
 static int xor_encrypt_int(int value, int key) {
     return value ^ key;
 }
 
-// ----- UntrustedMemory Methods -----
-std::vector<Element> UntrustedMemory::read_bucket(int level, int bucket_index) {
-    std::pair<int,int> key = { level, bucket_index };
-    return storage[key];
+// Bytes held by an element, including its heap-allocated payload.
+static size_t elementBytes(const Element& e) {
+    return sizeof(Element) + e.payload.size();
 }
 
-void UntrustedMemory::write_bucket(int level, int bucket_index, const std::vector<Element>& bucket) {
-    std::pair<int,int> key = { level, bucket_index };
-    storage[key] = bucket;
+// ----- External-memory merge-split helpers -----
+//
+// The merge-split and the final permutation never hold a whole bucket in the
+// enclave: the buckets they work on are treated as one array of WORKING_SIZE
+// blocks left in untrusted memory, and every step loads at most two blocks.
+// Enclave memory is therefore 2 * WORKING_SIZE elements whatever Z is, and
+// the block schedule depends only on Z, never on the data.
+
+// Elements per block: WORKING_SIZE, or the whole bucket when Z is smaller.
+static int blockSize(int Z) {
+    return std::min(WORKING_SIZE, Z);
 }
 
-std::vector<std::string> UntrustedMemory::get_access_log() {
-    return access_log;
+// Block g of the array formed by `buckets` at `level`, in that order.
+static BucketRange arrayBlock(int level, const std::vector<int>& buckets, int g, int W, int Z) {
+    int index = g * W;
+    return BucketRange{ level, buckets[index / Z], index % Z, W };
 }
 
-std::vector<Element> UntrustedMemory::read_bucket_block(int level, int bucket_index, int offset, int block_size) {
-    std::pair<int,int> key = { level, bucket_index };
-    const std::vector<Element>& bucket = storage[key];
-    int end = std::min(static_cast<int>(bucket.size()), offset + block_size);
-    return std::vector<Element>(bucket.begin() + offset, bucket.begin() + end);
+// Key compared by the network. A dummy carries its tag, 1, in `key`; a
+// real element's tag (0 or 2) comes from its routing bit, so its own key is
+// kept for the next level. bit_index < 0 compares the keys themselves.
+static int sortKey(const Element& e, int bit_index) {
+    if (bit_index < 0 || e.is_dummy)
+        return e.key;
+    return ((e.key >> bit_index) & 1) << 1;
 }
 
-void UntrustedMemory::write_bucket_block(int level, int bucket_index, int offset, const std::vector<Element>& block) {
-    std::pair<int,int> key = { level, bucket_index };
-    std::vector<Element>& bucket = storage[key];
-    if (bucket.size() < static_cast<size_t>(offset + block.size()))
-        bucket.resize(offset + block.size());
-    for (size_t i = 0; i < block.size(); i++) {
-        bucket[offset + i] = block[i];
-    }
+static void compareExchange(Element& a, Element& b, bool ascending, int bit_index) {
+    int ka = sortKey(a, bit_index), kb = sortKey(b, bit_index);
+    if ((ascending && ka > kb) || (!ascending && ka < kb))
+        std::swap(a, b);
+}
+
+// Bitonic stages j = top, top/2, ..., 1 of merge size k on one block whose
+// first element sits at array index `base` (the direction follows the index).
+static void blockStages(std::vector<Element>& block, int base, int k, int top, int bit_index) {
+    int W = static_cast<int>(block.size());
+    for (int j = top; j > 0; j /= 2)
+        for (int t = 0; t < W; t++) {
+            int partner = t ^ j;
+            if (partner > t)
+                compareExchange(block[t], block[partner], ((base + t) & k) == 0, bit_index);
+        }
+}
+
+// Every stage with k <= block size: block g ends up sorted ascending when g is
+// even and descending when g is odd, ready for Enclave::externalBitonicMerge.
+static void sortRuns(std::vector<Element>& block, int base, int bit_index) {
+    for (int k = 2; k <= static_cast<int>(block.size()); k *= 2)
+        blockStages(block, base, k, k / 2, bit_index);
 }
 
 // ----- Enclave Methods -----
@@ -61,36 +99,190 @@ Enclave::Enclave(UntrustedMemory* u) : untrusted(u) {
 
 // XOR-based encryption: encrypt every field for each element.
 std::vector<Element> Enclave::encryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> encrypted;
-    for (const auto &elem : bucket) {
-        Element e;
+    std::vector<Element> encrypted(bucket.size());
+    encryptBucketInto(make_bucket_view(bucket), make_bucket_view(encrypted));
+    return encrypted;
+}
+
+// Encrypts a bucket (or block) directly into `out`, normally a slot handed out by UntrustedMemory.
+void Enclave::encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out, const BucketRange& at) {
+    if (bucket.size != out.size)
+        throw std::invalid_argument("encryptBucketInto: destination size does not match the bucket.");
+    for (int i = 0; i < bucket.size; i++) {
+        const Element &elem = bucket[i];
+        Element &e = out[i];
         // Encrypt integers with XOR.
         e.sorting = xor_encrypt_int(elem.sorting, encryption_key);
         e.key = xor_encrypt_int(elem.key, encryption_key);
-        // Encrypt the payload string.
-        e.payload = xor_encrypt_string(elem.payload, encryption_key);
+        e.payload = elem.payload;
         // Encrypt the dummy flag by toggling it (optional). Here we leave it unencrypted.
-        e.is_dummy = elem.is_dummy; 
-        encrypted.push_back(e);
+        e.is_dummy = elem.is_dummy;
     }
-    return encrypted;
+    // Encrypt the payload strings.
+    applyPayloadStream(out, at);
 }
 
 // XOR-based decryption is identical to encryption.
 std::vector<Element> Enclave::decryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> decrypted;
-    for (const auto &elem : bucket) {
-        Element e;
-        e.sorting = xor_encrypt_int(elem.sorting, encryption_key);
-        e.key = xor_encrypt_int(elem.key, encryption_key);
-        e.payload = xor_encrypt_string(elem.payload, encryption_key);
-        e.is_dummy = elem.is_dummy;
-        decrypted.push_back(e);
-    }
+    return decryptBucket(make_bucket_view(bucket));
+}
+
+// Decrypts a bucket (or block) read through a view without copying the ciphertext first.
+std::vector<Element> Enclave::decryptBucket(BucketView<const Element> bucket, const BucketRange& at) {
+    std::vector<Element> decrypted(bucket.size);
+    encryptBucketInto(bucket, make_bucket_view(decrypted), at);
     return decrypted;
 }
 
+void Enclave::encryptBucketInPlace(BucketView<Element> bucket, const BucketRange& at) {
+    for (auto& elem : bucket) {
+        elem.sorting = xor_encrypt_int(elem.sorting, encryption_key);
+        elem.key = xor_encrypt_int(elem.key, encryption_key);
+    }
+    applyPayloadStream(bucket, at);
+}
+
+void Enclave::decryptBucketInPlace(BucketView<Element> bucket, const BucketRange& at) {
+    encryptBucketInPlace(bucket, at);
+}
+
+// Bytes of a block as it crosses the enclave boundary.
+static size_t blockBytes(BucketView<const Element> block) {
+    size_t bytes = 0;
+    for (const auto& e : block)
+        bytes += elementBytes(e);
+    return bytes;
+}
+
+std::vector<std::vector<Element>> Enclave::loadBuckets(const std::vector<BucketRange>& ranges) {
+    std::vector<std::vector<Element>> blocks;
+    blocks.reserve(ranges.size());
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted = untrusted->read_buckets(batch);
+            for (size_t k = 0; k < batch.size(); k++) {
+                if (cost)
+                    crossed += blockBytes(make_bucket_view(encrypted[k]));
+                blocks.push_back(decryptBucket(make_bucket_view(encrypted[k]), batch[k]));
+            }
+        } else {
+            std::vector<BucketView<const Element>> views = untrusted->view_buckets(batch);
+            for (size_t k = 0; k < batch.size(); k++) {
+                if (cost)
+                    crossed += blockBytes(views[k]);
+                blocks.push_back(decryptBucket(views[k], batch[k]));
+            }
+        }
+        first = last;
+    }
+    if (cost)
+        cost->on_load(crossed);
+    return blocks;
+}
+
+void Enclave::storeBuckets(const std::vector<BucketRange>& ranges, const std::vector<BucketView<const Element>>& blocks) {
+    if (blocks.size() != ranges.size())
+        throw std::invalid_argument("storeBuckets: need one block per range.");
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted;
+            encrypted.reserve(batch.size());
+            for (size_t k = first; k < last; k++) {
+                encrypted.emplace_back(blocks[k].size);
+                encryptBucketInto(blocks[k], make_bucket_view(encrypted.back()), ranges[k]);
+                if (cost)
+                    crossed += blockBytes(make_bucket_view(encrypted.back()));
+            }
+            untrusted->write_buckets(batch, encrypted);
+        } else {
+            std::vector<BucketView<Element>> slots = untrusted->bucket_slots(batch);
+            for (size_t k = first; k < last; k++) {
+                encryptBucketInto(blocks[k], slots[k - first], ranges[k]);
+                if (cost)
+                    crossed += blockBytes(slots[k - first]);
+            }
+        }
+        first = last;
+    }
+    if (cost)
+        cost->on_store(crossed);
+}
+
+void Enclave::loadBucketsInto(const std::vector<BucketRange>& ranges, const std::vector<BucketView<Element>>& blocks) {
+    if (blocks.size() != ranges.size())
+        throw std::invalid_argument("loadBucketsInto: need one block per range.");
+    for (size_t k = 0; k < ranges.size(); k++)
+        if (blocks[k].size != ranges[k].length)
+            throw std::invalid_argument("loadBucketsInto: block size does not match the range.");
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted = untrusted->read_buckets(batch);
+            for (size_t k = first; k < last; k++) {
+                if (cost)
+                    crossed += blockBytes(make_bucket_view(encrypted[k - first]));
+                std::move(encrypted[k - first].begin(), encrypted[k - first].end(), blocks[k].begin());
+            }
+        } else {
+            std::vector<BucketView<const Element>> views = untrusted->view_buckets(batch);
+            for (size_t k = first; k < last; k++) {
+                if (cost)
+                    crossed += blockBytes(views[k - first]);
+                std::copy(views[k - first].begin(), views[k - first].end(), blocks[k].begin());
+            }
+        }
+        for (size_t k = first; k < last; k++)
+            decryptBucketInPlace(blocks[k], ranges[k]);
+        first = last;
+    }
+    if (cost)
+        cost->on_load(crossed);
+}
+
+void Enclave::storeBucketsFrom(const std::vector<BucketRange>& ranges, const std::vector<BucketView<Element>>& blocks) {
+    if (blocks.size() != ranges.size())
+        throw std::invalid_argument("storeBucketsFrom: need one block per range.");
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        for (size_t k = first; k < last; k++) {
+            encryptBucketInPlace(blocks[k], ranges[k]);
+            if (cost)
+                crossed += blockBytes(blocks[k]);
+        }
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted;
+            encrypted.reserve(batch.size());
+            for (size_t k = first; k < last; k++)
+                encrypted.emplace_back(blocks[k].begin(), blocks[k].end());
+            untrusted->write_buckets(batch, encrypted);
+        } else {
+            std::vector<BucketView<Element>> slots = untrusted->bucket_slots(batch);
+            for (size_t k = first; k < last; k++) {
+                if (slots[k - first].size != blocks[k].size)
+                    throw std::invalid_argument("storeBucketsFrom: block size does not match the slot.");
+                std::swap_ranges(blocks[k].begin(), blocks[k].end(), slots[k - first].begin());
+            }
+        }
+        first = last;
+    }
+    if (cost)
+        cost->on_store(crossed);
+}
+
 std::pair<int, int> Enclave::computeBucketParameters(int n, int Z) {
+    // The block bitonic network needs a power-of-two bucket.
+    if (Z <= 0 || (Z & (Z - 1)) != 0)
+        throw std::invalid_argument("Bucket size must be a power of two.");
     int minimalB = static_cast<int>(std::ceil((2.0 * n) / Z));
     // For constant-storage, we may not need a high safety factor.
     int safety_factor = 1;
@@ -104,207 +296,147 @@ std::pair<int, int> Enclave::computeBucketParameters(int n, int Z) {
     return {B, L};
 }
 
-// Initialize buckets by partitioning input elements and padding with dummies.
+// Initialize buckets by partitioning input elements and padding with dummies,
+// building and writing each bucket one block at a time.
 void Enclave::initializeBuckets(const std::vector<Element>& input_array, int B, int Z) {
     int n = input_array.size();
+    untrusted->allocate(B, Z);
     int group_size = (n + B - 1) / B; // ceiling(n/B)
+    int W = blockSize(Z);
+    std::uniform_int_distribution<int> key_dist(0, B - 1);
     for (int i = 0; i < B; i++) {
-        std::vector<Element> bucket;
         int start = i * group_size;
         int end = std::min(start + group_size, n);
-        for (int j = start; j < end; j++) {
-            std::uniform_int_distribution<int> key_dist(0, B - 1);
-            int random_key = key_dist(rng);
-            // Use the input element directly.
-            bucket.push_back(Element{ input_array[j].sorting, input_array[j].payload, random_key, false });
-        }
-        if (bucket.size() > static_cast<size_t>(Z / 2))
+        if (end - start > Z / 2)
             throw std::overflow_error("Bucket overflow in initializeBuckets: too many real elements.");
-        // Pad with dummy elements.
-        while (bucket.size() < static_cast<size_t>(Z))
-            bucket.push_back(Element{ 0, "", 0, true });
-        // Encrypt the entire bucket.
-        std::vector<Element> encrypted_bucket = encryptBucket(bucket);
-        for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-            int block_size = std::min(WORKING_SIZE, Z - offset);
-            std::vector<Element> block(encrypted_bucket.begin() + offset, encrypted_bucket.begin() + offset + block_size);
-            untrusted->write_bucket_block(0, i, offset, block);
-        }
-    }
-}
-
-// In-memory bitonic merge.
-void Enclave::bitonicMerge(std::vector<Element>& a, int low, int cnt, bool ascending) {
-    if (cnt > 1) {
-        int k = cnt / 2;
-        for (int i = low; i < low + k; i++) {
-            if ((ascending && a[i].key > a[i+k].key) ||
-                (!ascending && a[i].key < a[i+k].key))
-                std::swap(a[i], a[i+k]);
+        for (int offset = 0; offset < Z; offset += W) {
+            std::vector<Element> block;
+            block.reserve(W);
+            for (int j = start + offset; j < start + offset + W; j++) {
+                // Use the input element directly.
+                if (j < end)
+                    block.push_back(Element{ input_array[j].sorting, input_array[j].payload, key_dist(rng), false });
+                else
+                    block.push_back(Element{ 0, "", 0, true });
+            }
+            storeBuckets({ BucketRange{ 0, i, offset, W } }, { make_bucket_view(block) });
         }
-        bitonicMerge(a, low, k, ascending);
-        bitonicMerge(a, low+k, k, ascending);
     }
 }
 
-void Enclave::bitonicSort(std::vector<Element>& a, int low, int cnt, bool ascending) {
-    if (cnt > 1) {
-        int k = cnt / 2;
-        bitonicSort(a, low, k, true);
-        bitonicSort(a, low+k, k, false);
-        bitonicMerge(a, low, cnt, ascending);
-    }
-}
-
-// Constant-space merge using a fixed-size buffer.
-void Enclave::constantSpaceMerge(std::vector<Element>& arr, int start, int mid, int end) {
-    int left = start, right = mid, out = start;
-    std::vector<Element> buffer;
-    buffer.reserve(WORKING_SIZE);
-    while (left < mid && right < end) {
-        buffer.clear();
-        while ((int)buffer.size() < WORKING_SIZE && left < mid && right < end) {
-            if (arr[left].key <= arr[right].key)
-                buffer.push_back(arr[left++]);
-            else
-                buffer.push_back(arr[right++]);
+// Merges the sorted runs left by sortRuns into one ascending array: the
+// buckets.size() * Z slots of `buckets` at `level`. Stages that span
+// blocks compare two blocks slot by slot; the rest finish inside each block.
+void Enclave::externalBitonicMerge(int level, const std::vector<int>& buckets, int Z, int bit_index) {
+    int W = blockSize(Z);
+    int n = static_cast<int>(buckets.size()) * Z;
+    int blocks = n / W;
+    // Blocks g and h of a cross-block stage sit back to back in `pair`.
+    std::vector<Element> pair(2 * W);
+    std::vector<Element> block(W);
+    std::vector<BucketView<Element>> halves{ make_bucket_view(pair).subview(0, W), make_bucket_view(pair).subview(W, W) };
+    for (int k = 2 * W; k <= n; k *= 2) {
+        for (int j = k / 2; j >= W; j /= 2) {
+            for (int g = 0; g < blocks; g++) {
+                int h = g ^ (j / W);
+                if (h < g)
+                    continue;
+                std::vector<BucketRange> ranges{ arrayBlock(level, buckets, g, W, Z),
+                                                 arrayBlock(level, buckets, h, W, Z) };
+                loadBucketsInto(ranges, halves);
+                bool ascending = ((g * W) & k) == 0;
+                for (int t = 0; t < W; t++)
+                    compareExchange(pair[t], pair[W + t], ascending, bit_index);
+                storeBucketsFrom(ranges, halves);
+            }
         }
-        while ((int)buffer.size() < WORKING_SIZE && left < mid)
-            buffer.push_back(arr[left++]);
-        while ((int)buffer.size() < WORKING_SIZE && right < end)
-            buffer.push_back(arr[right++]);
-        for (size_t i = 0; i < buffer.size(); i++) {
-            arr[out + i] = buffer[i];
+        for (int g = 0; g < blocks; g++) {
+            std::vector<BucketRange> ranges{ arrayBlock(level, buckets, g, W, Z) };
+            loadBucketsInto(ranges, { make_bucket_view(block) });
+            blockStages(block, g * W, k, W / 2, bit_index);
+            storeBucketsFrom(ranges, { make_bucket_view(block) });
         }
-        out += buffer.size();
     }
-    while (left < mid)
-        arr[out++] = arr[left++];
-    while (right < end)
-        arr[out++] = arr[right++];
 }
 
-// Constant-space bitonic sort over blocks.
-void Enclave::constantSpaceBitonicSort(std::vector<Element>& arr) {
-    int n = arr.size();
-    for (int start = 0; start < n; start += WORKING_SIZE) {
-        int len = std::min(WORKING_SIZE, n - start);
-        bitonicSort(arr, start, len, true);
-    }
-    int current_block_size = WORKING_SIZE;
-    while (current_block_size < n) {
-        for (int start = 0; start < n; start += 2 * current_block_size) {
-            int mid = std::min(start + current_block_size, n);
-            int end = std::min(start + 2 * current_block_size, n);
-            constantSpaceMerge(arr, start, mid, end);
-        }
-        current_block_size *= 2;
-    }
-}
+// External merge-split of the pair node.in at node.level into node.out at
+// level+1, on key bit `bit_index`. Both buckets are streamed block by block
+// in one pass that counts the real elements bound for each side, tags every
+// dummy 1, sorts each block and writes it to level+1; externalBitonicMerge
+// then finishes the sort there. The array ends as the count0 reals tagged 0,
+// the dummies, then the count1 reals tagged 2, so with both counts at most Z
+// the first Z slots (the 0s and Z - count0 dummies) land in node.out[0] and
+// the last Z in node.out[1], without knowing the counts before tagging.
+void Enclave::merge_split_external(const ButterflyNode& node, int bit_index, int Z) {
+    int level = node.level;
+    int W = blockSize(Z);
+    int blocks = 2 * Z / W;
 
-// Merge-split: combine two buckets and split them into two.
-std::pair<std::vector<Element>, std::vector<Element>> Enclave::merge_split_bitonic(
-    const std::vector<Element>& bucket1,
-    const std::vector<Element>& bucket2,
-    int level, int total_levels, int Z) {
-    
-    int L = total_levels;
-    int bit_index = L - 1 - level;
-    
-    // Count real elements for each output bucket.
+    std::vector<Element> block(W);
     int count0 = 0, count1 = 0;
-    std::vector<Element> combined = bucket1;
-    combined.insert(combined.end(), bucket2.begin(), bucket2.end());
-    for (const auto &elem : combined) {
-        if (!elem.is_dummy) {
-            if (((elem.key >> bit_index) & 1) == 0)
+    for (int g = 0; g < blocks; g++) {
+        loadBucketsInto({ arrayBlock(level, node.in, g, W, Z) }, { make_bucket_view(block) });
+        for (Element &e : block) {
+            if (e.is_dummy)
+                e.key = 1;
+            else if (((e.key >> bit_index) & 1) == 0)
                 count0++;
             else
                 count1++;
         }
+        sortRuns(block, g * W, bit_index);
+        storeBucketsFrom({ arrayBlock(level + 1, node.out, g, W, Z) }, { make_bucket_view(block) });
     }
     if (count0 > Z || count1 > Z)
         throw std::overflow_error("Bucket overflow occurred in merge_split.");
-    
-    int needed_dummies0 = Z - count0;
-    int needed_dummies1 = Z - count1;
-    int assigned_dummies0 = 0, assigned_dummies1 = 0;
-    
-    // Process combined array.
-    for (auto &elem : combined) {
-        if (elem.is_dummy) {
-            if (assigned_dummies0 < needed_dummies0) {
-                elem.key = 1;
-                assigned_dummies0++;
-            } else {
-                elem.key = 3;
-                assigned_dummies1++;
-            }
-        } else {
-            int bit_val = (elem.key >> bit_index) & 1;
-            elem.key = (bit_val << 1);
-        }
-    }
-    // Sort combined array.
-    bitonicSort(combined, 0, combined.size(), true);
-    
-    std::vector<Element> out_bucket0(combined.begin(), combined.begin() + Z);
-    std::vector<Element> out_bucket1(combined.begin() + Z, combined.end());
-    return { out_bucket0, out_bucket1 };
+    externalBitonicMerge(level + 1, node.out, Z, bit_index);
 }
 
-// Process the butterfly network.
+// Process the butterfly network with external merge-splits. The pairs and
+// the key bit of each level come from the topology (see butterfly_topology.h).
 void Enclave::performButterflyNetwork(int B, int L, int Z) {
-    for (int level = 0; level < L; level++) {
-        for (int i = 0; i < B; i += 2) {
-            std::vector<Element> bucket1_enc, bucket2_enc;
-            for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-                auto block1 = untrusted->read_bucket_block(level, i, offset, WORKING_SIZE);
-                bucket1_enc.insert(bucket1_enc.end(), block1.begin(), block1.end());
-                auto block2 = untrusted->read_bucket_block(level, i+1, offset, WORKING_SIZE);
-                bucket2_enc.insert(bucket2_enc.end(), block2.begin(), block2.end());
-            }
-            std::vector<Element> bucket1 = decryptBucket(bucket1_enc);
-            std::vector<Element> bucket2 = decryptBucket(bucket2_enc);
-            auto merge_result = merge_split_bitonic(bucket1, bucket2, level, L, Z);
-            // Re-encrypt buckets after merge-split.
-            std::vector<Element> out_bucket0 = encryptBucket(merge_result.first);
-            std::vector<Element> out_bucket1 = encryptBucket(merge_result.second);
-            for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-                int block_size = std::min(WORKING_SIZE, Z - offset);
-                std::vector<Element> block0(out_bucket0.begin() + offset, out_bucket0.begin() + offset + block_size);
-                std::vector<Element> block1(out_bucket1.begin() + offset, out_bucket1.begin() + offset + block_size);
-                untrusted->write_bucket_block(level+1, i, offset, block0);
-                untrusted->write_bucket_block(level+1, i+1, offset, block1);
-            }
-        }
-    }
+    if (Z <= 0 || (Z & (Z - 1)) != 0)
+        throw std::invalid_argument("performButterflyNetwork: bucket size must be a power of two.");
+    ButterflyTopology topo(topology, L);
+    if (topo.buckets() != B)
+        throw std::invalid_argument("performButterflyNetwork: B must be 2^L.");
+    for (int level = 0; level < L; level++)
+        for (const ButterflyNode& node : topo.pairs(level))
+            merge_split_external(node, topo.key_bit(level), Z);
 }
 
-// Extract final elements from the last level.
+// Stream extraction of final elements: each bucket is permuted in place and
+// then read back one block at a time.
 std::vector<Element> Enclave::extractFinalElements(int B, int L, int Z) {
     std::vector<Element> final_elements;
+    int W = blockSize(Z);
+    std::vector<Element> block(W);
     for (int i = 0; i < B; i++) {
-        std::vector<Element> bucket_enc;
-        for (int offset = 0; offset < Z; offset += WORKING_SIZE) {
-            auto block = untrusted->read_bucket_block(L, i, offset, WORKING_SIZE);
-            bucket_enc.insert(bucket_enc.end(), block.begin(), block.end());
+        obliviousPermuteBucket(L, i, Z);
+        for (int offset = 0; offset < Z; offset += W) {
+            loadBucketsInto({ BucketRange{ L, i, offset, W } }, { make_bucket_view(block) });
+            for (const auto &elem : block)
+                if (!elem.is_dummy)
+                    final_elements.push_back(elem);
         }
-        std::vector<Element> bucket = decryptBucket(bucket_enc);
-        obliviousPermuteBucket(bucket);
-        for (const auto &elem : bucket)
-            if (!elem.is_dummy)
-                final_elements.push_back(elem);
     }
     return final_elements;
 }
 
-// Oblivious permutation using in-memory bitonic sort.
-void Enclave::obliviousPermuteBucket(std::vector<Element>& bucket) {
-    for (auto &elem : bucket) {
-        elem.key = rng();
+// Oblivious permutation of a bucket in untrusted memory: random keys, then
+// the same block bitonic network sorts the bucket by them.
+void Enclave::obliviousPermuteBucket(int level, int bucket_index, int Z) {
+    int W = blockSize(Z);
+    std::vector<Element> block(W);
+    for (int offset = 0; offset < Z; offset += W) {
+        std::vector<BucketRange> ranges{ BucketRange{ level, bucket_index, offset, W } };
+        loadBucketsInto(ranges, { make_bucket_view(block) });
+        for (auto &elem : block)
+            elem.key = rng();
+        sortRuns(block, offset, -1);
+        storeBucketsFrom(ranges, { make_bucket_view(block) });
     }
-    bitonicSort(bucket, 0, bucket.size(), true);
+    externalBitonicMerge(level, { bucket_index }, Z, -1);
 }
 
 // Final sort (non-oblivious) by the sorting field.
@@ -322,8 +454,21 @@ std::vector<Element> Enclave::oblivious_sort(const std::vector<Element>& input_a
     int Z = bucket_size; // Full bucket size.
     auto params = computeBucketParameters(n, Z);
     int B = params.first, L = params.second;
-    initializeBuckets(input_array, B, Z);
-    performButterflyNetwork(B, L, Z);
-    std::vector<Element> final_elements = extractFinalElements(B, L, Z);
+    // Input and output both stay resident in the enclave.
+    size_t data_bytes = cost ? blockBytes(make_bucket_view(input_array)) : 0;
+    {
+        CostPhase phase(cost, "initialize", untrusted->transitions, data_bytes);
+        initializeBuckets(input_array, B, Z);
+    }
+    {
+        CostPhase phase(cost, "butterfly", untrusted->transitions);
+        performButterflyNetwork(B, L, Z);
+    }
+    std::vector<Element> final_elements;
+    {
+        CostPhase phase(cost, "extract", untrusted->transitions, data_bytes);
+        final_elements = extractFinalElements(B, L, Z);
+    }
+    CostPhase phase(cost, "final sort", untrusted->transitions, 2 * data_bytes);
     return finalSort(final_elements);
 }
@@ -2,13 +2,16 @@
 #define OBLIVIOUS_SORT_CONSTANT_H
 
 #include <vector>
-#include <map>
 #include <string>
 #include <stdexcept>
 #include <random>
 #include <algorithm>
 #include <utility>
 
+#include "untrusted_memory.h"
+#include "enclave_cost.h"
+#include "butterfly_topology.h"
+
 /*
  * Element:
  * Represents a data element used in oblivious sorting.
@@ -28,38 +31,53 @@ struct Element {
     bool is_dummy;
 };
 
-class UntrustedMemory {
-public:
-    // Storage: keys are pairs (level, bucket_index); values are buckets.
-    std::map<std::pair<int, int>, std::vector<Element>> storage;
-    std::vector<std::string> access_log;
-
-    // Reads a bucket from untrusted memory.
-    std::vector<Element> read_bucket(int level, int bucket_index);
-    // Writes a bucket to untrusted memory.
-    void write_bucket(int level, int bucket_index, const std::vector<Element>& bucket);
-    // Returns an access log.
-    std::vector<std::string> get_access_log();
-
-    // Block-based I/O for streaming operations.
-    std::vector<Element> read_bucket_block(int level, int bucket_index, int offset, int block_size);
-    void write_bucket_block(int level, int bucket_index, int offset, const std::vector<Element>& block);
-};
+typedef UntrustedBuckets<Element, XorRecords<Element>> UntrustedMemory;
 
 class Enclave {
 public:
     UntrustedMemory* untrusted;
     std::mt19937 rng; // Random number generator.
+    // Most bucket ranges per call into untrusted memory (<= 0: no limit). Bigger
+    // batches mean fewer transitions but more buckets held in the enclave.
+    int transition_budget = 16;
+    // Which buckets each level merge-splits and where the halves go (see
+    // butterfly_topology.h).
+    TopologyKind topology = TopologyKind::InPlace;
+    // Optional boundary cost accounting per phase (see enclave_cost.h).
+    EnclaveCostSimulator* cost = nullptr;
 
     // Fixed encryption key for simulation.
     static constexpr int encryption_key = 0xdeadbeef;
 
     Enclave(UntrustedMemory* u);
+    // Bytes of a backend record for payloads of up to max_payload bytes
+    // (see UntrustedMemory::use_backend).
+    static size_t recordBytes(size_t max_payload) { return XorRecords<Element>::size(max_payload); }
 
     // Encrypts a bucket by XOR–encrypting each field of each Element.
     static std::vector<Element> encryptBucket(const std::vector<Element>& bucket);
     // Decrypts a bucket by XOR–decrypting each field of each Element.
     static std::vector<Element> decryptBucket(const std::vector<Element>& bucket);
+    // View-based variants: decrypt straight out of untrusted storage and
+    // encrypt straight into a destination slot.
+    // `at` is where the bucket is stored; it picks the payload keystream offset.
+    static std::vector<Element> decryptBucket(BucketView<const Element> bucket, const BucketRange& at = BucketRange());
+    static void encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out,
+                                  const BucketRange& at = BucketRange());
+    // In-place variants: transform a block where it sits, with no new vector.
+    static void encryptBucketInPlace(BucketView<Element> bucket, const BucketRange& at = BucketRange());
+    static void decryptBucketInPlace(BucketView<Element> bucket, const BucketRange& at = BucketRange());
+    // Decrypt ranges from / encrypt ranges into untrusted memory (through views
+    // when storage is in memory, through the backend otherwise), in calls of at
+    // most transition_budget ranges each.
+    std::vector<std::vector<Element>> loadBuckets(const std::vector<BucketRange>& ranges);
+    void storeBuckets(const std::vector<BucketRange>& ranges, const std::vector<BucketView<const Element>>& blocks);
+    // The same into / out of caller-owned blocks: each range is
+    // copied into its block (reusing the payload strings) and decrypted there;
+    // each stored block is encrypted in place and swapped into its slot,
+    // leaving the block with the slot's old storage to reuse.
+    void loadBucketsInto(const std::vector<BucketRange>& ranges, const std::vector<BucketView<Element>>& blocks);
+    void storeBucketsFrom(const std::vector<BucketRange>& ranges, const std::vector<BucketView<Element>>& blocks);
 
     // Computes bucket parameters (B: number of buckets, L: number of levels)
     // given the input size n and bucket capacity Z.
@@ -76,18 +94,12 @@ public:
     // Main oblivious sort function that works on vector<Element>.
     std::vector<Element> oblivious_sort(const std::vector<Element>& input_array, int bucket_size);
 
-    // In-memory bitonic sort functions.
-    void bitonicMerge(std::vector<Element>& a, int low, int cnt, bool ascending);
-    void bitonicSort(std::vector<Element>& a, int low, int cnt, bool ascending);
-
-    // Streaming/block-based helper functions.
-    void constantSpaceMerge(std::vector<Element>& arr, int start, int mid, int end);
-    void constantSpaceBitonicSort(std::vector<Element>& arr);
-    std::pair<std::vector<Element>, std::vector<Element>> merge_split_bitonic(
-        const std::vector<Element>& bucket1,
-        const std::vector<Element>& bucket2,
-        int level, int total_levels, int Z);
-    void obliviousPermuteBucket(std::vector<Element>& bucket);
+    // External-memory helpers (see oblivious_sort_xorconstant.cpp): at most
+    // two WORKING_SIZE blocks are decrypted in the enclave at any time, in
+    // work buffers that each helper reuses for every block it touches.
+    void externalBitonicMerge(int level, const std::vector<int>& buckets, int Z, int bit_index);
+    void merge_split_external(const ButterflyNode& node, int bit_index, int Z);
+    void obliviousPermuteBucket(int level, int bucket_index, int Z);
 };
 
 #endif // OBLIVIOUS_SORT_CONSTANT_H
@@ -1,4 +1,5 @@
-#include "oblivious_sort_merge.h"
+#include "oblivious_sort_xormerge.h"
+#include "xor_keystream.h"
 #include <iostream>
 #include <algorithm>
 #include <random>
@@ -6,31 +7,32 @@
 #include <cstdint>
 
 // ---------- XOR Helper Functions ----------
-static std::string xor_encrypt_string(const std::string &s, int key) {
-    std::string result = s;
-    for (char &c : result) {
-        c = c ^ (key & 0xFF);
-    }
-    return result;
-}
-
-static int xor_encrypt_int(int value, int key) {
-    return value ^ key;
+// Payload keystream, keyed from encryption_key on first use (see xor_keystream.h).
+static const XorKeystream& payloadKeystream() {
+    static const XorKeystream keystream(static_cast<uint32_t>(Enclave::encryption_key));
+    return keystream;
 }
 
-// ---------- UntrustedMemory Methods ----------
-std::vector<Element> UntrustedMemory::read_bucket(int level, int bucket_index) {
-    std::pair<int, int> key = { level, bucket_index };
-    return storage[key];
+// XORs the payloads of the real elements of `block`, stored at `at`, as one
+// packed stream under the range's position nonce: the first starts at
+// offset 0, each next one where the previous one ended.
+static void applyPayloadStream(BucketView<Element> block, const BucketRange& at) {
+    XorKeystream::Nonce nonce = XorKeystream::position_nonce(at.level, at.bucket, at.offset);
+    uint64_t offset = 0;
+    for (auto& elem : block)
+        if (!elem.is_dummy) {
+            payloadKeystream().apply(elem.payload, nonce, offset);
+            offset += elem.payload.size();
+        }
 }
 
-void UntrustedMemory::write_bucket(int level, int bucket_index, const std::vector<Element>& bucket) {
-    std::pair<int, int> key = { level, bucket_index };
-    storage[key] = bucket;
+static int xor_encrypt_int(int value, int key) {
+    return value ^ key;
 }
 
-std::vector<std::string> UntrustedMemory::get_access_log() {
-    return access_log;
+// Bytes held by an element, including its heap-allocated payload.
+static size_t elementBytes(const Element& e) {
+    return sizeof(Element) + e.payload.size();
 }
 
 // ---------- Enclave Methods ----------
@@ -40,21 +42,105 @@ Enclave::Enclave(UntrustedMemory* u) : untrusted(u) {
 }
 
 std::vector<Element> Enclave::encryptBucket(const std::vector<Element>& bucket) {
-    std::vector<Element> encrypted = bucket;
-    for(auto &elem : encrypted) {
+    std::vector<Element> encrypted(bucket.size());
+    encryptBucketInto(make_bucket_view(bucket), make_bucket_view(encrypted));
+    return encrypted;
+}
+
+// Encrypts a bucket directly into `out`, normally a slot handed out by UntrustedMemory::bucket_slot.
+void Enclave::encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out, const BucketRange& at) {
+    if (bucket.size != out.size)
+        throw std::invalid_argument("encryptBucketInto: destination size does not match the bucket.");
+    for(int i = 0; i < bucket.size; i++) {
+        Element &elem = out[i];
+        elem = bucket[i];
         if(!elem.is_dummy) {
             elem.sorting = xor_encrypt_int(elem.sorting, encryption_key);
             elem.key = xor_encrypt_int(elem.key, encryption_key);
-            elem.payload = xor_encrypt_string(elem.payload, encryption_key);
         }
     }
-    return encrypted;
+    applyPayloadStream(out, at);
 }
 
 std::vector<Element> Enclave::decryptBucket(const std::vector<Element>& bucket) {
     return encryptBucket(bucket);
 }
 
+// Decrypts a bucket read through a view without copying the ciphertext first.
+std::vector<Element> Enclave::decryptBucket(BucketView<const Element> bucket, const BucketRange& at) {
+    std::vector<Element> decrypted(bucket.size);
+    encryptBucketInto(bucket, make_bucket_view(decrypted), at);
+    return decrypted;
+}
+
+// Bytes of a block as it crosses the enclave boundary.
+static size_t blockBytes(BucketView<const Element> block) {
+    size_t bytes = 0;
+    for (const auto& e : block)
+        bytes += elementBytes(e);
+    return bytes;
+}
+
+std::vector<std::vector<Element>> Enclave::loadBuckets(const std::vector<BucketRange>& ranges) {
+    std::vector<std::vector<Element>> blocks;
+    blocks.reserve(ranges.size());
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted = untrusted->read_buckets(batch);
+            for (size_t k = 0; k < batch.size(); k++) {
+                if (cost)
+                    crossed += blockBytes(make_bucket_view(encrypted[k]));
+                blocks.push_back(decryptBucket(make_bucket_view(encrypted[k]), batch[k]));
+            }
+        } else {
+            std::vector<BucketView<const Element>> views = untrusted->view_buckets(batch);
+            for (size_t k = 0; k < batch.size(); k++) {
+                if (cost)
+                    crossed += blockBytes(views[k]);
+                blocks.push_back(decryptBucket(views[k], batch[k]));
+            }
+        }
+        first = last;
+    }
+    if (cost)
+        cost->on_load(crossed);
+    return blocks;
+}
+
+void Enclave::storeBuckets(const std::vector<BucketRange>& ranges, const std::vector<BucketView<const Element>>& blocks) {
+    if (blocks.size() != ranges.size())
+        throw std::invalid_argument("storeBuckets: need one block per range.");
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted;
+            encrypted.reserve(batch.size());
+            for (size_t k = first; k < last; k++) {
+                encrypted.emplace_back(blocks[k].size);
+                encryptBucketInto(blocks[k], make_bucket_view(encrypted.back()), ranges[k]);
+                if (cost)
+                    crossed += blockBytes(make_bucket_view(encrypted.back()));
+            }
+            untrusted->write_buckets(batch, encrypted);
+        } else {
+            std::vector<BucketView<Element>> slots = untrusted->bucket_slots(batch);
+            for (size_t k = first; k < last; k++) {
+                encryptBucketInto(blocks[k], slots[k - first], ranges[k]);
+                if (cost)
+                    crossed += blockBytes(slots[k - first]);
+            }
+        }
+        first = last;
+    }
+    if (cost)
+        cost->on_store(crossed);
+}
+
 std::pair<int, int> Enclave::computeBucketParameters(int n, int Z) {
     int minimalB = static_cast<int>(std::ceil((2.0 * n) / Z));
     int safety_factor = 1;
@@ -70,12 +156,13 @@ std::pair<int, int> Enclave::computeBucketParameters(int n, int Z) {
 
 void Enclave::initializeBuckets(const std::vector<Element>& input_array, int B, int Z) {
     int n = input_array.size();
+    untrusted->allocate(B, Z);
     int group_size = (n + B - 1) / B;
     std::vector<Element> elements;
     std::uniform_int_distribution<int> key_dist(0, B - 1);
     for(const Element &elem : input_array) {
         int random_key = key_dist(rng);
-        elements.push_back(Element{ elem.sorting, elem.key,false,elem.payload });
+        elements.push_back(Element{ elem.sorting, random_key, false, elem.payload });
     }
     std::vector<std::vector<Element>> groups(B);
     for(int i = 0; i < B; i++){
@@ -86,24 +173,42 @@ void Enclave::initializeBuckets(const std::vector<Element>& input_array, int B,
         else
             groups[i] = std::vector<Element>();
     }
+    std::vector<BucketRange> ranges;
     for(int i = 0; i < B; i++){
-        std::vector<Element> bucket = groups[i];
-        while(bucket.size() < static_cast<size_t>(Z))
-            bucket.push_back(Element{0, 0,true,""});
-        untrusted->write_bucket(0, i, encryptBucket(bucket));
+        // Pad with dummy elements until bucket reaches size Z.
+        while(groups[i].size() < static_cast<size_t>(Z))
+            groups[i].push_back(Element{0, 0,true,""});
+        ranges.push_back(BucketRange{ 0, i, 0, Z });
     }
+    // Level 0 goes out in batches of transition_budget buckets.
+    storeBuckets(ranges, make_bucket_views(groups));
 }
 
 void Enclave::performButterflyNetwork(int B, int L, int Z) {
+    // Each batch loads whole bucket pairs in one call, merge-splits them and
+    // stores the results in one more call. The pairs and the key bit of each
+    // level come from the topology (see butterfly_topology.h).
+    ButterflyTopology topo(topology, L);
+    int pairs_per_batch = units_per_batch(transition_budget, 2, B / 2);
     for(int level = 0; level < L; level++){
-        for(int i = 0; i < B; i += 2){
-            std::vector<Element> bucket1 = untrusted->read_bucket(level, i);
-            std::vector<Element> bucket2 = untrusted->read_bucket(level, i+1);
-            bucket1 = decryptBucket(bucket1);
-            bucket2 = decryptBucket(bucket2);
-            auto buckets = merge_split(bucket1, bucket2, level, L, Z);
-            untrusted->write_bucket(level+1, i, encryptBucket(buckets.first));
-            untrusted->write_bucket(level+1, i+1, encryptBucket(buckets.second));
+        std::vector<ButterflyNode> nodes = topo.pairs(level);
+        for(size_t first = 0; first < nodes.size(); first += pairs_per_batch){
+            size_t last = std::min(nodes.size(), first + pairs_per_batch);
+            std::vector<BucketRange> in, out;
+            for(size_t k = first; k < last; k++)
+                for(int j = 0; j < 2; j++){
+                    in.push_back(BucketRange{ level, nodes[k].in[j], 0, Z });
+                    out.push_back(BucketRange{ level + 1, nodes[k].out[j], 0, Z });
+                }
+            std::vector<std::vector<Element>> buckets = loadBuckets(in);
+            std::vector<std::vector<Element>> results;
+            results.reserve(buckets.size());
+            for(size_t k = 0; k < buckets.size(); k += 2){
+                auto split = merge_split_on_bit(buckets[k], buckets[k + 1], topo.key_bit(level), Z);
+                results.push_back(std::move(split.first));
+                results.push_back(std::move(split.second));
+            }
+            storeBuckets(out, make_bucket_views(results));
         }
     }
 }
@@ -119,13 +224,18 @@ void Enclave::obliviousPermuteBucket(std::vector<Element>& bucket) {
 
 std::vector<Element> Enclave::extractFinalElements(int B, int L) {
     std::vector<Element> final_elements;
-    for(int i = 0; i < B; i++){
-        std::vector<Element> bucket = untrusted->read_bucket(L, i);
-        bucket = decryptBucket(bucket);
-        obliviousPermuteBucket(bucket);
-        for(const auto &elem : bucket)
-            if(!elem.is_dummy)
-                final_elements.push_back(elem);
+    int Z = untrusted->bucket_size();
+    int per_batch = units_per_batch(transition_budget, 1, B);
+    for(int first = 0; first < B; first += per_batch){
+        std::vector<BucketRange> ranges;
+        for(int i = first; i < std::min(B, first + per_batch); i++)
+            ranges.push_back(BucketRange{ L, i, 0, Z });
+        for(auto& bucket : loadBuckets(ranges)){
+            obliviousPermuteBucket(bucket);
+            for(const auto &elem : bucket)
+                if(!elem.is_dummy)
+                    final_elements.push_back(elem);
+        }
     }
     return final_elements;
 }
@@ -143,9 +253,22 @@ std::vector<Element> Enclave::oblivious_sort(const std::vector<Element>& input_a
     int Z = bucket_size;
     auto params = computeBucketParameters(n, Z);
     int B = params.first, L = params.second;
-    initializeBuckets(input_array, B, Z);
-    performButterflyNetwork(B, L, Z);
-    std::vector<Element> final_elements = extractFinalElements(B, L);
+    // Input and output both stay resident in the enclave.
+    size_t data_bytes = cost ? blockBytes(make_bucket_view(input_array)) : 0;
+    {
+        CostPhase phase(cost, "initialize", untrusted->transitions, data_bytes);
+        initializeBuckets(input_array, B, Z);
+    }
+    {
+        CostPhase phase(cost, "butterfly", untrusted->transitions);
+        performButterflyNetwork(B, L, Z);
+    }
+    std::vector<Element> final_elements;
+    {
+        CostPhase phase(cost, "extract", untrusted->transitions, data_bytes);
+        final_elements = extractFinalElements(B, L);
+    }
+    CostPhase phase(cost, "final sort", untrusted->transitions, 2 * data_bytes);
     return finalSort(final_elements);
 }
 
@@ -153,9 +276,14 @@ std::pair<std::vector<Element>, std::vector<Element>> Enclave::merge_split(
     const std::vector<Element>& bucket1,
     const std::vector<Element>& bucket2,
     int level, int total_levels, int Z) {
+    return merge_split_on_bit(bucket1, bucket2, total_levels - 1 - level, Z);
+}
+
+std::pair<std::vector<Element>, std::vector<Element>> Enclave::merge_split_on_bit(
+    const std::vector<Element>& bucket1,
+    const std::vector<Element>& bucket2,
+    int bit_index, int Z) {
     
-    int L = total_levels;
-    int bit_index = L - 1 - level;
     std::vector<Element> combined = bucket1;
     combined.insert(combined.end(), bucket2.begin(), bucket2.end());
     std::vector<Element> out_bucket0, out_bucket1;
@@ -2,13 +2,16 @@
 #define OBLIVIOUS_SORT_MERGE_H
 
 #include <vector>
-#include <map>
 #include <string>
 #include <stdexcept>
 #include <random>
 #include <algorithm>
 #include <utility>
 
+#include "untrusted_memory.h"
+#include "enclave_cost.h"
+#include "butterfly_topology.h"
+
 struct Element {
     int sorting;        // Numeric sorting column.
     int key;
@@ -16,26 +19,40 @@ struct Element {
     std::string payload; // Variable-length payload.
 };
 
-class UntrustedMemory {
-public:
-    std::map<std::pair<int, int>, std::vector<Element>> storage;
-    std::vector<std::string> access_log;
-
-    std::vector<Element> read_bucket(int level, int bucket_index);
-    void write_bucket(int level, int bucket_index, const std::vector<Element>& bucket);
-    std::vector<std::string> get_access_log();
-};
+typedef UntrustedBuckets<Element, XorRecords<Element>> UntrustedMemory;
 
 class Enclave {
 public:
     UntrustedMemory* untrusted;
     std::mt19937 rng;
+    // Most bucket ranges per call into untrusted memory (<= 0: no limit). Bigger
+    // batches mean fewer transitions but more buckets held in the enclave.
+    int transition_budget = 16;
+    // Which buckets each level merge-splits and where the halves go (see
+    // butterfly_topology.h).
+    TopologyKind topology = TopologyKind::InPlace;
+    // Optional boundary cost accounting per phase (see enclave_cost.h).
+    EnclaveCostSimulator* cost = nullptr;
 
     static constexpr int encryption_key = 0xdeadbeef;
 
     Enclave(UntrustedMemory* u);
+    // Bytes of a backend record for payloads of up to max_payload bytes
+    // (see UntrustedMemory::use_backend).
+    static size_t recordBytes(size_t max_payload) { return XorRecords<Element>::size(max_payload); }
     static std::vector<Element> encryptBucket(const std::vector<Element>& bucket);
     static std::vector<Element> decryptBucket(const std::vector<Element>& bucket);
+    // View-based variants: decrypt straight out of untrusted storage and
+    // encrypt straight into a destination slot.
+    // `at` is where the bucket is stored; it picks the payload keystream offset.
+    static std::vector<Element> decryptBucket(BucketView<const Element> bucket, const BucketRange& at = BucketRange());
+    static void encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out,
+                                  const BucketRange& at = BucketRange());
+    // Decrypt ranges from / encrypt ranges into untrusted memory (through views
+    // when storage is in memory, through the backend otherwise), in calls of at
+    // most transition_budget ranges each.
+    std::vector<std::vector<Element>> loadBuckets(const std::vector<BucketRange>& ranges);
+    void storeBuckets(const std::vector<BucketRange>& ranges, const std::vector<BucketView<const Element>>& blocks);
 
     std::pair<int, int> computeBucketParameters(int n, int Z);
     void initializeBuckets(const std::vector<Element>& input_array, int B, int Z);
@@ -49,6 +66,12 @@ public:
         const std::vector<Element>& bucket1,
         const std::vector<Element>& bucket2,
         int level, int total_levels, int Z);
+    // merge_split on key bit `bit_index` instead of L-1-level. Keys are left
+    // intact, so later levels can route on them.
+    std::pair<std::vector<Element>, std::vector<Element>> merge_split_on_bit(
+        const std::vector<Element>& bucket1,
+        const std::vector<Element>& bucket2,
+        int bit_index, int Z);
     void obliviousPermuteBucket(std::vector<Element>& bucket);
 };
 
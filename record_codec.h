@@ -0,0 +1,118 @@
+#ifndef RECORD_CODEC_H
+#define RECORD_CODEC_H
+
+#include <string>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include "bucket_view.h"
+
+/*
+ * RecordCodec:
+ * The fixed-width binary record of the AES variants, written and read in
+ * place in a caller's bucket buffer:
+ *     sorting (4) | key (4) | is_dummy (1) | payload length (4) | payload | zero padding
+ * Record i of a bucket lives at buffer + i * width(). encode() and decode()
+ * never allocate: encode copies the fields into the record, decode returns
+ * them with a PayloadView into the buffer, valid as long as the buffer is.
+ * decodeInto() fills an element and reuses the capacity of its payload string.
+ *
+ * The element type is any struct with the members sorting, key, is_dummy and
+ * payload (a std::string), as in oblivious_sort_{two,merge,constant}.h.
+ */
+struct PayloadView {
+    const char* data;
+    size_t size;
+
+    bool empty() const { return size == 0; }
+    std::string str() const { return std::string(data, size); }
+};
+
+struct RecordFields {
+    int sorting;
+    int key;
+    bool is_dummy;
+    PayloadView payload;
+};
+
+class RecordCodec {
+public:
+    static const size_t kHeaderBytes = 2 * sizeof(int) + sizeof(char) + sizeof(uint32_t);
+
+    // Throws std::invalid_argument if `width` cannot hold a header.
+    explicit RecordCodec(size_t width) : record_width(width) {
+        if (width < kHeaderBytes)
+            throw std::invalid_argument("RecordCodec: record width smaller than the header.");
+    }
+
+    size_t width() const { return record_width; }
+    // Largest payload a record holds.
+    size_t capacity() const { return record_width - kHeaderBytes; }
+
+    // The header alone, for records whose payload is written separately.
+    static void encodeHeader(char* out, int sorting, int key, bool is_dummy, uint32_t payload_size) {
+        char flag = is_dummy ? 1 : 0;
+        std::memcpy(out, &sorting, sizeof(int));
+        std::memcpy(out + sizeof(int), &key, sizeof(int));
+        std::memcpy(out + 2 * sizeof(int), &flag, sizeof(flag));
+        std::memcpy(out + 2 * sizeof(int) + 1, &payload_size, sizeof(payload_size));
+    }
+
+    // Reads a header; returns the payload length.
+    static uint32_t decodeHeader(const char* in, int& sorting, int& key, bool& is_dummy) {
+        char flag;
+        uint32_t payload_size;
+        std::memcpy(&sorting, in, sizeof(int));
+        std::memcpy(&key, in + sizeof(int), sizeof(int));
+        std::memcpy(&flag, in + 2 * sizeof(int), sizeof(flag));
+        std::memcpy(&payload_size, in + 2 * sizeof(int) + 1, sizeof(payload_size));
+        is_dummy = flag != 0;
+        return payload_size;
+    }
+
+    // Writes `e` into the width() bytes at `record`, zero-padded. Throws
+    // std::length_error if the payload does not fit.
+    template <typename E>
+    void encode(const E& e, char* record) const {
+        size_t size = e.payload.size();
+        if (size > capacity())
+            throw std::length_error("RecordCodec: payload does not fit the record width.");
+        encodeHeader(record, e.sorting, e.key, e.is_dummy, static_cast<uint32_t>(size));
+        std::memcpy(record + kHeaderBytes, e.payload.data(), size);
+        std::memset(record + kHeaderBytes + size, 0, capacity() - size);
+    }
+
+    // Encodes every element of `bucket` into `buffer` (bucket.size * width() bytes).
+    template <typename E>
+    void encodeBucket(BucketView<const E> bucket, char* buffer) const {
+        for (int i = 0; i < bucket.size; i++)
+            encode(bucket[i], buffer + i * record_width);
+    }
+
+    // The fields of the record at `record`. Throws std::out_of_range if its
+    // payload length runs past the record.
+    RecordFields decode(const char* record) const {
+        RecordFields f;
+        uint32_t size = decodeHeader(record, f.sorting, f.key, f.is_dummy);
+        if (size > capacity())
+            throw std::out_of_range("RecordCodec: payload length runs past the record.");
+        f.payload = PayloadView{ record + kHeaderBytes, size };
+        return f;
+    }
+
+    template <typename E>
+    void decodeInto(const char* record, E& e) const {
+        RecordFields f = decode(record);
+        e.sorting = f.sorting;
+        e.key = f.key;
+        e.is_dummy = f.is_dummy;
+        e.payload.assign(f.payload.data, f.payload.size);
+    }
+
+private:
+    size_t record_width;
+};
+
+#endif // RECORD_CODEC_H
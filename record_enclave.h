@@ -0,0 +1,345 @@
+#ifndef RECORD_ENCLAVE_H
+#define RECORD_ENCLAVE_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#include "untrusted_memory.h"
+#include "bucket_batch.h"
+#include "bucket_cipher.h"
+#include "cipher_policy.h"
+#include "record_codec.h"
+#include "enclave_cost.h"
+#include "thread_pool.h"
+
+/*
+ * RecordEnclave:
+ * The encrypted-record I/O shared by the two, merge and constant butterflies;
+ * each variant's Enclave derives from it and adds its butterfly. Element is
+ * the variant's element type (any struct with sorting, key, is_dummy and a
+ * std::string payload, see record_codec.h). Cipher is a cipher policy
+ * (cipher_policy.h): BucketCipher's AES-CTR/GCM by default, or the XOR
+ * keystream of xortwo, which is Enclave<XorPolicy> of oblivious_sort_two.
+ *
+ * An element is stored as one fixed-width RecordCodec record encrypted with
+ * the enclave's cipher: its blob is the write epoch, the GCM tag of the
+ * range on the range's first record, then the ciphertext. encryptBucketInto/
+ * decryptBucket handle one range; loadBuckets/storeBuckets batch ranges into
+ * calls of at most transition_budget ranges and run their cipher work on
+ * crypto_threads threads of the enclave's pool. The key, the record format
+ * and the run are all the enclave's own, so several enclaves can sort at once.
+ */
+template <typename Element, typename Cipher = AesCtrPolicy>
+class RecordEnclave {
+public:
+    typedef UntrustedBuckets<Element, SealedRecords<Element>> Memory;
+
+    Memory* untrusted;
+    // Most bucket ranges per call into untrusted memory (<= 0: no limit). Bigger
+    // batches mean fewer transitions but more buckets held in the enclave.
+    int transition_budget = 16;
+    // Threads that decrypt or encrypt the ranges of one such call in parallel,
+    // each on its own pooled cipher context. Ciphertexts differ from a serial
+    // run only in their epochs; the sort output is the same.
+    int crypto_threads = 1;
+    // Optional boundary cost accounting per phase (see enclave_cost.h).
+    EnclaveCostSimulator* cost = nullptr;
+
+    // Width in bytes of every encrypted record: serialized header, payload and
+    // zero padding, so all ciphertexts have the same length. 0 (the default)
+    // picks the smallest width that fits the input given to beginRun.
+    size_t record_size = 0;
+    // CTR (the default) or GCM: seal every stored range with one tag and
+    // verify it on load, so tampering with untrusted memory is detected.
+    RecordMode record_mode = RecordMode::CTR;
+    // The sort's key and its pool of keyed contexts. With AesCtrPolicy,
+    // cipher.use() picks the keystream of CTR records: AES (the default) or
+    // ChaCha20, for CPUs without AES-NI. GCM needs AES.
+    Cipher cipher;
+
+    // Record width needed for payloads of up to max_payload bytes.
+    static size_t recordSizeFor(size_t max_payload) {
+        return RecordCodec::kHeaderBytes + max_payload;
+    }
+    // Bytes of a backend record (see Memory::use_backend): epoch, GCM tag
+    // room and the encrypted record.
+    size_t recordBytes(size_t max_payload) const {
+        return kEpochBytes + (record_mode == RecordMode::GCM ? BucketCipher::kTagBytes : 0) +
+               std::max(record_size, recordSizeFor(max_payload));
+    }
+
+    std::vector<Element> encryptBucket(const std::vector<Element>& bucket, const BucketRange& at = BucketRange()) {
+        std::vector<Element> encrypted(bucket.size());
+        encryptBucketInto(make_bucket_view(bucket), make_bucket_view(encrypted), at);
+        return encrypted;
+    }
+    std::vector<Element> decryptBucket(const std::vector<Element>& bucket, const BucketRange& at = BucketRange()) {
+        return decryptBucket(make_bucket_view(bucket), at);
+    }
+    // View-based variants: decrypt straight out of untrusted storage and
+    // encrypt straight into a destination slot. `at` is where the records sit
+    // in untrusted memory; it seeds their nonces (see bucket_cipher.h), so
+    // records are decrypted at the position they were encrypted for. `pass`
+    // counts the earlier writes of the range in this run; GCM records only
+    // open at the pass they were sealed for, so an older copy is rejected.
+    // Both use the run, record width and mode of the current sort.
+    std::vector<Element> decryptBucket(BucketView<const Element> bucket, const BucketRange& at = BucketRange(),
+                                       uint32_t pass = 0);
+    void encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out,
+                           const BucketRange& at = BucketRange(), uint32_t pass = 0);
+    // Decrypt ranges from / encrypt ranges into untrusted memory (through views
+    // when storage is in memory, through the backend otherwise), in calls of at
+    // most transition_budget ranges each. Every range of a call is at `pass`.
+    std::vector<std::vector<Element>> loadBuckets(const std::vector<BucketRange>& ranges, uint32_t pass = 0);
+    void storeBuckets(const std::vector<BucketRange>& ranges, const std::vector<BucketView<const Element>>& blocks,
+                      uint32_t pass = 0);
+
+protected:
+    explicit RecordEnclave(Memory* u) : untrusted(u) {}
+    virtual ~RecordEnclave() {}
+
+    // Starts a sort of `input`: fixes the record width for its longest
+    // payload and takes a fresh run id for the nonces. Throws if the payloads
+    // do not fit record_size or GCM is asked for without AES.
+    void beginRun(const std::vector<Element>& input);
+    // Threads of the pool, the caller included; loadBuckets/storeBuckets use
+    // crypto_threads of them.
+    virtual int poolThreads() const { return crypto_threads; }
+    // The pool, (re)built on first use with poolThreads() threads and kept
+    // across levels.
+    ThreadPool& threadPool();
+    // Width every record of `bucket` is padded to: the record width of the
+    // current sort, or the widest serialized element when none is set.
+    size_t bucketRecordWidth(BucketView<const Element> bucket) const;
+    size_t recordWidth() const {
+        return active_record_size != 0 ? active_record_size : record_size;
+    }
+    // Bytes of a block as it crosses the enclave boundary.
+    static size_t blockBytes(BucketView<const Element> block) {
+        size_t bytes = 0;
+        for (const auto& e : block)
+            bytes += SealedRecords<Element>::bytes(e);
+        return bytes;
+    }
+
+    // Held around every call into untrusted memory and the cost accounting
+    // in loadBuckets/storeBuckets, which may be made from several threads.
+    std::mutex boundary;
+
+private:
+    static const size_t kEpochBytes = sizeof(uint32_t);
+
+    // Run id of the current sort (taken by beginRun); with the position and
+    // the epoch stored in front of each blob it gives the nonce.
+    uint32_t run = 0;
+    // Record width chosen by beginRun for the current sort (see record_size).
+    size_t active_record_size = 0;
+    std::unique_ptr<ThreadPool> pool;
+};
+
+template <typename Element, typename Cipher>
+void RecordEnclave<Element, Cipher>::beginRun(const std::vector<Element>& input) {
+    size_t max_payload = 0;
+    for (const Element& elem : input)
+        max_payload = std::max(max_payload, elem.payload.size());
+    if (record_size != 0 && record_size < recordSizeFor(max_payload))
+        throw std::length_error("initializeBuckets: payloads do not fit the configured record size.");
+    active_record_size = record_size != 0 ? record_size : recordSizeFor(max_payload);
+    if (record_mode == RecordMode::GCM && !cipher.seals())
+        throw std::invalid_argument("initializeBuckets: GCM records need the AES stream cipher.");
+    run = cipher.new_run();
+}
+
+template <typename Element, typename Cipher>
+ThreadPool& RecordEnclave<Element, Cipher>::threadPool() {
+    int threads = std::max(1, poolThreads());
+    if (!pool || pool->size() != threads)
+        pool.reset(new ThreadPool(threads));
+    return *pool;
+}
+
+template <typename Element, typename Cipher>
+size_t RecordEnclave<Element, Cipher>::bucketRecordWidth(BucketView<const Element> bucket) const {
+    size_t width = recordWidth();
+    if (width == 0)
+        for (const auto& e : bucket)
+            width = std::max(width, RecordCodec::kHeaderBytes + e.payload.size());
+    return std::max(width, RecordCodec::kHeaderBytes);
+}
+
+// Encrypts a bucket (or a block of one) directly into `out`, normally a slot
+// handed out by UntrustedMemory. The records are serialized back to back into
+// one buffer and encrypted in a single pass under a nonce derived from `at`
+// and a fresh write epoch (see bucket_cipher.h); each blob is prefixed by
+// that epoch. In GCM mode the range is sealed and its tag follows the first
+// record's epoch.
+template <typename Element, typename Cipher>
+void RecordEnclave<Element, Cipher>::encryptBucketInto(BucketView<const Element> bucket, BucketView<Element> out,
+                                                       const BucketRange& at, uint32_t pass) {
+    if (bucket.size != out.size)
+        throw std::invalid_argument("encryptBucketInto: destination size does not match the bucket.");
+    size_t width = bucketRecordWidth(bucket);
+    // The complete Elements (all fields), each padded to the record width.
+    std::string buffer(width * bucket.size, '\0');
+    RecordCodec(width).encodeBucket(bucket, &buffer[0]);
+    uint32_t epoch = cipher.new_epoch();
+    CtrNonce nonce{ run, epoch, at.level, at.bucket };
+    typename Cipher::Lease context = cipher.lease();
+    // GCM: the range's one tag rides on its first record.
+    std::string tag;
+    if (record_mode == RecordMode::GCM) {
+        tag.resize(BucketCipher::kTagBytes);
+        context.seal(buffer, nonce, at.offset, bucket.size, pass, reinterpret_cast<uint8_t*>(&tag[0]));
+    } else {
+        context.process(buffer, nonce, static_cast<uint64_t>(at.offset) * width);
+    }
+    for (int i = 0; i < bucket.size; i++) {
+        Element& elem = out[i];
+        // Overwrite the cleartext fields to prevent leakage.
+        elem.sorting = 0;
+        elem.key = 0;
+        elem.is_dummy = false; // The true flag is now hidden in the blob.
+        elem.payload.assign(reinterpret_cast<const char*>(&epoch), kEpochBytes);
+        if (i == 0)
+            elem.payload.append(tag);
+        elem.payload.append(buffer, i * width, width);
+    }
+}
+
+// Decrypts a bucket (or a block of one) read through a view from position
+// `at`: the ciphertexts are joined into one buffer and decrypted with one pass
+// per run of records that share a write epoch (normally the whole range), or
+// verified and decrypted as one sealed range in GCM mode.
+template <typename Element, typename Cipher>
+std::vector<Element> RecordEnclave<Element, Cipher>::decryptBucket(BucketView<const Element> bucket,
+                                                                   const BucketRange& at, uint32_t pass) {
+    std::vector<Element> decrypted;
+    if (bucket.empty())
+        return decrypted;
+    bool sealed = record_mode == RecordMode::GCM;
+    size_t head = kEpochBytes + (sealed ? BucketCipher::kTagBytes : 0);
+    if (bucket[0].payload.size() < head)
+        throw std::runtime_error("decryptBucket: record too short to hold its epoch.");
+    size_t width = bucket[0].payload.size() - head;
+    if (width < RecordCodec::kHeaderBytes)
+        throw std::runtime_error("decryptBucket: record too short to hold a header.");
+    std::string buffer;
+    std::vector<uint32_t> epochs(bucket.size);
+    buffer.reserve(width * bucket.size);
+    for (int i = 0; i < bucket.size; i++) {
+        const std::string& blob = bucket[i].payload;
+        size_t skip = i == 0 ? head : kEpochBytes;
+        if (blob.size() != skip + width)
+            throw std::runtime_error("decryptBucket: records do not have a fixed width.");
+        std::memcpy(&epochs[i], blob.data(), kEpochBytes);
+        buffer.append(blob, skip, width);
+    }
+    typename Cipher::Lease context = cipher.lease();
+    if (sealed) {
+        // One tag check for the whole range, which must be exactly one sealed range.
+        bool ok = std::all_of(epochs.begin(), epochs.end(), [&](uint32_t e) { return e == epochs[0]; }) &&
+                  context.open(buffer, CtrNonce{ run, epochs[0], at.level, at.bucket }, at.offset,
+                              bucket.size, pass, reinterpret_cast<const uint8_t*>(bucket[0].payload.data() + kEpochBytes));
+        if (!ok)
+            throw std::runtime_error("decryptBucket: authentication failed for level " + std::to_string(at.level) +
+                                     " bucket " + std::to_string(at.bucket) + ".");
+    }
+    for (int i = 0, j; !sealed && i < bucket.size; i = j) {
+        for (j = i + 1; j < bucket.size && epochs[j] == epochs[i]; j++) {}
+        context.process(reinterpret_cast<uint8_t*>(&buffer[i * width]), (j - i) * width,
+                        CtrNonce{ run, epochs[i], at.level, at.bucket },
+                        static_cast<uint64_t>(at.offset + i) * width);
+    }
+    RecordCodec codec(width);
+    decrypted.resize(bucket.size);
+    for (int i = 0; i < bucket.size; i++)
+        codec.decodeInto(&buffer[i * width], decrypted[i]);
+    return decrypted;
+}
+
+template <typename Element, typename Cipher>
+std::vector<std::vector<Element>> RecordEnclave<Element, Cipher>::loadBuckets(
+    const std::vector<BucketRange>& ranges, uint32_t pass) {
+    std::vector<std::vector<Element>> blocks;
+    blocks.reserve(ranges.size());
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        std::vector<BucketView<const Element>> views;
+        std::vector<std::vector<Element>> encrypted;
+        {
+            std::lock_guard<std::mutex> lock(boundary);
+            if (untrusted->has_backend()) {
+                encrypted = untrusted->read_buckets(batch);
+                views = make_bucket_views(encrypted);
+            } else {
+                views = untrusted->view_buckets(batch);
+            }
+        }
+        // Ranges decrypt independently, each on a pooled cipher context.
+        size_t base = blocks.size();
+        blocks.resize(base + views.size());
+        threadPool().run(views.size(), crypto_threads, [&](size_t k, int) {
+            blocks[base + k] = decryptBucket(views[k], batch[k], pass);
+        });
+        if (cost)
+            for (const auto& view : views)
+                crossed += blockBytes(view);
+        first = last;
+    }
+    if (cost) {
+        std::lock_guard<std::mutex> lock(boundary);
+        cost->on_load(crossed);
+    }
+    return blocks;
+}
+
+template <typename Element, typename Cipher>
+void RecordEnclave<Element, Cipher>::storeBuckets(const std::vector<BucketRange>& ranges,
+                                                  const std::vector<BucketView<const Element>>& blocks, uint32_t pass) {
+    if (blocks.size() != ranges.size())
+        throw std::invalid_argument("storeBuckets: need one block per range.");
+    size_t crossed = 0;
+    for (size_t first = 0; first < ranges.size(); ) {
+        size_t last = batch_end(first, ranges.size(), transition_budget);
+        std::vector<BucketRange> batch(ranges.begin() + first, ranges.begin() + last);
+        if (untrusted->has_backend()) {
+            std::vector<std::vector<Element>> encrypted(batch.size());
+            threadPool().run(batch.size(), crypto_threads, [&](size_t k, int) {
+                encrypted[k].resize(blocks[first + k].size);
+                encryptBucketInto(blocks[first + k], make_bucket_view(encrypted[k]), ranges[first + k], pass);
+            });
+            if (cost)
+                for (const auto& block : encrypted)
+                    crossed += blockBytes(make_bucket_view(block));
+            std::lock_guard<std::mutex> lock(boundary);
+            untrusted->write_buckets(batch, encrypted);
+        } else {
+            std::vector<BucketView<Element>> slots;
+            {
+                std::lock_guard<std::mutex> lock(boundary);
+                slots = untrusted->bucket_slots(batch);
+            }
+            threadPool().run(slots.size(), crypto_threads, [&](size_t k, int) {
+                encryptBucketInto(blocks[first + k], slots[k], ranges[first + k], pass);
+            });
+            if (cost)
+                for (const auto& slot : slots)
+                    crossed += blockBytes(slot);
+        }
+        first = last;
+    }
+    if (cost) {
+        std::lock_guard<std::mutex> lock(boundary);
+        cost->on_store(crossed);
+    }
+}
+
+#endif // RECORD_ENCLAVE_H
@@ -0,0 +1,476 @@
+#include "storage_backend.h"
+
+#include <map>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+// ----- StorageBackend -----
+
+void StorageBackend::check_slots(int bucket_index, int offset, int count) const {
+    if (B == 0)
+        throw std::logic_error(name() + " backend: allocate() has not been called.");
+    if (bucket_index < 0 || bucket_index >= B)
+        throw std::out_of_range(name() + " backend: bucket index " + std::to_string(bucket_index) + " out of range.");
+    if (offset < 0 || count < 0 || offset + count > Z)
+        throw std::out_of_range(name() + " backend: slots do not fit in the bucket.");
+}
+
+// ----- MemoryBackend -----
+
+void MemoryBackend::allocate(int num_buckets, int bucket_size, size_t) {
+    arena.reset(num_buckets, bucket_size);
+    B = num_buckets;
+    Z = bucket_size;
+}
+
+void MemoryBackend::read_slots(int level, int bucket_index, int offset, int count, std::vector<std::string>& records) {
+    check_slots(bucket_index, offset, count);
+    const std::string* slot = arena.read_slot(level, bucket_index) + offset;
+    records.assign(slot, slot + count);
+    counters.requests++;
+    for (const auto& r : records)
+        counters.bytes_read += r.size();
+}
+
+void MemoryBackend::write_slots(int level, int bucket_index, int offset, const std::vector<std::string>& records) {
+    int count = static_cast<int>(records.size());
+    check_slots(bucket_index, offset, count);
+    std::string* slot = arena.write_slot(level, bucket_index) + offset;
+    for (int s = 0; s < count; s++) {
+        slot[s] = records[s];
+        counters.bytes_written += records[s].size();
+    }
+    counters.requests++;
+}
+
+// ----- MappedBackend -----
+
+void MappedBackend::allocate(int num_buckets, int bucket_size, size_t record_bytes) {
+    file.open(file_path, num_buckets, bucket_size, record_bytes);
+    B = num_buckets;
+    Z = bucket_size;
+}
+
+void MappedBackend::read_slots(int level, int bucket_index, int offset, int count, std::vector<std::string>& records) {
+    check_slots(bucket_index, offset, count);
+    records.resize(count);
+    for (int s = 0; s < count; s++) {
+        size_t len;
+        const char* data = file.read_record(level, bucket_index, offset + s, len);
+        records[s].assign(data, len);
+        counters.bytes_read += len;
+    }
+    counters.requests++;
+    if (offset + count == Z)
+        file.finished_reading(level, bucket_index);
+}
+
+void MappedBackend::write_slots(int level, int bucket_index, int offset, const std::vector<std::string>& records) {
+    int count = static_cast<int>(records.size());
+    check_slots(bucket_index, offset, count);
+    for (int s = 0; s < count; s++) {
+        file.write_record(level, bucket_index, offset + s, records[s].data(), records[s].size());
+        counters.bytes_written += records[s].size();
+    }
+    counters.requests++;
+    if (offset + count == Z)
+        file.finished_writing(level, bucket_index);
+}
+
+// ----- Remote protocol -----
+// Every request is a fixed header, followed for WRITE by `count` records
+// (4-byte length + bytes). Every reply starts with a 4-byte status; a READ
+// reply then carries `count` records, an error reply a message.
+namespace {
+    enum RemoteOp : uint32_t {
+        OP_ALLOCATE = 1,
+        OP_READ = 2,
+        OP_WRITE = 3,
+        OP_SHUTDOWN = 4
+    };
+
+    struct RequestHeader {
+        uint32_t op;
+        int32_t level;
+        int32_t bucket;
+        int32_t offset;
+        int32_t count;
+        uint32_t reserved;
+        uint64_t record_bytes; // OP_ALLOCATE only.
+    };
+
+    const uint32_t kStatusOk = 0;
+    const uint32_t kStatusError = 1;
+
+    std::runtime_error socketError(const std::string& what) {
+        return std::runtime_error("RemoteBackend: " + what + ": " + std::strerror(errno));
+    }
+
+    // Returns false on a clean EOF before the first byte.
+    bool recvAll(int fd, void* buf, size_t len) {
+        char* p = static_cast<char*>(buf);
+        size_t got = 0;
+        while (got < len) {
+            ssize_t n = ::recv(fd, p + got, len - got, 0);
+            if (n == 0) {
+                if (got == 0)
+                    return false;
+                throw std::runtime_error("RemoteBackend: connection closed mid-message.");
+            }
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw socketError("recv");
+            }
+            got += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void sendAll(int fd, const void* buf, size_t len) {
+        const char* p = static_cast<const char*>(buf);
+        while (len > 0) {
+            ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw socketError("send");
+            }
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+    }
+
+    void appendRecord(std::string& out, const std::string& record) {
+        uint32_t len = static_cast<uint32_t>(record.size());
+        out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        out.append(record);
+    }
+
+    void recvRecords(int fd, int count, std::vector<std::string>& records, uint64_t& bytes) {
+        records.resize(count);
+        for (int s = 0; s < count; s++) {
+            uint32_t len;
+            if (!recvAll(fd, &len, sizeof(len)))
+                throw std::runtime_error("RemoteBackend: connection closed mid-message.");
+            records[s].resize(len);
+            if (len > 0 && !recvAll(fd, &records[s][0], len))
+                throw std::runtime_error("RemoteBackend: connection closed mid-message.");
+            bytes += sizeof(len) + len;
+        }
+    }
+
+    void checkReply(int fd) {
+        uint32_t status;
+        if (!recvAll(fd, &status, sizeof(status)))
+            throw std::runtime_error("RemoteBackend: storage server closed the connection.");
+        if (status == kStatusOk)
+            return;
+        uint32_t len;
+        recvAll(fd, &len, sizeof(len));
+        std::string message(len, '\0');
+        if (len > 0)
+            recvAll(fd, &message[0], len);
+        throw std::runtime_error("RemoteBackend: server error: " + message);
+    }
+
+    void setNoDelay(int fd) {
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    // Storage of the server process, the C++ twin of client_server.py's Server:
+    // buckets keyed by (level, bucket_index).
+    class ServerState {
+    public:
+        explicit ServerState(const RemoteLink& l) : link(l), Z(0) {}
+
+        // Handles one request; returns false when the client asked to shut down.
+        bool serve(int fd, const RequestHeader& req, uint64_t& traffic) {
+            std::string reply;
+            uint32_t ok = kStatusOk;
+            try {
+                switch (req.op) {
+                case OP_ALLOCATE:
+                    storage.clear();
+                    Z = req.count;
+                    reply.append(reinterpret_cast<const char*>(&ok), sizeof(ok));
+                    break;
+                case OP_READ: {
+                    auto it = storage.find(std::make_pair(req.level, req.bucket));
+                    if (it == storage.end())
+                        throw std::out_of_range("bucket (" + std::to_string(req.level) + ", " +
+                                                std::to_string(req.bucket) + ") was never written");
+                    checkRange(req);
+                    reply.append(reinterpret_cast<const char*>(&ok), sizeof(ok));
+                    for (int s = 0; s < req.count; s++)
+                        appendRecord(reply, it->second[req.offset + s]);
+                    break;
+                }
+                case OP_WRITE: {
+                    std::vector<std::string> records;
+                    recvRecords(fd, req.count, records, traffic);
+                    checkRange(req);
+                    std::vector<std::string>& bucket = storage[std::make_pair(req.level, req.bucket)];
+                    bucket.resize(Z);
+                    for (int s = 0; s < req.count; s++)
+                        bucket[req.offset + s].swap(records[s]);
+                    reply.append(reinterpret_cast<const char*>(&ok), sizeof(ok));
+                    break;
+                }
+                case OP_SHUTDOWN:
+                    reply.append(reinterpret_cast<const char*>(&ok), sizeof(ok));
+                    sendAll(fd, reply.data(), reply.size());
+                    return false;
+                default:
+                    throw std::invalid_argument("unknown request " + std::to_string(req.op));
+                }
+            } catch (const std::runtime_error&) {
+                throw; // Connection problems end the session.
+            } catch (const std::exception& e) {
+                reply.clear();
+                uint32_t err = kStatusError;
+                std::string message = e.what();
+                reply.append(reinterpret_cast<const char*>(&err), sizeof(err));
+                appendRecord(reply, message);
+            }
+            traffic += sizeof(req) + reply.size();
+            delay(traffic);
+            sendAll(fd, reply.data(), reply.size());
+            return true;
+        }
+
+    private:
+        void checkRange(const RequestHeader& req) const {
+            if (req.offset < 0 || req.count < 0 || req.offset + req.count > Z)
+                throw std::out_of_range("slots do not fit in the bucket");
+        }
+
+        // Per-request latency plus the time the bytes take on the simulated link.
+        void delay(uint64_t bytes) const {
+            double ms = link.latency_ms;
+            if (link.bandwidth_mbps > 0)
+                ms += static_cast<double>(bytes) / (link.bandwidth_mbps * 1e6) * 1e3;
+            if (ms > 0)
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(ms));
+        }
+
+        RemoteLink link;
+        int Z;
+        std::map<std::pair<int, int>, std::vector<std::string>> storage;
+    };
+} // anonymous namespace
+
+void run_storage_server(int listen_fd, const RemoteLink& link, bool once) {
+    ServerState state(link);
+    for (;;) {
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            throw socketError("accept");
+        }
+        setNoDelay(fd);
+        bool keep_running = true;
+        try {
+            RequestHeader req;
+            while (keep_running && recvAll(fd, &req, sizeof(req))) {
+                uint64_t traffic = 0;
+                keep_running = state.serve(fd, req, traffic);
+            }
+        } catch (const std::exception&) {
+            // Drop the client; the server keeps running for the next one.
+        }
+        ::close(fd);
+        if (!keep_running || once)
+            return;
+    }
+}
+
+// ----- RemoteBackend -----
+
+RemoteBackend::RemoteBackend(const std::string& host, int port) : sock(-1), server_pid(-1) {
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addrs = nullptr;
+    std::string service = std::to_string(port);
+    if (::getaddrinfo(host.c_str(), service.c_str(), &hints, &addrs) != 0)
+        throw std::runtime_error("RemoteBackend: cannot resolve " + host);
+    for (addrinfo* a = addrs; a != nullptr && sock < 0; a = a->ai_next) {
+        int fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+            sock = fd;
+        else
+            ::close(fd);
+    }
+    ::freeaddrinfo(addrs);
+    if (sock < 0)
+        throw socketError("cannot connect to " + host + ":" + service);
+    setNoDelay(sock);
+}
+
+std::unique_ptr<RemoteBackend> RemoteBackend::spawn(const RemoteLink& link) {
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        throw socketError("socket");
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0; // Any free port.
+    socklen_t addr_len = sizeof(addr);
+    if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listen_fd, 1) != 0 ||
+        ::getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+        std::runtime_error err = socketError("cannot listen on loopback");
+        ::close(listen_fd);
+        throw err;
+    }
+
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        std::runtime_error err = socketError("fork");
+        ::close(listen_fd);
+        throw err;
+    }
+    if (pid == 0) {
+        int status = 0;
+        try {
+            run_storage_server(listen_fd, link, true);
+        } catch (...) {
+            status = 1;
+        }
+        ::_exit(status);
+    }
+
+    ::close(listen_fd); // The child keeps its own copy; the connection is already queued.
+    std::unique_ptr<RemoteBackend> backend;
+    try {
+        backend.reset(new RemoteBackend("127.0.0.1", ntohs(addr.sin_port)));
+    } catch (...) {
+        ::kill(pid, SIGTERM);
+        ::waitpid(pid, nullptr, 0);
+        throw;
+    }
+    backend->server_pid = pid;
+    return backend;
+}
+
+RemoteBackend::~RemoteBackend() {
+    if (sock >= 0) {
+        if (server_pid > 0) {
+            // Our own server: ask it to exit.
+            RequestHeader req;
+            std::memset(&req, 0, sizeof(req));
+            req.op = OP_SHUTDOWN;
+            try {
+                sendAll(sock, &req, sizeof(req));
+                checkReply(sock);
+            } catch (...) {
+            }
+        }
+        ::close(sock);
+    }
+    if (server_pid > 0)
+        ::waitpid(server_pid, nullptr, 0);
+}
+
+void RemoteBackend::allocate(int num_buckets, int bucket_size, size_t record_bytes) {
+    if (num_buckets <= 0 || bucket_size <= 0)
+        throw std::invalid_argument("RemoteBackend requires a positive bucket count and size.");
+    RequestHeader req;
+    std::memset(&req, 0, sizeof(req));
+    req.op = OP_ALLOCATE;
+    req.bucket = num_buckets;
+    req.count = bucket_size;
+    req.record_bytes = record_bytes;
+    sendAll(sock, &req, sizeof(req));
+    checkReply(sock);
+    B = num_buckets;
+    Z = bucket_size;
+}
+
+void RemoteBackend::read_slots(int level, int bucket_index, int offset, int count, std::vector<std::string>& records) {
+    check_slots(bucket_index, offset, count);
+    RequestHeader req;
+    std::memset(&req, 0, sizeof(req));
+    req.op = OP_READ;
+    req.level = level;
+    req.bucket = bucket_index;
+    req.offset = offset;
+    req.count = count;
+    sendAll(sock, &req, sizeof(req));
+    checkReply(sock);
+    uint64_t bytes = 0;
+    recvRecords(sock, count, records, bytes);
+    counters.requests++;
+    for (const auto& r : records)
+        counters.bytes_read += r.size();
+}
+
+void RemoteBackend::write_slots(int level, int bucket_index, int offset, const std::vector<std::string>& records) {
+    int count = static_cast<int>(records.size());
+    check_slots(bucket_index, offset, count);
+    RequestHeader req;
+    std::memset(&req, 0, sizeof(req));
+    req.op = OP_WRITE;
+    req.level = level;
+    req.bucket = bucket_index;
+    req.offset = offset;
+    req.count = count;
+    std::string message(reinterpret_cast<const char*>(&req), sizeof(req));
+    for (const auto& r : records) {
+        appendRecord(message, r);
+        counters.bytes_written += r.size();
+    }
+    sendAll(sock, message.data(), message.size());
+    checkReply(sock);
+    counters.requests++;
+}
+
+// ----- Factory -----
+
+std::unique_ptr<StorageBackend> make_storage_backend(const std::string& spec) {
+    if (spec == "memory")
+        return std::unique_ptr<StorageBackend>(new MemoryBackend());
+    if (spec.compare(0, 5, "mmap:") == 0)
+        return std::unique_ptr<StorageBackend>(new MappedBackend(spec.substr(5)));
+    if (spec.compare(0, 7, "remote@") == 0) {
+        size_t colon = spec.rfind(':');
+        if (colon == std::string::npos || colon < 7)
+            throw std::invalid_argument("backend spec remote@<host>:<port> is missing the port.");
+        return std::unique_ptr<StorageBackend>(
+            new RemoteBackend(spec.substr(7, colon - 7), std::atoi(spec.c_str() + colon + 1)));
+    }
+    if (spec == "remote" || spec.compare(0, 7, "remote:") == 0) {
+        RemoteLink link;
+        if (spec.size() > 7) {
+            std::string params = spec.substr(7);
+            size_t colon = params.find(':');
+            link.latency_ms = std::atof(params.substr(0, colon).c_str());
+            if (colon != std::string::npos)
+                link.bandwidth_mbps = std::atof(params.substr(colon + 1).c_str());
+        }
+        return std::unique_ptr<StorageBackend>(RemoteBackend::spawn(link).release());
+    }
+    if (spec.empty())
+        throw std::invalid_argument("empty storage backend spec.");
+    return std::unique_ptr<StorageBackend>(new MappedBackend(spec));
+}
@@ -0,0 +1,122 @@
+#ifndef STORAGE_BACKEND_H
+#define STORAGE_BACKEND_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+#include "level_arena.h"
+#include "mapped_slot_store.h"
+
+/*
+ * StorageBackend:
+ * Where UntrustedMemory keeps encrypted buckets when it is not using its
+ * built-in level arena. A backend stores opaque records (one encoded,
+ * encrypted Element each) addressed by level, bucket and slot; each sort
+ * variant supplies the codec between its Element type and a record.
+ *
+ * Implementations:
+ *   - MemoryBackend: records in a double-buffered in-process arena;
+ *   - MappedBackend: records in fixed-size slots of a memory-mapped file;
+ *   - RemoteBackend: records held by a storage server process reached over a
+ *     socket, mirroring the Server class of client_server.py, with optional
+ *     per-request latency and bandwidth limits.
+ */
+struct BackendStats {
+    uint64_t requests = 0;       // read_slots/write_slots calls.
+    uint64_t bytes_read = 0;     // Record bytes returned to the caller.
+    uint64_t bytes_written = 0;  // Record bytes handed to the backend.
+};
+
+class StorageBackend {
+public:
+    virtual ~StorageBackend() {}
+
+    // Prepares B x Z slots for records of up to record_bytes bytes.
+    virtual void allocate(int num_buckets, int bucket_size, size_t record_bytes) = 0;
+    // Reads `count` records starting at slot `offset` of a bucket.
+    virtual void read_slots(int level, int bucket_index, int offset, int count,
+                            std::vector<std::string>& records) = 0;
+    // Writes records.size() records starting at slot `offset` of a bucket.
+    virtual void write_slots(int level, int bucket_index, int offset,
+                             const std::vector<std::string>& records) = 0;
+    virtual std::string name() const = 0;
+
+    int num_buckets() const { return B; }
+    int bucket_size() const { return Z; }
+    const BackendStats& stats() const { return counters; }
+
+protected:
+    StorageBackend() : B(0), Z(0) {}
+    // Validates a slot range against the allocated geometry.
+    void check_slots(int bucket_index, int offset, int count) const;
+
+    int B;
+    int Z;
+    BackendStats counters;
+};
+
+class MemoryBackend : public StorageBackend {
+public:
+    void allocate(int num_buckets, int bucket_size, size_t record_bytes);
+    void read_slots(int level, int bucket_index, int offset, int count, std::vector<std::string>& records);
+    void write_slots(int level, int bucket_index, int offset, const std::vector<std::string>& records);
+    std::string name() const { return "memory"; }
+
+private:
+    LevelArena<std::string> arena;
+};
+
+class MappedBackend : public StorageBackend {
+public:
+    // `path` is created at allocate() and removed when the backend is destroyed.
+    explicit MappedBackend(const std::string& path) : file_path(path) {}
+    void allocate(int num_buckets, int bucket_size, size_t record_bytes);
+    void read_slots(int level, int bucket_index, int offset, int count, std::vector<std::string>& records);
+    void write_slots(int level, int bucket_index, int offset, const std::vector<std::string>& records);
+    std::string name() const { return "mmap"; }
+
+private:
+    std::string file_path;
+    MappedSlotStore file;
+};
+
+// Simulated network between the client and the storage server.
+struct RemoteLink {
+    double latency_ms = 0;       // Added to every request.
+    double bandwidth_mbps = 0;   // Megabytes per second; 0 means unlimited.
+};
+
+class RemoteBackend : public StorageBackend {
+public:
+    // Connects to a storage server already listening on host:port.
+    RemoteBackend(const std::string& host, int port);
+    // Forks a storage server process on a loopback socket and connects to it.
+    static std::unique_ptr<RemoteBackend> spawn(const RemoteLink& link);
+    ~RemoteBackend();
+
+    void allocate(int num_buckets, int bucket_size, size_t record_bytes);
+    void read_slots(int level, int bucket_index, int offset, int count, std::vector<std::string>& records);
+    void write_slots(int level, int bucket_index, int offset, const std::vector<std::string>& records);
+    std::string name() const { return "remote"; }
+
+private:
+    RemoteBackend(const RemoteBackend&) = delete;
+    RemoteBackend& operator=(const RemoteBackend&) = delete;
+
+    int sock;
+    pid_t server_pid; // Child started by spawn(), or -1.
+};
+
+// Serves RemoteBackend clients accepted on `listen_fd`, one at a time, until
+// a client asks the server to shut down (or after one client if `once`).
+void run_storage_server(int listen_fd, const RemoteLink& link, bool once);
+
+// Builds a backend from a command-line spec:
+//   memory | mmap:<path> | remote:<latency_ms>[:<MBps>] | remote@<host>:<port> | <path> (same as mmap:<path>)
+std::unique_ptr<StorageBackend> make_storage_backend(const std::string& spec);
+
+#endif // STORAGE_BACKEND_H
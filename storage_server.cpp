@@ -0,0 +1,54 @@
+// storage_server: standalone untrusted storage server for RemoteBackend,
+// the C++ counterpart of client_server.py's Server.
+//
+//   storage_server <port> [latency_ms] [bandwidth_MBps]
+//
+// Clients connect with the backend spec remote@<host>:<port>. Latency is
+// added to every request and bandwidth (0 = unlimited) limits the bytes
+// moved per request, so a local run can stand in for a real deployment.
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "storage_backend.h"
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <port> [latency_ms] [bandwidth_MBps]\n";
+        return 1;
+    }
+    int port = std::atoi(argv[1]);
+    RemoteLink link;
+    if (argc > 2)
+        link.latency_ms = std::atof(argv[2]);
+    if (argc > 3)
+        link.bandwidth_mbps = std::atof(argv[3]);
+
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listen_fd, 4) != 0) {
+        std::cerr << "Error: cannot listen on port " << port << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    std::cout << "Storage server listening on port " << port << " (latency " << link.latency_ms
+              << " ms, bandwidth " << (link.bandwidth_mbps > 0 ? std::to_string(link.bandwidth_mbps) + " MB/s" : "unlimited")
+              << ")" << std::endl;
+    try {
+        run_storage_server(listen_fd, link, false);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    ::close(listen_fd);
+    return 0;
+}
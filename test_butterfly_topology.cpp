@@ -0,0 +1,136 @@
+// Test: every butterfly topology gives a uniformly random bin assignment.
+//
+//   test_butterfly_topology
+//
+// 1. Schedules (butterfly_topology.h), for L = 1 .. 10: every level reads and
+//    writes each bucket exactly once, the in-place blocks cover every bucket
+//    once, and routing any key from any starting bucket ends in bucket == key.
+//    So the final bin of an element is its key, drawn uniformly at random.
+// 2. The butterfly of oblivious_sort_two on each topology, level by level,
+//    as a dataflow graph, blocked and k-ary with AES records, and level by
+//    level and pipelined with the XOR keystream (xortwo): after the last
+//    level every real element sits in the bucket its key names, none is
+//    lost, and the bucket loads pass a chi-square test against the uniform
+//    distribution (butterfly_routing_check.h). test_butterfly_topology_<variant>
+//    checks the same for the other butterfly variants.
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include "oblivious_sort_two.h"
+#include "butterfly_routing_check.h"
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << "\n";
+        failures++;
+    }
+}
+
+static void checkSchedule(TopologyKind kind, int L) {
+    ButterflyTopology topo(kind, L);
+    int B = topo.buckets();
+    std::string name = std::string(topology_name(kind)) + " L=" + std::to_string(L);
+    // levels[level]: the pair nodes of `level`.
+    std::vector<std::vector<ButterflyNode>> levels;
+    for (int level = 0; level < L; level++) {
+        levels.push_back(topo.pairs(level));
+        std::vector<int> reads(B, 0), writes(B, 0);
+        for (const auto& node : levels.back()) {
+            for (int b : node.in)
+                reads[b]++;
+            for (int b : node.out)
+                writes[b]++;
+        }
+        for (int b = 0; b < B; b++)
+            check(reads[b] == 1 && writes[b] == 1, name + ": level " + std::to_string(level) + " does not read and write every bucket once");
+    }
+    if (topo.in_place())
+        for (int level = 0; level < L; level++)
+            for (int levels = 1; level + levels <= L; levels++) {
+                std::vector<int> covered(B, 0);
+                for (const auto& node : topo.block(level, levels))
+                    for (int b : node.in)
+                        covered[b]++;
+                for (int b = 0; b < B; b++)
+                    check(covered[b] == 1, name + ": block does not cover every bucket once");
+            }
+    for (int start = 0; start < B; start++)
+        for (int key = 0; key < B; key++) {
+            int bucket = start;
+            for (int level = 0; level < L; level++)
+                for (const auto& node : levels[level])
+                    if (node.in[0] == bucket || node.in[1] == bucket) {
+                        bucket = node.out[(key >> topo.key_bit(level)) & 1];
+                        break;
+                    }
+            if (bucket != key) {
+                check(false, name + ": key " + std::to_string(key) + " from bucket " + std::to_string(start) +
+                             " ends in bucket " + std::to_string(bucket));
+                return;
+            }
+        }
+}
+
+enum class Schedule { Levels, Dataflow, Pipelined };
+
+static const char* scheduleName(Schedule schedule) {
+    switch (schedule) {
+    case Schedule::Levels: return "levels";
+    case Schedule::Dataflow: return "dataflow";
+    default: return "pipelined";
+    }
+}
+
+template <typename Cipher>
+static void checkEnclave(TopologyKind kind, Schedule schedule, int block_levels, int arity_bits) {
+    const int n = 16384, Z = 64;
+    std::string name = std::string(Cipher::name()) + " " + topology_name(kind) + " " + scheduleName(schedule) +
+                       " block=" + std::to_string(block_levels) + " arity=" + std::to_string(arity_bits);
+    std::mt19937 gen(99);
+    std::vector<Element> input;
+    for (int i = 0; i < n; i++)
+        input.push_back(Element{ static_cast<int>(gen() % 1000000), 0, false, "p" + std::to_string(i) });
+
+    UntrustedMemory untrusted;
+    Enclave<Cipher> enclave(&untrusted, 2024);
+    enclave.topology = kind;
+    enclave.block_levels = block_levels;
+    enclave.arity_bits = arity_bits;
+    enclave.merge_threads = 2;
+    std::pair<int, int> params = enclave.computeBucketParameters(n, Z);
+    int B = params.first, L = params.second;
+    enclave.initializeBuckets(input, B, Z);
+    if (schedule == Schedule::Dataflow)
+        enclave.performButterflyNetworkDataflow(B, L, Z);
+    else if (schedule == Schedule::Pipelined)
+        enclave.performButterflyNetworkPipelined(B, L, Z);
+    else
+        enclave.performButterflyNetwork(B, L, Z);
+
+    std::string error = butterfly_routing_error(enclave, n, B, L, Z);
+    check(error.empty(), name + ": " + error);
+}
+
+int main() {
+    const TopologyKind kinds[] = { TopologyKind::Standard, TopologyKind::BitReversed, TopologyKind::InPlace };
+    for (TopologyKind kind : kinds)
+        for (int L = 1; L <= 10; L++)
+            checkSchedule(kind, L);
+    for (TopologyKind kind : kinds) {
+        checkEnclave<AesCtrPolicy>(kind, Schedule::Levels, 1, 1);
+        checkEnclave<AesCtrPolicy>(kind, Schedule::Dataflow, 1, 1);
+        checkEnclave<XorPolicy>(kind, Schedule::Levels, 1, 1);
+        checkEnclave<XorPolicy>(kind, Schedule::Pipelined, 1, 1);
+    }
+    checkEnclave<AesCtrPolicy>(TopologyKind::InPlace, Schedule::Levels, 4, 1);
+    checkEnclave<AesCtrPolicy>(TopologyKind::InPlace, Schedule::Dataflow, 3, 1);
+    checkEnclave<AesCtrPolicy>(TopologyKind::InPlace, Schedule::Levels, 4, 2);
+    checkEnclave<AesCtrPolicy>(TopologyKind::InPlace, Schedule::Dataflow, 0, 3);
+
+    if (failures == 0)
+        std::cout << "All butterfly topology checks passed.\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * ThreadPool:
+ * A fixed set of worker threads that is kept for many parallel loops, so a
+ * butterfly level does not pay for thread start-up on every loop.
+ * run(n, body) calls body(i, worker) for every i in [0, n) and returns when all
+ * are done. The caller is worker 0 and the pool's threads are 1 .. size() - 1,
+ * so per-worker state (an RNG, a cipher lease, scratch buffers) can be kept in
+ * a vector indexed by `worker`. Indices are handed out one at a time, so which
+ * worker runs which index varies from run to run; bodies that must give the
+ * same result every time may depend on i but not on worker.
+ *
+ * One run() at a time. A run() made from inside a body (of any pool) runs
+ * serially on the calling thread, so code that parallelizes its own inner
+ * loops can itself be called from a pool. The first exception thrown by a
+ * body stops the remaining indices from being handed out and is rethrown by
+ * run() once every worker is idle again.
+ */
+class ThreadPool {
+public:
+    // `threads` in all, counting the caller of run(): threads - 1 are started.
+    explicit ThreadPool(int threads)
+        : job(nullptr), count(0), next(0), helpers(0), active(0), generation(0), stopping(false) {
+        for (int w = 1; w < std::max(threads, 1); w++)
+            workers.emplace_back(&ThreadPool::serve, this, w);
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers)
+            t.join();
+    }
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    template <typename F>
+    void run(size_t n, F body) {
+        run(n, size(), body);
+    }
+
+    // As above, on at most `max_threads` of the workers (the caller included).
+    template <typename F>
+    void run(size_t n, int max_threads, F body) {
+        size_t used = std::min(n, static_cast<size_t>(std::max(1, std::min(max_threads, size()))));
+        if (used <= 1 || inside_body()) {
+            for (size_t i = 0; i < n; i++)
+                body(i, 0);
+            return;
+        }
+        std::function<void(size_t, int)> task(body);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &task;
+            count = n;
+            next = 0;
+            error = nullptr;
+            helpers = static_cast<int>(used) - 1;
+            active = helpers;
+            generation++;
+        }
+        wake.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return active == 0; });
+        job = nullptr;
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Set while this thread runs a body, to keep nested run() calls serial.
+    static bool& inside_body() {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    void work(int worker) {
+        inside_body() = true;
+        for (size_t i; (i = next++) < count; ) {
+            try {
+                (*job)(i, worker);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                next = count;
+            }
+        }
+        inside_body() = false;
+    }
+
+    void serve(int worker) {
+        unsigned seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                if (worker > helpers)
+                    continue;
+            }
+            work(worker);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                active--;
+            }
+            done.notify_one();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(size_t, int)>* job;
+    size_t count;
+    std::atomic<size_t> next;
+    int helpers;
+    int active;
+    unsigned generation;
+    bool stopping;
+    std::exception_ptr error;
+    std::vector<std::thread> workers; // Declared last so they start after the state above.
+};
+
+#endif // THREAD_POOL_H
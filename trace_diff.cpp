@@ -0,0 +1,91 @@
+// trace_diff: checks that two runs touched untrusted memory identically.
+//
+//   trace_diff <a.trace> <b.trace>
+//       Compares two traces saved with AccessTrace::save.
+//   trace_diff --run <a.json> <b.json> [bucket_size]
+//       Sorts both inputs (two-column json, as for bucket_sort_xortwo) with the
+//       XOR butterfly sort and compares the access traces of the two runs.
+//       Pass --save to also write them to a.json.trace and b.json.trace.
+//
+// For an oblivious sort the traces of two inputs with the same number of rows
+// must be identical. Exit status: 0 identical, 1 different, 2 error.
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include "nlohmann/json.hpp"
+#include "oblivious_sort_two.h"
+
+using json = nlohmann::json;
+
+static std::vector<Element> loadRows(const std::string& path) {
+    std::ifstream ifs(path);
+    if (!ifs.is_open())
+        throw std::runtime_error("could not open " + path);
+    json j;
+    ifs >> j;
+    std::vector<Element> rows;
+    for (const auto& row : j)
+        rows.push_back(Element{ row["sorting"].get<int>(), 0, false, row["payload"].get<std::string>() });
+    return rows;
+}
+
+static AccessTrace traceSort(const std::vector<Element>& rows, int bucket_size) {
+    UntrustedMemory untrusted;
+    Enclave<XorPolicy> enclave(&untrusted);
+    enclave.oblivious_sort(rows, bucket_size);
+    return untrusted.trace;
+}
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <a.trace> <b.trace>\n"
+              << "       " << prog << " --run <a.json> <b.json> [bucket_size] [--save]\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    bool save = false;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--save") {
+            save = true;
+            args.erase(args.begin() + i);
+            break;
+        }
+    }
+
+    try {
+        AccessTrace a, b;
+        if (!args.empty() && args[0] == "--run") {
+            if (args.size() < 3) {
+                usage(argv[0]);
+                return 2;
+            }
+            int bucket_size = args.size() > 3 ? std::atoi(args[3].c_str()) : 256;
+            std::vector<Element> rows_a = loadRows(args[1]);
+            std::vector<Element> rows_b = loadRows(args[2]);
+            if (rows_a.size() != rows_b.size())
+                std::cerr << "Warning: inputs have " << rows_a.size() << " and " << rows_b.size()
+                          << " rows; only the input size may show in the trace.\n";
+            a = traceSort(rows_a, bucket_size);
+            b = traceSort(rows_b, bucket_size);
+            if (save) {
+                a.save(args[1] + ".trace");
+                b.save(args[2] + ".trace");
+            }
+        } else if (args.size() == 2) {
+            a = AccessTrace::load(args[0]);
+            b = AccessTrace::load(args[1]);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+
+        TraceDiff diff = compare_traces(a, b);
+        std::cout << (diff.identical ? "IDENTICAL: " : "DIFFERENT: ") << diff.detail << "\n";
+        return diff.identical ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
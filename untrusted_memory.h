@@ -0,0 +1,286 @@
+#ifndef UNTRUSTED_MEMORY_H
+#define UNTRUSTED_MEMORY_H
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+#include "level_arena.h"
+#include "access_trace.h"
+#include "storage_backend.h"
+#include "bucket_batch.h"
+
+/*
+ * UntrustedBuckets:
+ * The untrusted memory of the butterfly variants: B x Z buckets of encrypted
+ * elements per level, kept in a LevelArena or, when a backend is given, in a
+ * StorageBackend as encoded records. Every access is recorded in the access
+ * trace and every call counts as one enclave transition.
+ *
+ * Element is the variant's element type. Records says how an element is
+ * stored by a backend:
+ *     static size_t bytes(const Element&)             bytes the element holds
+ *     static std::string encode(const Element&)       its backend record
+ *     static Element decode(const std::string&)       and back
+ * Each variant names its instance UntrustedMemory.
+ */
+template <typename Element, typename Records>
+class UntrustedBuckets {
+public:
+    LevelArena<Element> storage; // Two B x Z slabs, alternating between even and odd levels.
+    mutable AccessTrace trace; // Binary record of every bucket access (see access_trace.h).
+    // Bytes copied out of / into storage by the copying read/write functions.
+    size_t bytes_copied = 0;
+    // Optional pluggable storage (see storage_backend.h). When set, buckets
+    // are kept there as encoded records instead of in `storage`, and the
+    // enclave goes through the copying read/write functions.
+    StorageBackend* backend = nullptr;
+    size_t backend_record_bytes = 0;
+    mutable TransitionStats transitions; // Calls into this object (see bucket_batch.h).
+
+    // Preallocates B buckets of Z elements.
+    void allocate(int B, int Z) {
+        if (has_backend())
+            backend->allocate(B, Z, backend_record_bytes);
+        else
+            storage.reset(B, Z);
+    }
+
+    // Routes every bucket through `b` (which must outlive this object), with
+    // records of up to record_bytes bytes (see the enclave's recordBytes).
+    void use_backend(StorageBackend* b, size_t record_bytes) {
+        backend = b;
+        backend_record_bytes = record_bytes;
+    }
+    bool has_backend() const { return backend != nullptr; }
+    int bucket_size() const { return backend ? backend->bucket_size() : storage.bucket_size(); }
+
+    std::vector<Element> read_bucket(int level, int bucket_index) {
+        transitions.count(1);
+        return readRange(BucketRange{ level, bucket_index, 0, bucket_size() });
+    }
+    void write_bucket(int level, int bucket_index, const std::vector<Element>& bucket) {
+        transitions.count(1);
+        writeRange(BucketRange{ level, bucket_index, 0, bucket_size() }, bucket);
+    }
+    // Block-based I/O for streaming operations.
+    std::vector<Element> read_bucket_block(int level, int bucket_index, int offset, int block_size) {
+        transitions.count(1);
+        return readRange(BucketRange{ level, bucket_index, offset, block_size });
+    }
+    void write_bucket_block(int level, int bucket_index, int offset, const std::vector<Element>& block) {
+        transitions.count(1);
+        writeRange(BucketRange{ level, bucket_index, offset, static_cast<int>(block.size()) }, block);
+    }
+
+    // Zero-copy access: views into the level arena instead of copies.
+    BucketView<const Element> view_bucket(int level, int bucket_index) const {
+        transitions.count(1);
+        return viewRange(BucketRange{ level, bucket_index, 0, bucket_size() });
+    }
+    BucketView<Element> bucket_slot(int level, int bucket_index) {
+        transitions.count(1);
+        return slotRange(BucketRange{ level, bucket_index, 0, bucket_size() });
+    }
+    BucketView<const Element> view_bucket_block(int level, int bucket_index, int offset, int block_size) const {
+        transitions.count(1);
+        return viewRange(BucketRange{ level, bucket_index, offset, block_size });
+    }
+    BucketView<Element> bucket_slot_block(int level, int bucket_index, int offset, int block_size) {
+        transitions.count(1);
+        return slotRange(BucketRange{ level, bucket_index, offset, block_size });
+    }
+
+    // Vectored access: a whole list of ranges in one call (one transition).
+    std::vector<std::vector<Element>> read_buckets(const std::vector<BucketRange>& ranges) {
+        transitions.count(ranges.size());
+        std::vector<std::vector<Element>> blocks;
+        blocks.reserve(ranges.size());
+        for (const auto& r : ranges)
+            blocks.push_back(readRange(r));
+        return blocks;
+    }
+    void write_buckets(const std::vector<BucketRange>& ranges, const std::vector<std::vector<Element>>& blocks) {
+        if (blocks.size() != ranges.size())
+            throw std::invalid_argument("write_buckets: need one block per range.");
+        transitions.count(ranges.size());
+        for (size_t k = 0; k < ranges.size(); k++)
+            writeRange(ranges[k], blocks[k]);
+    }
+    std::vector<BucketView<const Element>> view_buckets(const std::vector<BucketRange>& ranges) const {
+        transitions.count(ranges.size());
+        std::vector<BucketView<const Element>> views;
+        views.reserve(ranges.size());
+        for (const auto& r : ranges)
+            views.push_back(viewRange(r));
+        return views;
+    }
+    std::vector<BucketView<Element>> bucket_slots(const std::vector<BucketRange>& ranges) {
+        transitions.count(ranges.size());
+        std::vector<BucketView<Element>> slots;
+        slots.reserve(ranges.size());
+        for (const auto& r : ranges)
+            slots.push_back(slotRange(r));
+        return slots;
+    }
+
+    std::vector<std::string> get_access_log() {
+        return trace.to_strings();
+    }
+
+    // A bucket's fixed-width records packed back to back (Z * record width
+    // bytes), so it can be memcpy'd or sent in bulk.
+    std::string export_bucket(int level, int bucket_index) const {
+        transitions.count(1);
+        trace.record(TRACE_READ, level, bucket_index, 0, bucket_size());
+        std::vector<std::string> records;
+        if (has_backend()) {
+            backend->read_slots(level, bucket_index, 0, backend->bucket_size(), records);
+        } else {
+            for (const auto& e : storage.read_view(level, bucket_index))
+                records.push_back(Records::encode(e));
+        }
+        size_t width = records.empty() ? 0 : records[0].size();
+        std::string bytes;
+        bytes.reserve(width * records.size());
+        for (const auto& r : records) {
+            if (r.size() != width)
+                throw std::runtime_error("export_bucket: records do not have a fixed width.");
+            bytes.append(r);
+        }
+        return bytes;
+    }
+    void import_bucket(int level, int bucket_index, const std::string& bytes) {
+        transitions.count(1);
+        trace.record(TRACE_WRITE, level, bucket_index, 0, bucket_size());
+        int Z = bucket_size();
+        if (Z <= 0 || bytes.size() % Z != 0)
+            throw std::invalid_argument("import_bucket: byte count is not a multiple of the bucket size.");
+        size_t width = bytes.size() / Z;
+        if (has_backend()) {
+            std::vector<std::string> records(Z);
+            for (int s = 0; s < Z; s++)
+                records[s] = bytes.substr(s * width, width);
+            backend->write_slots(level, bucket_index, 0, records);
+            return;
+        }
+        BucketView<Element> slot = storage.write_view(level, bucket_index);
+        for (int s = 0; s < Z; s++)
+            slot[s] = Records::decode(bytes.substr(s * width, width));
+    }
+
+private:
+    // Single-range workers behind the public functions; they record the
+    // access trace but leave transition counting to the caller.
+    std::vector<Element> readRange(const BucketRange& r) {
+        trace.record(TRACE_READ, r.level, r.bucket, r.offset, r.length);
+        if (has_backend()) {
+            int count = std::max(0, std::min(r.length, backend->bucket_size() - r.offset));
+            std::vector<std::string> records;
+            backend->read_slots(r.level, r.bucket, r.offset, count, records);
+            std::vector<Element> block;
+            block.reserve(records.size());
+            for (const auto& record : records) {
+                block.push_back(Records::decode(record));
+                bytes_copied += Records::bytes(block.back());
+            }
+            return block;
+        }
+        BucketView<const Element> block = storage.read_view(r.level, r.bucket).subview(r.offset, r.length);
+        for (const auto& e : block)
+            bytes_copied += Records::bytes(e);
+        return std::vector<Element>(block.begin(), block.end());
+    }
+
+    void writeRange(const BucketRange& r, const std::vector<Element>& block) {
+        trace.record(TRACE_WRITE, r.level, r.bucket, r.offset, r.length);
+        if (block.size() != static_cast<size_t>(r.length))
+            throw std::invalid_argument("write_bucket: block size does not match the range.");
+        if (r.offset < 0 || r.offset + r.length > bucket_size())
+            throw std::out_of_range("write_bucket: range does not fit in the bucket.");
+        if (has_backend()) {
+            std::vector<std::string> records;
+            records.reserve(block.size());
+            for (const auto& e : block) {
+                records.push_back(Records::encode(e));
+                bytes_copied += Records::bytes(e);
+            }
+            backend->write_slots(r.level, r.bucket, r.offset, records);
+            return;
+        }
+        for (const auto& e : block)
+            bytes_copied += Records::bytes(e);
+        std::copy(block.begin(), block.end(), storage.write_slot(r.level, r.bucket) + r.offset);
+    }
+
+    BucketView<const Element> viewRange(const BucketRange& r) const {
+        trace.record(TRACE_READ, r.level, r.bucket, r.offset, r.length);
+        if (has_backend())
+            throw std::logic_error("view_bucket: not available with a storage backend.");
+        return storage.read_view(r.level, r.bucket).subview(r.offset, r.length);
+    }
+
+    BucketView<Element> slotRange(const BucketRange& r) {
+        trace.record(TRACE_WRITE, r.level, r.bucket, r.offset, r.length);
+        if (has_backend())
+            throw std::logic_error("bucket_slot: not available with a storage backend.");
+        if (r.offset < 0 || r.length < 0 || r.offset + r.length > storage.bucket_size())
+            throw std::out_of_range("bucket_slot: range does not fit in the bucket.");
+        return storage.write_view(r.level, r.bucket).subview(r.offset, r.length);
+    }
+};
+
+/*
+ * SealedRecords:
+ * Records of the AES variants. An encrypted element only carries its blob in
+ * `payload` (the cleartext fields are zeroed), so its record is the blob.
+ */
+template <typename Element>
+struct SealedRecords {
+    static size_t bytes(const Element& e) { return sizeof(Element) + e.payload.size(); }
+    static std::string encode(const Element& e) { return e.payload; }
+    static Element decode(const std::string& record) {
+        Element e = Element();
+        e.payload = record;
+        return e;
+    }
+};
+
+/*
+ * XorRecords:
+ * Records of the XOR variants, whose encryption keeps every field of the
+ * element: the (encrypted) sorting and key, the dummy flag and the payload.
+ */
+template <typename Element>
+struct XorRecords {
+    static const size_t kHeaderBytes = 2 * sizeof(int) + sizeof(char);
+
+    // Record bytes for payloads of up to max_payload bytes.
+    static size_t size(size_t max_payload) { return kHeaderBytes + max_payload; }
+    static size_t bytes(const Element& e) { return sizeof(Element) + e.payload.size(); }
+    static std::string encode(const Element& e) {
+        std::string out;
+        out.reserve(kHeaderBytes + e.payload.size());
+        out.append(reinterpret_cast<const char*>(&e.sorting), sizeof(e.sorting));
+        out.append(reinterpret_cast<const char*>(&e.key), sizeof(e.key));
+        char flag = e.is_dummy ? 1 : 0;
+        out.append(&flag, sizeof(flag));
+        out.append(e.payload);
+        return out;
+    }
+    static Element decode(const std::string& record) {
+        if (record.size() < kHeaderBytes)
+            throw std::runtime_error("decodeRecord: truncated record.");
+        Element e = Element();
+        std::memcpy(&e.sorting, record.data(), sizeof(e.sorting));
+        std::memcpy(&e.key, record.data() + sizeof(e.sorting), sizeof(e.key));
+        e.is_dummy = record[2 * sizeof(int)] != 0;
+        e.payload = record.substr(kHeaderBytes);
+        return e;
+    }
+};
+
+#endif // UNTRUSTED_MEMORY_H
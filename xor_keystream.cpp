@@ -0,0 +1,155 @@
+#include "xor_keystream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define XOR_KEYSTREAM_X86 1
+#endif
+
+namespace {
+    // Stream bytes generated per kernel call in XorKeystream::apply.
+    const size_t kChunkBytes = 1024;
+
+    // splitmix64: expands the 64-bit key into the ChaCha20 key.
+    uint64_t nextWord(uint64_t& state) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    struct ExpandedKey {
+        uint8_t bytes[ChaCha20::kKeyBytes];
+        explicit ExpandedKey(uint64_t key) {
+            for (size_t i = 0; i < sizeof(bytes); i += sizeof(uint64_t)) {
+                uint64_t word = nextWord(key);
+                std::memcpy(bytes + i, &word, sizeof(word));
+            }
+        }
+    };
+
+    void putBE(uint8_t* out, uint32_t value, int bytes) {
+        for (int i = bytes - 1; i >= 0; i--) {
+            out[i] = static_cast<uint8_t>(value);
+            value >>= 8;
+        }
+    }
+
+    void xorScalar(uint8_t* dst, const uint8_t* src, size_t len) {
+        for (size_t i = 0; i < len; i++)
+            dst[i] ^= src[i];
+    }
+
+#ifdef XOR_KEYSTREAM_X86
+    // Unaligned loads and stores: payload strings have no alignment to offer.
+    __attribute__((target("sse2")))
+    void xorSSE2(uint8_t* dst, const uint8_t* src, size_t len) {
+        size_t i = 0;
+        for (; i + 16 <= len; i += 16) {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, s));
+        }
+        xorScalar(dst + i, src + i, len - i);
+    }
+
+    __attribute__((target("avx2")))
+    void xorAVX2(uint8_t* dst, const uint8_t* src, size_t len) {
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(d, s));
+        }
+        xorSSE2(dst + i, src + i, len - i);
+    }
+#endif
+} // anonymous namespace
+
+const char* xor_kernel_name(XorKernel kernel) {
+    switch (kernel) {
+    case XorKernel::AVX2: return "avx2";
+    case XorKernel::SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+bool xor_kernel_supported(XorKernel kernel) {
+#ifdef XOR_KEYSTREAM_X86
+    __builtin_cpu_init();
+#endif
+    switch (kernel) {
+#ifdef XOR_KEYSTREAM_X86
+    case XorKernel::AVX2: return __builtin_cpu_supports("avx2");
+    case XorKernel::SSE2: return __builtin_cpu_supports("sse2");
+#else
+    case XorKernel::AVX2:
+    case XorKernel::SSE2: return false;
+#endif
+    default: return true;
+    }
+}
+
+XorKernel best_xor_kernel() {
+    if (xor_kernel_supported(XorKernel::AVX2))
+        return XorKernel::AVX2;
+    if (xor_kernel_supported(XorKernel::SSE2))
+        return XorKernel::SSE2;
+    return XorKernel::Scalar;
+}
+
+void xor_bytes(uint8_t* dst, const uint8_t* src, size_t len, XorKernel kernel) {
+    switch (kernel) {
+#ifdef XOR_KEYSTREAM_X86
+    case XorKernel::AVX2: xorAVX2(dst, src, len); return;
+    case XorKernel::SSE2: xorSSE2(dst, src, len); return;
+#else
+    case XorKernel::AVX2:
+    case XorKernel::SSE2: throw std::invalid_argument("xor_bytes: SIMD kernel not built for this CPU.");
+#endif
+    default: xorScalar(dst, src, len); return;
+    }
+}
+
+XorKeystream::XorKeystream(uint64_t key) : XorKeystream(key, best_xor_kernel()) {}
+
+XorKeystream::XorKeystream(uint64_t key, XorKernel kernel) : prf(ExpandedKey(key).bytes), selected(kernel) {
+    if (!xor_kernel_supported(kernel))
+        throw std::invalid_argument(std::string("XorKeystream: kernel not supported here: ") + xor_kernel_name(kernel));
+}
+
+void XorKeystream::apply(uint8_t* data, size_t len, const Nonce& nonce, uint64_t offset) const {
+    alignas(32) uint8_t stream[kChunkBytes];
+    while (len > 0) {
+        size_t chunk = std::min(len, kChunkBytes);
+        std::memset(stream, 0, chunk);
+        prf.process(stream, chunk, nonce.bytes, offset);
+        xor_bytes(data, stream, chunk, selected);
+        data += chunk;
+        len -= chunk;
+        offset += chunk;
+    }
+}
+
+void XorKeystream::apply(std::string& buffer, const Nonce& nonce, uint64_t offset) const {
+    if (!buffer.empty())
+        apply(reinterpret_cast<uint8_t*>(&buffer[0]), buffer.size(), nonce, offset);
+}
+
+XorKeystream::Nonce XorKeystream::nonce(uint32_t run, uint32_t epoch, int level, int bucket) {
+    if (level < 0 || level > 0xFF || bucket < 0 || bucket > 0xFFFFFF)
+        throw std::out_of_range("XorKeystream: level or bucket does not fit the nonce.");
+    Nonce n;
+    putBE(n.bytes, run, 4);
+    putBE(n.bytes + 4, epoch, 4);
+    putBE(n.bytes + 8, static_cast<uint32_t>(level), 1);
+    putBE(n.bytes + 9, static_cast<uint32_t>(bucket), 3);
+    return n;
+}
+
+XorKeystream::Nonce XorKeystream::position_nonce(int level, int bucket, int first_slot) {
+    return nonce(0, static_cast<uint32_t>(first_slot), level, bucket);
+}
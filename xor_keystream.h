@@ -0,0 +1,70 @@
+#ifndef XOR_KEYSTREAM_H
+#define XOR_KEYSTREAM_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "chacha20.h"
+
+/*
+ * XorKeystream:
+ * The cipher of the XOR variants (xortwo through XorPolicy, xormerge,
+ * xorconstant, string): counter-mode ChaCha20 (chacha20.h) under a key
+ * expanded from the variant's 64-bit key. Byte i of the stream of a 96-bit
+ * nonce is byte i mod 64 of the block with counter i / 64, so the stream is
+ * a function of (key, nonce, counter) with no period: different nonces or
+ * offsets never share keystream. xortwo takes its nonce from the record
+ * nonce (run, epoch, level, bucket, see bucket_cipher.h). The other
+ * variants run the payloads of a stored range through it as one packed
+ * stream under position_nonce() of the range, each payload starting where
+ * the previous one ended; they keep no write epochs, so a range rewritten in
+ * place within one sort (xorconstant's merge passes) is XORed with the same
+ * stream again.
+ *
+ * The stream is generated into a buffer and XORed in 32-byte (AVX2) or
+ * 16-byte (SSE2) strides where the CPU has them, picked once at run time,
+ * and byte by byte otherwise.
+ */
+enum class XorKernel { Scalar, SSE2, AVX2 };
+
+// Name of a kernel, and whether this CPU (and build) can run it.
+const char* xor_kernel_name(XorKernel kernel);
+bool xor_kernel_supported(XorKernel kernel);
+// The widest supported kernel.
+XorKernel best_xor_kernel();
+
+// dst[i] ^= src[i] for i < len, with the given kernel (which must be supported).
+void xor_bytes(uint8_t* dst, const uint8_t* src, size_t len, XorKernel kernel);
+
+class XorKeystream {
+public:
+    struct Nonce {
+        uint8_t bytes[ChaCha20::kNonceBytes];
+    };
+
+    // Uses best_xor_kernel(), or `kernel` (std::invalid_argument if unsupported).
+    explicit XorKeystream(uint64_t key);
+    XorKeystream(uint64_t key, XorKernel kernel);
+
+    // XORs `len` bytes in place (encrypts and decrypts) with the stream of
+    // `nonce`, starting `offset` bytes in. Throws std::out_of_range past the
+    // 2^32 blocks of one nonce.
+    void apply(uint8_t* data, size_t len, const Nonce& nonce, uint64_t offset = 0) const;
+    void apply(std::string& buffer, const Nonce& nonce, uint64_t offset = 0) const;
+
+    // run id | epoch | level (8 bits) | bucket (24 bits), laid out as
+    // BucketCipher's nonces.
+    static Nonce nonce(uint32_t run, uint32_t epoch, int level, int bucket);
+    // Nonce of the range that starts at slot `first_slot` of bucket (level,
+    // bucket): run 0, which XorPolicy never hands out, and the slot as epoch.
+    static Nonce position_nonce(int level, int bucket, int first_slot);
+
+    XorKernel kernel() const { return selected; }
+
+private:
+    ChaCha20 prf;
+    XorKernel selected;
+};
+
+#endif // XOR_KEYSTREAM_H